@@ -0,0 +1,63 @@
+#include "BagCamera.hpp"
+
+BagCamera::BagCamera(const std::string &file_name, const std::string &serial_number, bool repeat, bool real_time) :
+        BagCamera(rs2::context().load_device(file_name), file_name, serial_number, repeat, real_time) {}
+
+BagCamera::BagCamera(rs2::playback recording, const std::string &file_name, const std::string &serial_number,
+                     bool repeat, bool real_time) :
+        RealSenseD400(recording, serial_number.empty() ?
+                                 std::string(recording.get_info(RS2_CAMERA_INFO_SERIAL_NUMBER)) : serial_number),
+        file_name_(file_name) {
+    std::cout << "Camera " << serial_number_ << ": Replaying " << file_name_ << (repeat ? " (repeating)" : "")
+              << std::endl;
+
+    // Play back every recorded stream, the recording fixes the resolution and frame rate
+    cfg.enable_device_from_file(file_name_, repeat);
+    selection = pipe_.start(cfg);
+    pipeline_started_ = true;
+
+    // Use the device the pipeline plays back from, the one used to read the serial number is not streaming
+    rs2::playback playback = selection.get_device();
+    playback.set_real_time(real_time);
+    dev_ = playback;
+    depth_sensor_ = dev_.first<rs2::depth_sensor>();
+
+    int d_fps = selection.get_stream(RS2_STREAM_DEPTH).fps();
+    int c_fps = selection.get_stream(RS2_STREAM_COLOR).fps();
+    SetFramePeriods(d_fps, c_fps);
+    StartupStage("pipeline");
+
+    Open();
+}
+
+const void BagCamera::SetLaser(bool status, float power) {
+    std::cerr << "Camera " << serial_number_ << ": Laser can not be set while replaying " << file_name_ << std::endl;
+}
+
+bool BagCamera::SetPairedCapture(bool enabled) {
+    std::cerr << "Camera " << serial_number_ << ": Emitter can not be set while replaying " << file_name_ << std::endl;
+    return false;
+}
+
+bool BagCamera::SetExposureBracket(bool enabled) {
+    if (!enabled)
+        return true;
+    std::cerr << "Camera " << serial_number_ << ": Exposure can not be set while replaying " << file_name_ << std::endl;
+    return false;
+}
+
+bool BagCamera::StartRecording() {
+    std::cerr << "Camera " << serial_number_ << ": Already a recording, copy " << file_name_ << " instead" << std::endl;
+    return false;
+}
+
+bool BagCamera::RestartStreams() {
+    std::cerr << "Camera " << serial_number_ << ": Streams are fixed by " << file_name_
+              << ", ignoring new stream settings" << std::endl;
+    return false;
+}
+
+bool BagCamera::WasRemoved(const rs2::event_information &info) {
+    // Recordings are never unplugged
+    return false;
+}
@@ -1,15 +1,39 @@
 #include <iostream>
+#include <stdexcept>
 
 #include "ConfigManager.hpp"
 
-ConfigManager *ConfigManager::self_ = nullptr;
+std::atomic<ConfigManager *> ConfigManager::self_{nullptr};
 std::mutex ConfigManager::singleton_lock_;
 
+ConfigSnapshot::ConfigSnapshot(nlohmann::json config, uint64_t version) : config_(std::move(config)),
+                                                                          version_(version) {}
+
+const nlohmann::json &ConfigSnapshot::operator[](const std::string &key) const {
+    static const nlohmann::json null;
+    if (!config_.is_object())
+        return null;
+    auto value = config_.find(key);
+    return value == config_.end() ? null : *value;
+}
+
+const nlohmann::json &ConfigSnapshot::Json() const {
+    return config_;
+}
+
+uint64_t ConfigSnapshot::Version() const {
+    return version_;
+}
+
 ConfigManager *ConfigManager::GetInstance() {
-    std::lock_guard<std::mutex> lock(singleton_lock_);
+    // Created once, every later call is a single load
+    ConfigManager *instance = self_.load(std::memory_order_acquire);
+    if (instance != nullptr)
+        return instance;
 
-    if (self_ == nullptr)
-        self_ = new ConfigManager();
+    std::lock_guard<std::mutex> lock(singleton_lock_);
+    if (self_.load(std::memory_order_relaxed) == nullptr)
+        self_.store(new ConfigManager(), std::memory_order_release);
 
     return self_;
 }
@@ -17,11 +41,12 @@ ConfigManager *ConfigManager::GetInstance() {
 ConfigManager *ConfigManager::GetInstance(std::string path) {
     std::lock_guard<std::mutex> lock(singleton_lock_);
 
-    if (self_ == nullptr)
-        self_ = new ConfigManager(path);
-    else if(self_->path_ != path) {
-        self_->path_ = path;
-        self_->Load();
+    ConfigManager *instance = self_.load(std::memory_order_relaxed);
+    if (instance == nullptr) {
+        self_.store(new ConfigManager(path), std::memory_order_release);
+    } else if(instance->path_ != path) {
+        instance->path_ = path;
+        instance->Load();
     }
 
     return self_;
@@ -43,21 +68,121 @@ ConfigManager::~ConfigManager() {
 }
 
 void ConfigManager::Load() {
+    nlohmann::json config;
     std::ifstream in(path_);
     in >> config;
     in.close();
+
+    std::lock_guard<std::mutex> lock(write_lock_);
+    file_ = config;
+    runtime_ = nlohmann::json::object();
+    Publish(std::move(config));
+}
+
+bool ConfigManager::Reload(const std::function<void(const nlohmann::json &)> &validate) {
+    nlohmann::json file;
+    try {
+        std::ifstream in(path_);
+        in >> file;
+        if (!file.is_object())
+            throw std::invalid_argument("expected an object");
+    } catch (const std::exception &e) {
+        std::cerr << "Config: Could not read " << path_ << " (" << e.what() << "), keeping the current settings"
+                  << std::endl;
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(write_lock_);
+
+    // A key Set at run time (e.g. a new dataset name) stays until the file changes that key itself
+    nlohmann::json runtime = nlohmann::json::object();
+    for (auto it = runtime_.begin(); it != runtime_.end(); ++it) {
+        auto before = file_.find(it.key()), after = file.find(it.key());
+        bool file_changed = (before == file_.end()) != (after == file.end()) ||
+                            (before != file_.end() && *before != *after);
+        if (!file_changed)
+            runtime[it.key()] = it.value();
+    }
+
+    nlohmann::json config = file;
+    for (auto it = runtime.begin(); it != runtime.end(); ++it)
+        config[it.key()] = it.value();
+
+    try {
+        if (validate)
+            validate(config);
+    } catch (const std::exception &e) {
+        std::cerr << "Config: " << path_ << " rejected, keeping the current settings\n" << e.what() << std::endl;
+        return false;
+    }
+
+    file_ = std::move(file);
+    runtime_ = std::move(runtime);
+    if (config == GetShared()->Json())
+        return false;
+    Publish(std::move(config));
+    return true;
+}
+
+void ConfigManager::Update(const std::string &key, nlohmann::json value) {
+    // Writers serialise among themselves, readers keep using the version they hold
+    std::lock_guard<std::mutex> lock(write_lock_);
+    nlohmann::json config = GetShared()->Json();
+    runtime_[key] = value;
+    config[key] = std::move(value);
+    Publish(std::move(config));
+}
+
+void ConfigManager::Publish(nlohmann::json config) {
+    uint64_t version = version_.load(std::memory_order_relaxed) + 1;
+    std::atomic_store(&current_, std::shared_ptr<const ConfigSnapshot>(
+            std::make_shared<ConfigSnapshot>(std::move(config), version)));
+    version_.store(version, std::memory_order_release);
+}
+
+const ConfigSnapshot &ConfigManager::GetSnapshot() {
+    // Each thread keeps the last snapshot it read, the shared pointer (and its reference count) is only touched
+    // when a writer has published a newer version
+    struct Cache {
+        const ConfigManager *owner = nullptr;
+        uint64_t version = 0;
+        std::shared_ptr<const ConfigSnapshot> snapshot;
+    };
+    thread_local Cache cache;
+
+    uint64_t version = version_.load(std::memory_order_acquire);
+    if (cache.owner != this || cache.version != version) {
+        cache.snapshot = GetShared();
+        cache.version = cache.snapshot->Version();
+        cache.owner = this;
+    }
+    return *cache.snapshot;
+}
+
+std::shared_ptr<const ConfigSnapshot> ConfigManager::GetShared() const {
+    return std::atomic_load(&current_);
+}
+
+const std::string &ConfigManager::GetPath() const {
+    return path_;
+}
+
+uint64_t ConfigManager::Version() const {
+    return version_.load(std::memory_order_acquire);
 }
 
 const void ConfigManager::Print(int spaces) {
-    std::lock_guard<std::mutex> lock(ConfigManager::singleton_lock_);
-    std::cout << config.dump(spaces) << std::endl;
+    std::cout << GetSnapshot().Json().dump(spaces) << std::endl;
 }
 
 nlohmann::json ConfigManager::Get(const std::string &key) {
-    std::lock_guard<std::mutex> lock(singleton_lock_);
-    return config[key];
+    return GetSnapshot()[key];
 }
 
 nlohmann::json ConfigManager::IGet(const std::string &key) {
     return GetInstance()->Get(key);
 }
+
+const ConfigSnapshot &ConfigManager::ISnapshot() {
+    return GetInstance()->GetSnapshot();
+}
@@ -0,0 +1,88 @@
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <iostream>
+
+#include <boost/filesystem.hpp>
+
+#include "ConfigWatcher.hpp"
+#include "Settings.hpp"
+#include "Tracer.hpp"
+
+ConfigWatcher::ConfigWatcher(Callback on_change, int debounce_ms) : ThreadClass(10), on_change_(std::move(on_change)),
+                                                                    debounce_(debounce_ms) {
+    boost::filesystem::path path = boost::filesystem::absolute(ConfigManager::GetInstance()->GetPath());
+    directory_ = path.parent_path().string();
+    file_name_ = path.filename().string();
+    StartThread();
+}
+
+ConfigWatcher::~ConfigWatcher() {
+    // Stop here rather than in ThreadClass so Loop is never called on a partially destroyed object
+    cancel_thread_ = true;
+    if (thread_.joinable())
+        thread_.join();
+    if (inotify_ >= 0)
+        close(inotify_);
+}
+
+const void ConfigWatcher::Setup() {
+    Tracer::SetThreadName("config-watcher");
+    inotify_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_ < 0 || inotify_add_watch(inotify_, directory_.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE) < 0) {
+        std::cerr << "Config: Could not watch " << directory_ << " (" << strerror(errno) << "), reload disabled"
+                  << std::endl;
+        return;
+    }
+
+    std::cout << "Config: Watching " << directory_ << "/" << file_name_ << " for changes" << std::endl;
+
+    while (ThreadAlive()) {
+        try {
+            Loop();
+        } catch (const std::exception &err) {
+            std::cerr << "Config watcher error: " << err.what() << std::endl;
+        }
+    }
+}
+
+const void ConfigWatcher::Loop() {
+    // Wake up regularly so the destructor can stop the thread and a pending reload fires after the debounce
+    pollfd fd{inotify_, POLLIN, 0};
+    if (poll(&fd, 1, static_cast<int>(ms_timeout_)) > 0 && (fd.revents & POLLIN)) {
+        alignas(inotify_event) char buffer[4096];
+        ssize_t length;
+        while ((length = read(inotify_, buffer, sizeof(buffer))) > 0)
+            for (char *event = buffer; event < buffer + length;) {
+                auto *notification = reinterpret_cast<inotify_event *>(event);
+                if (notification->len > 0 && file_name_ == notification->name) {
+                    pending_ = true;
+                    last_event_ = std::chrono::steady_clock::now();
+                }
+                event += sizeof(inotify_event) + notification->len;
+            }
+    }
+
+    if (pending_ && std::chrono::steady_clock::now() - last_event_ >= debounce_) {
+        pending_ = false;
+        Reload();
+    }
+}
+
+void ConfigWatcher::Reload() {
+    TraceScope trace("ReloadConfig");
+    ConfigManager *config = ConfigManager::GetInstance();
+    std::shared_ptr<const ConfigSnapshot> previous = config->GetShared();
+
+    // Every typed setting is checked before anything is published
+    bool changed = config->Reload([](const nlohmann::json &candidate) { CaptureSettings::Parse(candidate); });
+    if (!changed)
+        return;
+
+    std::shared_ptr<const ConfigSnapshot> current = config->GetShared();
+    std::cout << "Config: Reloaded " << file_name_ << " (version " << current->Version() << ")" << std::endl;
+    if (on_change_)
+        on_change_(*previous, *current);
+}
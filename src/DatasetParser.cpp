@@ -1 +1,320 @@
+#include <algorithm>
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+#include <boost/filesystem.hpp>
+
 #include "DatasetParser.h"
+#include "Settings.hpp"
+
+DatasetParser::FileNames DatasetParser::FileNames::FromConfig() {
+    FileNames names;
+    const FileNameSettings &file_names = CaptureSettings::Current()->Defaults().file_names;
+    names.rgb = file_names.colour;
+    names.ir_left = file_names.ir_left;
+    names.ir_right = file_names.ir_right;
+    names.depth = file_names.depth;
+    names.coloured_depth = file_names.coloured_depth;
+    names.capture = file_names.capture;
+    names.video_frame_ext = file_names.video_frame_ext;
+    names.metadata_ext = file_names.metadata_ext;
+    return names;
+}
+
+DatasetParser::DataCapture::DataCapture(const std::string *root, const FileNames *file_names, std::string dataset,
+                                        std::string serial_number, std::string day, std::string time) :
+        dataset(std::move(dataset)), serial_number(std::move(serial_number)), day(std::move(day)),
+        time(std::move(time)), root_(root), file_names_(file_names) {}
+
+std::string DatasetParser::DataCapture::GetRelativePath() const {
+    return dataset + "/" + serial_number + "/" + day + "/" + time + "/";
+}
+
+std::string DatasetParser::DataCapture::GetPath() const {
+    return *root_ + GetRelativePath();
+}
+
+std::string DatasetParser::DataCapture::GetPath(SensorType sensor_type) const {
+    switch (sensor_type) {
+        case SensorType::RGB:
+            return GetPath() + file_names_->rgb + file_names_->video_frame_ext;
+        case SensorType::IR_LEFT:
+            return GetPath() + file_names_->ir_left + file_names_->video_frame_ext;
+        case SensorType::IR_RIGHT:
+            return GetPath() + file_names_->ir_right + file_names_->video_frame_ext;
+        case SensorType::DEPTH:
+            return GetPath() + file_names_->depth + file_names_->video_frame_ext;
+        case SensorType::COLOURISED_DEPTH:
+            return GetPath() + file_names_->coloured_depth + file_names_->video_frame_ext;
+    }
+    return GetPath();
+}
+
+std::string DatasetParser::DataCapture::GetRGBPath() const {
+    return GetPath(SensorType::RGB);
+}
+
+std::string DatasetParser::DataCapture::GetDepthPath(SensorType sensor_type) const {
+    return GetPath(sensor_type);
+}
+
+std::string DatasetParser::DataCapture::GetIRPath(SensorType sensor_type) const {
+    return GetPath(sensor_type);
+}
+
+std::string DatasetParser::DataCapture::GetCaptureMetaPath() const {
+    return GetPath() + file_names_->capture + file_names_->metadata_ext;
+}
+
+DatasetParser::timestamp DatasetParser::DataCapture::GetTimestamp() const {
+    // Folders are named in local time by Strawberry::DataStructure, YYYY_MM_DD/HH_MM_SS_mmm
+    std::tm tm = {};
+    int milliseconds = 0;
+    std::istringstream stream(day + " " + time);
+    stream >> std::get_time(&tm, "%Y_%m_%d %H_%M_%S_") >> milliseconds;
+    if (stream.fail())
+        return timestamp();
+
+    tm.tm_isdst = -1;
+    return std::chrono::system_clock::from_time_t(std::mktime(&tm)) + std::chrono::milliseconds(milliseconds);
+}
+
+DatasetParser::GrabberDataset::GrabberDataset(std::string data_root, std::string index_file) :
+        root_(std::move(data_root)), index_file_(std::move(index_file)), file_names_(FileNames::FromConfig()) {
+    if (!root_.empty() && root_.back() != '/')
+        root_ += '/';
+    if (index_file_.empty())
+        index_file_ = root_ + "dataset_index.csv";
+}
+
+bool DatasetParser::GrabberDataset::Load() {
+    std::ifstream csv(index_file_);
+    if (!csv.is_open())
+        return false;
+
+    // Columns are looked up by name so indices written by older versions still load
+    std::string line, cell;
+    std::getline(csv, line);
+    std::map<std::string, size_t> columns;
+    std::istringstream header(line);
+    for (size_t i = 0; std::getline(header, cell, ','); ++i)
+        columns[cell] = i;
+
+    for (auto &column : {"Dataset", "Serial", "Day", "Time"})
+        if (columns.find(column) == columns.end()) {
+            std::cerr << "Index " << index_file_ << " has no " << column << " column, ignoring it" << std::endl;
+            return false;
+        }
+
+    captures_.clear();
+    std::vector<std::string> cells;
+    while (std::getline(csv, line)) {
+        cells.clear();
+        std::istringstream row(line);
+        while (std::getline(row, cell, ','))
+            cells.push_back(cell);
+        cells.resize(columns.size());
+
+        captures_.emplace_back(&root_, &file_names_, cells[columns["Dataset"]], cells[columns["Serial"]],
+                               cells[columns["Day"]], cells[columns["Time"]]);
+
+        auto hash = columns.find("Image Hash");
+        if (hash != columns.end() && !cells[hash->second].empty()) {
+            // A damaged cell only costs this capture its hash, it is hashed again
+            try {
+                captures_.back().image_hash = std::stoull(cells[hash->second], nullptr, 16);
+                captures_.back().hashed = true;
+            } catch (const std::logic_error &) {
+                std::cerr << "Index " << index_file_ << ": Invalid image hash '" << cells[hash->second] << "' for "
+                          << captures_.back().GetPath() << ", hashing it again" << std::endl;
+            }
+        }
+
+        // Markers as id:x:y:diameter separated by ';', "none" when detection found nothing
+        auto markers = columns.find("WhyCON");
+        if (markers != columns.end() && !cells[markers->second].empty()) {
+            DataCapture &capture = captures_.back();
+            capture.markers_detected = true;
+            std::istringstream list(cells[markers->second]);
+            std::string entry;
+            while (std::getline(list, entry, ';')) {
+                WhyConMarker marker;
+                if (std::sscanf(entry.c_str(), "%d:%f:%f:%f", &marker.id, &marker.x, &marker.y,
+                                &marker.diameter) == 4)
+                    capture.markers.push_back(marker);
+            }
+        }
+    }
+
+    Sort();
+    return true;
+}
+
+bool DatasetParser::GrabberDataset::Save() {
+    // Written next to the index and renamed over it so an interrupted save keeps the previous index
+    std::string temporary = index_file_ + ".tmp";
+    std::ofstream csv(temporary);
+    csv << "Dataset,Serial,Day,Time,Image Hash,WhyCON\n";
+    for (auto &capture : captures_) {
+        csv << capture.dataset << ',' << capture.serial_number << ',' << capture.day << ',' << capture.time << ',';
+        if (capture.hashed)
+            csv << std::hex << std::setw(16) << std::setfill('0') << capture.image_hash << std::dec
+                << std::setfill(' ');
+        csv << ',';
+        if (capture.markers_detected && capture.markers.empty())
+            csv << "none";
+        for (size_t i = 0; i < capture.markers.size(); ++i) {
+            const WhyConMarker &marker = capture.markers[i];
+            csv << (i > 0 ? ";" : "") << marker.id << ':' << std::fixed << std::setprecision(1) << marker.x << ':'
+                << marker.y << ':' << marker.diameter << std::defaultfloat;
+        }
+        csv << '\n';
+    }
+    csv.close();
+
+    if (!csv.good()) {
+        std::cerr << "Could not write " << temporary << std::endl;
+        return false;
+    }
+    boost::filesystem::rename(temporary, index_file_);
+    return true;
+}
+
+size_t DatasetParser::GrabberDataset::Scan() {
+    namespace fs = boost::filesystem;
+    auto directories = [](const fs::path &path) {
+        std::vector<fs::path> children;
+        boost::system::error_code error;
+        for (fs::directory_iterator it(path, error), end; !error && it != end; it.increment(error))
+            if (fs::is_directory(it->status()))
+                children.push_back(it->path());
+        return children;
+    };
+
+    std::vector<DataCapture> found;
+    for (auto &dataset : directories(root_))
+        for (auto &serial : directories(dataset))
+            for (auto &day : directories(serial))
+                for (auto &time : directories(day))
+                    found.emplace_back(&root_, &file_names_, dataset.filename().string(),
+                                       serial.filename().string(), day.filename().string(),
+                                       time.filename().string());
+
+    // Keep what is cached for captures still on disk
+    size_t added = 0;
+    for (auto &capture : found) {
+        auto known = paths_.find(capture.GetRelativePath());
+        if (known != paths_.end()) {
+            capture.image_hash = captures_[known->second].image_hash;
+            capture.hashed = captures_[known->second].hashed;
+            capture.markers = std::move(captures_[known->second].markers);
+            capture.markers_detected = captures_[known->second].markers_detected;
+        } else {
+            added++;
+        }
+    }
+
+    captures_ = std::move(found);
+    Sort();
+    return added;
+}
+
+void DatasetParser::GrabberDataset::Sort() {
+    std::sort(captures_.begin(), captures_.end(), [](const DataCapture &a, const DataCapture &b) {
+        return std::tie(a.dataset, a.serial_number, a.day, a.time) <
+               std::tie(b.dataset, b.serial_number, b.day, b.time);
+    });
+
+    paths_.clear();
+    paths_.reserve(captures_.size());
+    for (size_t i = 0; i < captures_.size(); ++i)
+        paths_[captures_[i].GetRelativePath()] = i;
+    IndexMarkers();
+}
+
+void DatasetParser::GrabberDataset::IndexMarkers() {
+    // Indices are pushed in capture order, so every list is already sorted; a marker seen twice counts once
+    markers_.clear();
+    for (size_t i = 0; i < captures_.size(); ++i)
+        for (const WhyConMarker &marker : captures_[i].markers) {
+            std::vector<size_t> &seen = markers_[marker.id];
+            if (seen.empty() || seen.back() != i)
+                seen.push_back(i);
+        }
+}
+
+size_t DatasetParser::GrabberDataset::Size() const {
+    return captures_.size();
+}
+
+DatasetParser::DataCapture &DatasetParser::GrabberDataset::operator[](size_t index) {
+    return captures_[index];
+}
+
+const DatasetParser::DataCapture &DatasetParser::GrabberDataset::operator[](size_t index) const {
+    return captures_[index];
+}
+
+const std::string &DatasetParser::GrabberDataset::GetRoot() const {
+    return root_;
+}
+
+long DatasetParser::GrabberDataset::Find(const std::string &path) const {
+    std::string relative = path;
+    if (relative.compare(0, root_.size(), root_) == 0)
+        relative = relative.substr(root_.size());
+
+    // Strip a file name, the capture folder is the first four components
+    std::string folder;
+    std::istringstream components(relative);
+    std::string component;
+    for (int depth = 0; depth < 4 && std::getline(components, component, '/'); ++depth)
+        folder += component + "/";
+
+    auto capture = paths_.find(folder);
+    return capture == paths_.end() ? -1 : static_cast<long>(capture->second);
+}
+
+std::vector<size_t> DatasetParser::GrabberDataset::GetByHierarchy(const std::string &dataset,
+                                                                  const std::string &serial_number,
+                                                                  const std::string &day) const {
+    std::vector<size_t> indices;
+    for (size_t i = 0; i < captures_.size(); ++i) {
+        const DataCapture &capture = captures_[i];
+        if (capture.dataset == dataset && (serial_number.empty() || capture.serial_number == serial_number) &&
+            (day.empty() || capture.day == day))
+            indices.push_back(i);
+    }
+    return indices;
+}
+
+std::vector<size_t> DatasetParser::GrabberDataset::GetByDataSet(const std::string &dataset) const {
+    return GetByHierarchy(dataset);
+}
+
+std::vector<size_t> DatasetParser::GrabberDataset::GetByDay(const std::string &day) const {
+    std::vector<size_t> indices;
+    for (size_t i = 0; i < captures_.size(); ++i)
+        if (captures_[i].day == day)
+            indices.push_back(i);
+    return indices;
+}
+
+std::vector<size_t> DatasetParser::GrabberDataset::GetByStartTime(timestamp from, timestamp to) const {
+    std::vector<size_t> indices;
+    for (size_t i = 0; i < captures_.size(); ++i) {
+        timestamp time = captures_[i].GetTimestamp();
+        if (time >= from && time < to)
+            indices.push_back(i);
+    }
+    return indices;
+}
+
+std::vector<size_t> DatasetParser::GrabberDataset::GetByWhyCON(int id) const {
+    auto seen = markers_.find(id);
+    return seen == markers_.end() ? std::vector<size_t>() : seen->second;
+}
@@ -0,0 +1,143 @@
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+
+#include "FrameMonitor.hpp"
+
+StreamMonitor::StreamMonitor(const char *name, double expected_period_ms) : name_(name),
+                                                                              expected_period_ms_(expected_period_ms) {}
+
+void StreamMonitor::Reset(double expected_period_ms) {
+    const char *name = name_;
+    *this = StreamMonitor(name, expected_period_ms);
+}
+
+long long StreamMonitor::Update(const rs2::frame &frame) {
+    long long counter = frame.supports_frame_metadata(RS2_FRAME_METADATA_FRAME_COUNTER) ?
+                        frame.get_frame_metadata(RS2_FRAME_METADATA_FRAME_COUNTER) :
+                        static_cast<long long>(frame.get_frame_number());
+
+    // Prefer the sensor (mid exposure) clock, it is not affected by USB transfer delays
+    double timestamp_ms = frame.supports_frame_metadata(RS2_FRAME_METADATA_SENSOR_TIMESTAMP) ?
+                          frame.get_frame_metadata(RS2_FRAME_METADATA_SENSOR_TIMESTAMP) / 1000.0 :
+                          frame.get_timestamp();
+
+    // The syncer repeats the slower stream's last frame, only count it once
+    if (counter == last_counter_)
+        return 0;
+
+    // A counter that goes backwards means the stream restarted (pipeline restart or bag loop), start again from it
+    long long missing = 0;
+    if (last_counter_ >= 0 && counter > last_counter_) {
+        missing = counter - last_counter_ - 1;
+
+        // Jitter is the deviation from the expected spacing, accounting for any frames that went missing
+        double delta = timestamp_ms - last_timestamp_ms_;
+        if (expected_period_ms_ > 0 && delta > 0) {
+            double jitter = std::fabs(delta - expected_period_ms_ * (missing + 1));
+            jitter_sum_ms_ += jitter;
+            jitter_max_ms_ = std::max(jitter_max_ms_, jitter);
+            jitter_samples_++;
+        }
+    }
+
+    if (missing > 0) {
+        dropped_ += missing;
+        gaps_++;
+    }
+
+    window_dropped_ -= window_[window_index_];
+    window_[window_index_] = static_cast<uint32_t>(missing);
+    window_dropped_ += missing;
+    window_index_ = (window_index_ + 1) % kWindow;
+    window_fill_ = std::min(window_fill_ + 1, kWindow);
+
+    received_++;
+    last_counter_ = counter;
+    last_timestamp_ms_ = timestamp_ms;
+    return missing;
+}
+
+const char *StreamMonitor::GetName() const {
+    return name_;
+}
+
+uint64_t StreamMonitor::Received() const {
+    return received_;
+}
+
+uint64_t StreamMonitor::Dropped() const {
+    return dropped_;
+}
+
+uint64_t StreamMonitor::Gaps() const {
+    return gaps_;
+}
+
+double StreamMonitor::DropRate() const {
+    double expected = static_cast<double>(window_fill_) + window_dropped_;
+    return expected > 0 ? window_dropped_ / expected : 0.0;
+}
+
+double StreamMonitor::JitterMean() const {
+    return jitter_samples_ > 0 ? jitter_sum_ms_ / jitter_samples_ : 0.0;
+}
+
+double StreamMonitor::JitterMax() const {
+    return jitter_max_ms_;
+}
+
+long long StreamMonitor::LastCounter() const {
+    return last_counter_;
+}
+
+FrameMonitor::FrameMonitor(double depth_period_ms, double colour_period_ms) {
+    streams_[DEPTH] = StreamMonitor("Depth", depth_period_ms);
+    streams_[COLOUR] = StreamMonitor("Colour", colour_period_ms);
+    streams_[IR_LEFT] = StreamMonitor("IR Left", depth_period_ms);
+    streams_[IR_RIGHT] = StreamMonitor("IR Right", depth_period_ms);
+}
+
+void FrameMonitor::Reset(double depth_period_ms, double colour_period_ms) {
+    *this = FrameMonitor(depth_period_ms, colour_period_ms);
+}
+
+long long FrameMonitor::Update(Stream stream, const rs2::frame &frame) {
+    return streams_[stream].Update(frame);
+}
+
+const StreamMonitor &FrameMonitor::Get(Stream stream) const {
+    return streams_[stream];
+}
+
+uint64_t FrameMonitor::Dropped() const {
+    uint64_t dropped = 0;
+    for (auto &stream : streams_)
+        dropped += stream.Dropped();
+    return dropped;
+}
+
+void FrameMonitor::Print(std::ostream &out, const std::string &serial_number) const {
+    out << "Camera " << serial_number << ":\n\t" << std::left << std::setw(10) << "Stream" << std::right
+        << std::setw(10) << "Received" << std::setw(10) << "Dropped" << std::setw(8) << "Gaps" << std::setw(12)
+        << "Drop Rate" << std::setw(14) << "Jitter Mean" << std::setw(13) << "Jitter Max" << " (ms)\n";
+
+    for (auto &stream : streams_)
+        out << "\t" << std::left << std::setw(10) << stream.GetName() << std::right << std::setw(10)
+            << stream.Received() << std::setw(10) << stream.Dropped() << std::setw(8) << stream.Gaps()
+            << std::fixed << std::setprecision(2) << std::setw(11) << stream.DropRate() * 100 << "%"
+            << std::setw(14) << stream.JitterMean() << std::setw(13) << stream.JitterMax() << "\n";
+    out.unsetf(std::ios_base::floatfield);
+    out << std::flush;
+}
+
+void FrameMonitor::WriteCsv(std::ostream &csv) const {
+    for (auto &stream : streams_) {
+        csv << stream.GetName() << " Frames Received," << stream.Received() << '\n';
+        csv << stream.GetName() << " Frames Dropped," << stream.Dropped() << '\n';
+        csv << stream.GetName() << " Drop Rate (Last " << StreamMonitor::kWindow << " Frames)," << stream.DropRate()
+            << '\n';
+        csv << stream.GetName() << " Jitter Mean (ms)," << stream.JitterMean() << '\n';
+        csv << stream.GetName() << " Jitter Max (ms)," << stream.JitterMax() << '\n';
+    }
+}
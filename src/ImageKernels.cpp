@@ -0,0 +1,402 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+#include "ImageKernels.hpp"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+void ImageKernels::Decimate(const uint8_t *src, int width, int height, int stride, int channels, int channel,
+                            int step, uint8_t *dst) {
+    int out_width = width / step, out_height = height / step;
+    for (int y = 0; y < out_height; ++y) {
+        const uint8_t *row = src + static_cast<size_t>(y) * step * stride + channel;
+        for (int x = 0; x < out_width; ++x)
+            *dst++ = row[x * step * channels];
+    }
+}
+
+double ImageKernels::MeanAbsDifferenceScalar(const uint8_t *a, const uint8_t *b, size_t size) {
+    if (size == 0)
+        return 0;
+
+    uint64_t sum = 0;
+    for (size_t i = 0; i < size; ++i)
+        sum += static_cast<uint64_t>(std::abs(static_cast<int>(a[i]) - static_cast<int>(b[i])));
+    return static_cast<double>(sum) / size;
+}
+
+double ImageKernels::MeanAbsDifference(const uint8_t *a, const uint8_t *b, size_t size) {
+#if defined(__SSE2__)
+    if (size == 0)
+        return 0;
+
+    // psadbw sums 8 absolute differences into each 64 bit half, 16 bytes per instruction
+    __m128i total = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i));
+        __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i));
+        total = _mm_add_epi64(total, _mm_sad_epu8(va, vb));
+    }
+
+    uint64_t sum = static_cast<uint64_t>(_mm_cvtsi128_si64(total)) +
+                   static_cast<uint64_t>(_mm_cvtsi128_si64(_mm_unpackhi_epi64(total, total)));
+    for (; i < size; ++i)
+        sum += static_cast<uint64_t>(std::abs(static_cast<int>(a[i]) - static_cast<int>(b[i])));
+    return static_cast<double>(sum) / size;
+#else
+    return MeanAbsDifferenceScalar(a, b, size);
+#endif
+}
+
+double ImageKernels::LaplacianVarianceScalar(const uint8_t *src, int width, int height) {
+    if (width < 3 || height < 3)
+        return 0;
+
+    int64_t sum = 0, squares = 0;
+    for (int y = 1; y < height - 1; ++y) {
+        const uint8_t *up = src + static_cast<size_t>(y - 1) * width, *row = up + width, *down = row + width;
+        for (int x = 1; x < width - 1; ++x) {
+            int laplacian = 4 * row[x] - row[x - 1] - row[x + 1] - up[x] - down[x];
+            sum += laplacian;
+            squares += laplacian * laplacian;
+        }
+    }
+
+    double count = static_cast<double>(width - 2) * (height - 2);
+    double mean = sum / count;
+    return squares / count - mean * mean;
+}
+
+double ImageKernels::LaplacianVariance(const uint8_t *src, int width, int height) {
+#if defined(__SSE2__)
+    if (width < 3 || height < 3)
+        return 0;
+
+    // 8 pixels per step in 16 bit lanes (the Laplacian is within +-1020), pmaddwd sums pairs of values and squares
+    // into 32 bit lanes which are flushed to 64 bit every row so they can not overflow
+    const __m128i zero = _mm_setzero_si128(), ones = _mm_set1_epi16(1);
+    int64_t sum = 0, squares = 0;
+    for (int y = 1; y < height - 1; ++y) {
+        const uint8_t *up = src + static_cast<size_t>(y - 1) * width, *row = up + width, *down = row + width;
+        __m128i row_sum = _mm_setzero_si128(), row_squares = _mm_setzero_si128();
+
+        int x = 1;
+        for (; x + 8 <= width - 1; x += 8) {
+            auto load = [zero](const uint8_t *p) {
+                return _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(p)), zero);
+            };
+            __m128i centre = _mm_slli_epi16(load(row + x), 2);
+            __m128i neighbours = _mm_add_epi16(_mm_add_epi16(load(row + x - 1), load(row + x + 1)),
+                                               _mm_add_epi16(load(up + x), load(down + x)));
+            __m128i laplacian = _mm_sub_epi16(centre, neighbours);
+            row_sum = _mm_add_epi32(row_sum, _mm_madd_epi16(laplacian, ones));
+            row_squares = _mm_add_epi32(row_squares, _mm_madd_epi16(laplacian, laplacian));
+        }
+
+        alignas(16) int32_t lanes[8];
+        _mm_store_si128(reinterpret_cast<__m128i *>(lanes), row_sum);
+        _mm_store_si128(reinterpret_cast<__m128i *>(lanes + 4), row_squares);
+        sum += static_cast<int64_t>(lanes[0]) + lanes[1] + lanes[2] + lanes[3];
+        squares += static_cast<int64_t>(lanes[4]) + lanes[5] + lanes[6] + lanes[7];
+
+        for (; x < width - 1; ++x) {
+            int laplacian = 4 * row[x] - row[x - 1] - row[x + 1] - up[x] - down[x];
+            sum += laplacian;
+            squares += laplacian * laplacian;
+        }
+    }
+
+    double count = static_cast<double>(width - 2) * (height - 2);
+    double mean = sum / count;
+    return squares / count - mean * mean;
+#else
+    return LaplacianVarianceScalar(src, width, height);
+#endif
+}
+
+void ImageKernels::ThresholdScalar(const uint8_t *src, int width, int height, int stride, uint8_t level,
+                                   uint8_t *dst) {
+    for (int y = 0; y < height; ++y) {
+        const uint8_t *row = src + static_cast<size_t>(y) * stride;
+        for (int x = 0; x < width; ++x)
+            *dst++ = row[x] < level ? 1 : 0;
+    }
+}
+
+void ImageKernels::Threshold(const uint8_t *src, int width, int height, int stride, uint8_t level, uint8_t *dst) {
+#if defined(__SSE2__)
+    if (level == 0) {
+        std::fill(dst, dst + static_cast<size_t>(width) * height, 0);
+        return;
+    }
+
+    // There is no unsigned byte compare, x < level is min(x, level - 1) == x
+    const __m128i below = _mm_set1_epi8(static_cast<char>(level - 1)), one = _mm_set1_epi8(1);
+    for (int y = 0; y < height; ++y) {
+        const uint8_t *row = src + static_cast<size_t>(y) * stride;
+        int x = 0;
+        for (; x + 16 <= width; x += 16) {
+            __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row + x));
+            __m128i dark = _mm_cmpeq_epi8(_mm_min_epu8(pixels, below), pixels);
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + x), _mm_and_si128(dark, one));
+        }
+        for (; x < width; ++x)
+            dst[x] = row[x] < level ? 1 : 0;
+        dst += width;
+    }
+#else
+    ThresholdScalar(src, width, height, stride, level, dst);
+#endif
+}
+
+void ImageKernels::Histogram(const uint8_t *src, size_t size, uint32_t histogram[256]) {
+    // Four partial histograms so consecutive equal pixels do not wait on each other's increment
+    uint32_t partial[4][256] = {};
+    size_t i = 0;
+    for (; i + 4 <= size; i += 4) {
+        partial[0][src[i]]++;
+        partial[1][src[i + 1]]++;
+        partial[2][src[i + 2]]++;
+        partial[3][src[i + 3]]++;
+    }
+    for (; i < size; ++i)
+        partial[0][src[i]]++;
+
+    for (int bin = 0; bin < 256; ++bin)
+        histogram[bin] = partial[0][bin] + partial[1][bin] + partial[2][bin] + partial[3][bin];
+}
+
+size_t ImageKernels::CountNonZeroScalar(const uint16_t *src, int width, int height, int stride) {
+    size_t count = 0;
+    for (int y = 0; y < height; ++y) {
+        const uint16_t *row = reinterpret_cast<const uint16_t *>(reinterpret_cast<const uint8_t *>(src) +
+                                                                 static_cast<size_t>(y) * stride);
+        for (int x = 0; x < width; ++x)
+            count += row[x] != 0;
+    }
+    return count;
+}
+
+size_t ImageKernels::CountNonZero(const uint16_t *src, int width, int height, int stride) {
+#if defined(__SSE2__)
+    // Count the zeros, a zero pixel compares to -1 and is subtracted from 16 bit lane counters flushed every row
+    size_t zeros = 0;
+    const __m128i zero = _mm_setzero_si128(), ones = _mm_set1_epi16(1);
+    for (int y = 0; y < height; ++y) {
+        const uint16_t *row = reinterpret_cast<const uint16_t *>(reinterpret_cast<const uint8_t *>(src) +
+                                                                 static_cast<size_t>(y) * stride);
+        __m128i row_zeros = _mm_setzero_si128();
+        int x = 0;
+        for (int flush = 0; x + 8 <= width; x += 8) {
+            __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row + x));
+            row_zeros = _mm_sub_epi16(row_zeros, _mm_cmpeq_epi16(pixels, zero));
+
+            // A 16 bit lane holds at most 65535 zeros
+            if (++flush == 0x7fff || x + 16 > width) {
+                alignas(16) int32_t lanes[4];
+                _mm_store_si128(reinterpret_cast<__m128i *>(lanes), _mm_madd_epi16(row_zeros, ones));
+                zeros += static_cast<size_t>(lanes[0]) + lanes[1] + lanes[2] + lanes[3];
+                row_zeros = _mm_setzero_si128();
+                flush = 0;
+            }
+        }
+        for (; x < width; ++x)
+            zeros += row[x] == 0;
+    }
+    return static_cast<size_t>(width) * height - zeros;
+#else
+    return CountNonZeroScalar(src, width, height, stride);
+#endif
+}
+
+uint64_t ImageKernels::DifferenceHash(const uint8_t *src, int width, int height) {
+    if (width < 9 || height < 8)
+        return 0;
+
+    // Sum of every cell of a 9x8 grid, cell edges are spread evenly when the size is not a multiple
+    uint32_t cells[8][9] = {};
+    int cell_x[9 + 1], cell_y[8 + 1];
+    for (int i = 0; i <= 9; ++i)
+        cell_x[i] = i * width / 9;
+    for (int i = 0; i <= 8; ++i)
+        cell_y[i] = i * height / 8;
+
+    for (int row = 0; row < 8; ++row)
+        for (int y = cell_y[row]; y < cell_y[row + 1]; ++y) {
+            const uint8_t *line = src + static_cast<size_t>(y) * width;
+            for (int column = 0; column < 9; ++column) {
+                uint32_t sum = 0;
+                for (int x = cell_x[column]; x < cell_x[column + 1]; ++x)
+                    sum += line[x];
+                cells[row][column] += sum;
+            }
+        }
+
+    // Compare the means of neighbouring cells, cross multiplied by the cell widths to stay in integers
+    uint64_t hash = 0;
+    for (int row = 0; row < 8; ++row)
+        for (int column = 0; column < 8; ++column) {
+            uint64_t left = static_cast<uint64_t>(cells[row][column]) * (cell_x[column + 2] - cell_x[column + 1]);
+            uint64_t right = static_cast<uint64_t>(cells[row][column + 1]) * (cell_x[column + 1] - cell_x[column]);
+            hash = (hash << 1) | (left < right ? 1u : 0u);
+        }
+    return hash;
+}
+
+int ImageKernels::HammingDistance(uint64_t a, uint64_t b) {
+    return __builtin_popcountll(a ^ b);
+}
+
+void ImageKernels::AccumulateDepthScalar(const uint16_t *depth, size_t size, float tolerance, float *sum,
+                                         float *count) {
+    for (size_t i = 0; i < size; ++i) {
+        if (depth[i] == 0)
+            continue;
+
+        // |value - sum / count| > tolerance * sum / count, multiplied out to avoid the division
+        float value = depth[i];
+        if (count[i] > 0 && std::fabs(value * count[i] - sum[i]) > tolerance * sum[i])
+            continue;
+        sum[i] += value;
+        count[i] += 1;
+    }
+}
+
+void ImageKernels::AccumulateDepth(const uint16_t *depth, size_t size, float tolerance, float *sum, float *count) {
+#if defined(__SSE2__)
+    // 8 pixels per step, widened to two halves of 4 floats. The same operations as the scalar version in the same
+    // order so both give identical sums
+    const __m128i zero = _mm_setzero_si128();
+    const __m128 zero_ps = _mm_setzero_ps(), one = _mm_set1_ps(1), limit = _mm_set1_ps(tolerance);
+    const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i *>(depth + i));
+        __m128i halves[2] = {_mm_unpacklo_epi16(pixels, zero), _mm_unpackhi_epi16(pixels, zero)};
+        for (int half = 0; half < 2; ++half) {
+            float *s = sum + i + half * 4, *c = count + i + half * 4;
+            __m128 value = _mm_cvtepi32_ps(halves[half]);
+            __m128 vs = _mm_loadu_ps(s), vc = _mm_loadu_ps(c);
+
+            __m128 error = _mm_and_ps(_mm_sub_ps(_mm_mul_ps(value, vc), vs), abs_mask);
+            __m128 inlier = _mm_or_ps(_mm_cmpeq_ps(vc, zero_ps), _mm_cmple_ps(error, _mm_mul_ps(limit, vs)));
+            __m128 keep = _mm_and_ps(_mm_cmpneq_ps(value, zero_ps), inlier);
+
+            _mm_storeu_ps(s, _mm_add_ps(vs, _mm_and_ps(keep, value)));
+            _mm_storeu_ps(c, _mm_add_ps(vc, _mm_and_ps(keep, one)));
+        }
+    }
+    AccumulateDepthScalar(depth + i, size - i, tolerance, sum + i, count + i);
+#else
+    AccumulateDepthScalar(depth, size, tolerance, sum, count);
+#endif
+}
+
+void ImageKernels::ResolveDepthMeanScalar(const float *sum, const float *count, size_t size, int min_count,
+                                          uint16_t *dst) {
+    float minimum = static_cast<float>(std::max(1, min_count));
+    for (size_t i = 0; i < size; ++i)
+        dst[i] = count[i] >= minimum ? static_cast<uint16_t>(std::nearbyint(sum[i] / count[i])) : 0;
+}
+
+void ImageKernels::ResolveDepthMean(const float *sum, const float *count, size_t size, int min_count,
+                                    uint16_t *dst) {
+#if defined(__SSE2__)
+    // cvtps rounds to nearest even like nearbyint, SSE2 has no unsigned 32 to 16 bit pack so the values are moved
+    // into the signed range, packed and moved back
+    const __m128 minimum = _mm_set1_ps(static_cast<float>(std::max(1, min_count)));
+    const __m128i offset = _mm_set1_epi32(0x8000), sign = _mm_set1_epi16(static_cast<short>(0x8000));
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        __m128i halves[2];
+        for (int half = 0; half < 2; ++half) {
+            __m128 vs = _mm_loadu_ps(sum + i + half * 4), vc = _mm_loadu_ps(count + i + half * 4);
+            __m128 mean = _mm_and_ps(_mm_cmpge_ps(vc, minimum), _mm_div_ps(vs, vc));
+            halves[half] = _mm_sub_epi32(_mm_cvtps_epi32(mean), offset);
+        }
+        __m128i packed = _mm_xor_si128(_mm_packs_epi32(halves[0], halves[1]), sign);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), packed);
+    }
+    ResolveDepthMeanScalar(sum + i, count + i, size - i, min_count, dst + i);
+#else
+    ResolveDepthMeanScalar(sum, count, size, min_count, dst);
+#endif
+}
+
+void ImageKernels::MedianDepthScalar(const uint16_t *const *frames, int frame_count, size_t size, int min_count,
+                                     uint16_t *dst) {
+    frame_count = std::min(frame_count, kMaxMedianFrames);
+    min_count = std::max(1, min_count);
+    uint16_t values[kMaxMedianFrames];
+    for (size_t i = 0; i < size; ++i) {
+        int valid = 0;
+        for (int frame = 0; frame < frame_count; ++frame)
+            if (frames[frame][i] != 0)
+                values[valid++] = frames[frame][i];
+
+        if (valid < min_count) {
+            dst[i] = 0;
+            continue;
+        }
+        std::sort(values, values + valid);
+        dst[i] = static_cast<uint16_t>((values[(valid - 1) / 2] + values[valid / 2] + 1) >> 1);
+    }
+}
+
+void ImageKernels::MedianDepth(const uint16_t *const *frames, int frame_count, size_t size, int min_count,
+                               uint16_t *dst) {
+#if defined(__SSE2__)
+    // 8 pixels per step through an odd-even transposition sort of the frames. SSE2 only has signed 16 bit min/max,
+    // flipping the sign bit keeps the unsigned order and sorts the invalid zeros to the front. The median index of
+    // each lane then depends on its number of zeros and is picked out with a compare per frame
+    frame_count = std::min(frame_count, kMaxMedianFrames);
+    min_count = std::max(1, min_count);
+    const __m128i zero = _mm_setzero_si128(), sign = _mm_set1_epi16(static_cast<short>(0x8000));
+    const __m128i frames_vector = _mm_set1_epi16(static_cast<short>(frame_count));
+    const __m128i enough = _mm_set1_epi16(static_cast<short>(min_count - 1));
+    __m128i values[kMaxMedianFrames];
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        __m128i zeros = zero;
+        for (int frame = 0; frame < frame_count; ++frame) {
+            __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i *>(frames[frame] + i));
+            zeros = _mm_sub_epi16(zeros, _mm_cmpeq_epi16(pixels, zero));
+            values[frame] = _mm_xor_si128(pixels, sign);
+        }
+
+        for (int pass = 0; pass < frame_count; ++pass)
+            for (int frame = pass & 1; frame + 1 < frame_count; frame += 2) {
+                __m128i low = _mm_min_epi16(values[frame], values[frame + 1]);
+                values[frame + 1] = _mm_max_epi16(values[frame], values[frame + 1]);
+                values[frame] = low;
+            }
+
+        __m128i valid = _mm_sub_epi16(frames_vector, zeros);
+        __m128i lower_index = _mm_add_epi16(zeros, _mm_srai_epi16(_mm_sub_epi16(valid, _mm_set1_epi16(1)), 1));
+        __m128i upper_index = _mm_add_epi16(zeros, _mm_srai_epi16(valid, 1));
+        __m128i lower = zero, upper = zero;
+        for (int frame = 0; frame < frame_count; ++frame) {
+            __m128i index = _mm_set1_epi16(static_cast<short>(frame));
+            lower = _mm_or_si128(lower, _mm_and_si128(_mm_cmpeq_epi16(lower_index, index), values[frame]));
+            upper = _mm_or_si128(upper, _mm_and_si128(_mm_cmpeq_epi16(upper_index, index), values[frame]));
+        }
+
+        __m128i median = _mm_avg_epu16(_mm_xor_si128(lower, sign), _mm_xor_si128(upper, sign));
+        median = _mm_and_si128(median, _mm_cmpgt_epi16(valid, enough));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), median);
+    }
+
+    if (i < size) {
+        const uint16_t *tails[kMaxMedianFrames];
+        for (int frame = 0; frame < frame_count; ++frame)
+            tails[frame] = frames[frame] + i;
+        MedianDepthScalar(tails, frame_count, size - i, min_count, dst + i);
+    }
+#else
+    MedianDepthScalar(frames, frame_count, size, min_count, dst);
+#endif
+}
@@ -0,0 +1,324 @@
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+
+#include "Metrics.hpp"
+#include "Tracer.hpp"
+
+std::atomic<bool> Metrics::enabled_(false);
+std::array<std::atomic<int64_t>, static_cast<int>(Gauge::COUNT)> Metrics::gauges_{};
+
+const char *StageToString(Stage stage) {
+    static const char *names[] = {"wait_for_frames", "colourise", "point_cloud", "quality", "create_directories",
+                                  "write_depth", "write_coloured_depth", "write_colour", "write_ir_left",
+                                  "write_ir_right", "export_ply", "write_metadata", "write_data", "reattach",
+                                  "stabilise_exposure", "fuse_depth",
+                                  "exposure_bracket", "merge_exposures"};
+    return names[static_cast<int>(stage)];
+}
+
+const char *CounterToString(Counter counter) {
+    static const char *names[] = {"frames", "invalid_frames", "dropped_frames", "saves", "bytes_written", "quality_skips",
+                                  "duplicate_skips", "reattaches"};
+    return names[static_cast<int>(counter)];
+}
+
+const char *GaugeToString(Gauge gauge) {
+    static const char *names[] = {"cameras_connected", "save_queue_depth"};
+    return names[static_cast<int>(gauge)];
+}
+
+LatencyHistogram::LatencyHistogram() {
+    Reset();
+}
+
+int LatencyHistogram::BucketIndex(uint64_t value) {
+    if (value < 2 * kSubBucketHalf)
+        return static_cast<int>(value);
+
+    // Keep the top kSubBucketBits bits of the value, the exponent selects the group of sub buckets
+    int msb = 63 - __builtin_clzll(value);
+    int exponent = msb - kSubBucketBits + 1;
+    return exponent * kSubBucketHalf + static_cast<int>(value >> exponent);
+}
+
+uint64_t LatencyHistogram::BucketUpperBound(int index) {
+    if (index < 2 * kSubBucketHalf)
+        return static_cast<uint64_t>(index);
+
+    int exponent = index / kSubBucketHalf - 1;
+    uint64_t sub_bucket = static_cast<uint64_t>(index - exponent * kSubBucketHalf);
+    return ((sub_bucket + 1) << exponent) - 1;
+}
+
+void LatencyHistogram::Record(uint64_t value) {
+    buckets_[BucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    sum_.fetch_add(value, std::memory_order_relaxed);
+
+    uint64_t current = max_.load(std::memory_order_relaxed);
+    while (value > current && !max_.compare_exchange_weak(current, value, std::memory_order_relaxed));
+}
+
+void LatencyHistogram::Reset() {
+    for (auto &bucket : buckets_)
+        bucket.store(0, std::memory_order_relaxed);
+    count_.store(0, std::memory_order_relaxed);
+    sum_.store(0, std::memory_order_relaxed);
+    max_.store(0, std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::Count() const {
+    return count_.load(std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::Sum() const {
+    return sum_.load(std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::Max() const {
+    return max_.load(std::memory_order_relaxed);
+}
+
+double LatencyHistogram::Mean() const {
+    uint64_t count = Count();
+    return count == 0 ? 0.0 : static_cast<double>(Sum()) / count;
+}
+
+uint64_t LatencyHistogram::Percentile(double percentile) const {
+    // Sum the buckets first, the total may differ slightly from count_ while writers are active
+    uint64_t total = 0;
+    for (auto &bucket : buckets_)
+        total += bucket.load(std::memory_order_relaxed);
+    if (total == 0)
+        return 0;
+
+    auto target = static_cast<uint64_t>(percentile / 100.0 * total + 0.5);
+    target = std::max<uint64_t>(target, 1);
+
+    uint64_t seen = 0;
+    for (int i = 0; i < kBucketCount; ++i) {
+        seen += buckets_[i].load(std::memory_order_relaxed);
+        if (seen >= target)
+            return std::min(BucketUpperBound(i), Max());
+    }
+    return Max();
+}
+
+CameraMetrics::CameraMetrics(std::string serial_number, int slot) : serial_number_(std::move(serial_number)),
+                                                                    slot_(slot) {}
+
+void CameraMetrics::Record(Stage stage, uint64_t nanoseconds) {
+    histograms_[static_cast<int>(stage)].Record(nanoseconds);
+}
+
+void CameraMetrics::Add(Counter counter, uint64_t value) {
+    if (!Metrics::Enabled() || slot_ < 0)
+        return;
+
+    // Single writer per shard, so a relaxed load/store pair is enough and avoids a locked instruction
+    auto &cell = Metrics::LocalShard()->values[slot_][static_cast<int>(counter)];
+    cell.store(cell.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+void CameraMetrics::AddBytes(Stage stage, uint64_t bytes) {
+    if (!Metrics::Enabled() || slot_ < 0)
+        return;
+
+    auto &values = Metrics::LocalShard()->values[slot_];
+    auto &cell = values[static_cast<int>(Counter::COUNT) + static_cast<int>(stage)];
+    auto &total = values[static_cast<int>(Counter::BYTES_WRITTEN)];
+    cell.store(cell.load(std::memory_order_relaxed) + bytes, std::memory_order_relaxed);
+    total.store(total.load(std::memory_order_relaxed) + bytes, std::memory_order_relaxed);
+}
+
+uint64_t CameraMetrics::Count(Counter counter) const {
+    return slot_ < 0 ? 0 : Metrics::GetInstance()->SumShards(slot_, static_cast<int>(counter));
+}
+
+uint64_t CameraMetrics::Bytes(Stage stage) const {
+    return slot_ < 0 ? 0 : Metrics::GetInstance()->SumShards(slot_,
+                                                             static_cast<int>(Counter::COUNT) + static_cast<int>(stage));
+}
+
+const LatencyHistogram &CameraMetrics::Histogram(Stage stage) const {
+    return histograms_[static_cast<int>(stage)];
+}
+
+const std::string &CameraMetrics::GetSerialNumber() const {
+    return serial_number_;
+}
+
+void CameraMetrics::Reset() {
+    for (auto &histogram : histograms_)
+        histogram.Reset();
+    if (slot_ >= 0)
+        Metrics::GetInstance()->ResetShards(slot_);
+}
+
+Metrics::CounterShard::CounterShard() {
+    for (auto &camera : values)
+        for (auto &value : camera)
+            value.store(0, std::memory_order_relaxed);
+}
+
+// Returns the thread's shard to the free list when the thread exits, its totals are kept
+struct ShardHandle {
+    Metrics::CounterShard *shard = nullptr;
+    ~ShardHandle() {
+        if (shard != nullptr)
+            Metrics::GetInstance()->ReleaseShard(shard);
+    }
+};
+
+Metrics *Metrics::GetInstance() {
+    // Intentionally leaked so thread exit handlers can still release their shard during shutdown
+    static Metrics *self = new Metrics();
+    return self;
+}
+
+void Metrics::SetEnabled(bool enabled) {
+    enabled_.store(enabled, std::memory_order_relaxed);
+}
+
+void Metrics::AddGauge(Gauge gauge, int64_t value) {
+    gauges_[static_cast<int>(gauge)].fetch_add(value, std::memory_order_relaxed);
+}
+
+void Metrics::SetGauge(Gauge gauge, int64_t value) {
+    gauges_[static_cast<int>(gauge)].store(value, std::memory_order_relaxed);
+}
+
+int64_t Metrics::GetGauge(Gauge gauge) {
+    return gauges_[static_cast<int>(gauge)].load(std::memory_order_relaxed);
+}
+
+Metrics::CounterShard *Metrics::LocalShard() {
+    thread_local ShardHandle handle;
+    if (handle.shard == nullptr)
+        handle.shard = GetInstance()->AcquireShard();
+    return handle.shard;
+}
+
+Metrics::CounterShard *Metrics::AcquireShard() {
+    {
+        std::lock_guard<std::mutex> lock(free_lock_);
+        if (!free_shards_.empty()) {
+            CounterShard *shard = free_shards_.back();
+            free_shards_.pop_back();
+            return shard;
+        }
+    }
+
+    // Pushed onto the front of the list, a scrape sees either the old or the new head and both are complete lists
+    CounterShard *shard = new CounterShard();
+    shard->next = shards_.load(std::memory_order_relaxed);
+    while (!shards_.compare_exchange_weak(shard->next, shard, std::memory_order_release, std::memory_order_relaxed)) {}
+    return shard;
+}
+
+void Metrics::ReleaseShard(CounterShard *shard) {
+    std::lock_guard<std::mutex> lock(free_lock_);
+    free_shards_.push_back(shard);
+}
+
+uint64_t Metrics::SumShards(int slot, int index) {
+    uint64_t total = 0;
+    for (CounterShard *shard = shards_.load(std::memory_order_acquire); shard != nullptr; shard = shard->next)
+        total += shard->values[slot][index].load(std::memory_order_relaxed);
+    return total;
+}
+
+void Metrics::ResetShards(int slot) {
+    for (CounterShard *shard = shards_.load(std::memory_order_acquire); shard != nullptr; shard = shard->next)
+        for (auto &value : shard->values[slot])
+            value.store(0, std::memory_order_relaxed);
+}
+
+CameraMetrics *Metrics::Camera(const std::string &serial_number) {
+    std::lock_guard<std::mutex> lock(lock_);
+
+    auto itr = cameras_.find(serial_number);
+    if (itr != cameras_.end())
+        return itr->second.get();
+
+    int slot = cameras_.size() < kMaxCameras ? static_cast<int>(cameras_.size()) : -1;
+    if (slot < 0)
+        std::cerr << "Metrics: More than " << kMaxCameras << " cameras, counters disabled for " << serial_number
+                  << std::endl;
+
+    return cameras_.emplace(serial_number, std::unique_ptr<CameraMetrics>(new CameraMetrics(serial_number, slot)))
+            .first->second.get();
+}
+
+std::vector<CameraMetrics *> Metrics::Cameras() {
+    std::lock_guard<std::mutex> lock(lock_);
+    std::vector<CameraMetrics *> cameras;
+    for (auto &cam : cameras_)
+        cameras.push_back(cam.second.get());
+    return cameras;
+}
+
+void Metrics::Reset() {
+    for (auto &cam : Cameras())
+        cam->Reset();
+}
+
+void Metrics::Dump(std::ostream &out) {
+    if (!Enabled()) {
+        out << "Metrics disabled, set 'instrumentation/enabled' in the config file" << std::endl;
+        return;
+    }
+
+    auto ms = [](double ns) { return ns / 1e6; };
+    for (auto &cam : Cameras()) {
+        out << "Camera " << cam->GetSerialNumber() << ":";
+        for (int c = 0; c < static_cast<int>(Counter::COUNT); ++c)
+            out << " " << CounterToString(static_cast<Counter>(c)) << "=" << cam->Count(static_cast<Counter>(c));
+        out << "\n\t" << std::left << std::setw(22) << "Stage" << std::right << std::setw(8) << "Count"
+            << std::setw(10) << "Mean" << std::setw(10) << "P50" << std::setw(10) << "P90" << std::setw(10) << "P99"
+            << std::setw(10) << "Max" << std::setw(10) << "MB" << " (ms)\n";
+
+        for (int s = 0; s < static_cast<int>(Stage::COUNT); ++s) {
+            auto stage = static_cast<Stage>(s);
+            const LatencyHistogram &histogram = cam->Histogram(stage);
+            if (histogram.Count() == 0)
+                continue;
+
+            out << "\t" << std::left << std::setw(22) << StageToString(stage) << std::right << std::setw(8)
+                << histogram.Count() << std::fixed << std::setprecision(2)
+                << std::setw(10) << ms(histogram.Mean()) << std::setw(10) << ms(histogram.Percentile(50))
+                << std::setw(10) << ms(histogram.Percentile(90)) << std::setw(10) << ms(histogram.Percentile(99))
+                << std::setw(10) << ms(histogram.Max()) << std::setw(10) << cam->Bytes(stage) / 1e6 << "\n";
+        }
+        out.unsetf(std::ios_base::floatfield);
+    }
+    out << std::flush;
+}
+
+ScopedTimer::ScopedTimer(CameraMetrics *metrics, Stage stage) : metrics_(metrics), stage_(stage),
+                                                                 timed_(Metrics::Enabled()),
+                                                                 traced_(Tracer::Enabled()) {
+    if (timed_ || traced_)
+        start_ = std::chrono::steady_clock::now();
+}
+
+ScopedTimer::~ScopedTimer() {
+    if (!timed_ && !traced_)
+        return;
+
+    auto end = std::chrono::steady_clock::now();
+    if (timed_ && metrics_ != nullptr)
+        metrics_->Record(stage_, static_cast<uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(end - start_).count()));
+
+    if (traced_) {
+        auto ns = [](std::chrono::steady_clock::time_point t) {
+            return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    t.time_since_epoch()).count());
+        };
+        Tracer::GetInstance()->Record(StageToString(stage_),
+                                      metrics_ != nullptr ? metrics_->GetSerialNumber().c_str() : "",
+                                      ns(start_), ns(end));
+    }
+}
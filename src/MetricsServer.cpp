@@ -0,0 +1,216 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+#include <boost/filesystem.hpp>
+
+#include "ConfigManager.hpp"
+#include "MetricsServer.hpp"
+
+MetricsServer::MetricsServer(std::string address, int port) : ThreadClass(10), address_(std::move(address)),
+                                                               port_(port) {
+    StartThread();
+}
+
+MetricsServer::~MetricsServer() {
+    // Stop here rather than in ThreadClass so Loop is never called on a partially destroyed object
+    cancel_thread_ = true;
+    if (thread_.joinable())
+        thread_.join();
+    if (socket_ >= 0)
+        close(socket_);
+}
+
+const void MetricsServer::Setup() {
+    socket_ = socket(AF_INET, SOCK_STREAM, 0);
+    int reuse = 1;
+    setsockopt(socket_, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(static_cast<uint16_t>(port_));
+    if (inet_pton(AF_INET, address_.c_str(), &addr.sin_addr) != 1 ||
+        bind(socket_, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 || listen(socket_, 4) != 0) {
+        std::cerr << "Metrics endpoint: Could not listen on " << address_ << ":" << port_ << " (" << strerror(errno)
+                  << ")" << std::endl;
+        return;
+    }
+
+    std::cout << "Metrics endpoint: Serving http://" << address_ << ":" << port_ << "/metrics" << std::endl;
+
+    while (ThreadAlive()) {
+        try {
+            Loop();
+        } catch (const std::exception &err) {
+            std::cerr << "Metrics endpoint error: " << err.what() << std::endl;
+        }
+    }
+}
+
+const void MetricsServer::Loop() {
+    // Wake up regularly so the destructor can stop the thread
+    pollfd fd{socket_, POLLIN, 0};
+    if (poll(&fd, 1, static_cast<int>(ms_timeout_)) <= 0 || !(fd.revents & POLLIN))
+        return;
+
+    int client = accept(socket_, nullptr, nullptr);
+    if (client < 0)
+        return;
+
+    HandleClient(client);
+    close(client);
+}
+
+void MetricsServer::HandleClient(int client) {
+    // Scrapers send a small GET request, the request line is all that is needed
+    char buffer[1024];
+    timeval timeout{1, 0};
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    ssize_t received = recv(client, buffer, sizeof(buffer) - 1, 0);
+    if (received <= 0)
+        return;
+    buffer[received] = '\0';
+
+    std::string request(buffer);
+    std::string status = "200 OK", body;
+    if (request.compare(0, 12, "GET /metrics") == 0 || request.compare(0, 6, "GET / ") == 0) {
+        body = Render();
+    } else {
+        status = "404 Not Found";
+        body = "Not found, metrics are served on /metrics\n";
+    }
+
+    std::ostringstream response;
+    response << "HTTP/1.1 " << status << "\r\nContent-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+             << "Content-Length: " << body.size() << "\r\nConnection: close\r\n\r\n" << body;
+
+    std::string data = response.str();
+    size_t sent = 0;
+    while (sent < data.size()) {
+        ssize_t n = send(client, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0)
+            break;
+        sent += static_cast<size_t>(n);
+    }
+}
+
+std::string MetricsServer::DiskPath() {
+    std::string path = ConfigManager::IGet("save-path-prefix");
+    return path.empty() ? "." : path;
+}
+
+std::string MetricsServer::Render() {
+    std::ostringstream out;
+    auto now = std::chrono::steady_clock::now();
+    std::vector<CameraMetrics *> cameras = Metrics::GetInstance()->Cameras();
+
+    auto header = [&out](const char *name, const char *type, const char *help) {
+        out << "# HELP strawberry_" << name << " " << help << "\n# TYPE strawberry_" << name << " " << type << "\n";
+    };
+
+    header("frames_total", "counter", "Coherent framesets received");
+    for (auto &cam : cameras)
+        out << "strawberry_frames_total{serial=\"" << cam->GetSerialNumber() << "\"} " << cam->Count(Counter::FRAMES)
+            << "\n";
+
+    header("dropped_frames_total", "counter", "Frames missing from the hardware frame counter sequence");
+    for (auto &cam : cameras)
+        out << "strawberry_dropped_frames_total{serial=\"" << cam->GetSerialNumber() << "\"} "
+            << cam->Count(Counter::DROPPED_FRAMES) << "\n";
+
+    header("invalid_framesets_total", "counter", "Incomplete framesets that had to be waited for again");
+    for (auto &cam : cameras)
+        out << "strawberry_invalid_framesets_total{serial=\"" << cam->GetSerialNumber() << "\"} "
+            << cam->Count(Counter::INVALID_FRAMES) << "\n";
+
+    header("saves_total", "counter", "Captures written to disk");
+    for (auto &cam : cameras)
+        out << "strawberry_saves_total{serial=\"" << cam->GetSerialNumber() << "\"} " << cam->Count(Counter::SAVES)
+            << "\n";
+
+    header("quality_skipped_saves_total", "counter", "Saves skipped because no frame passed the quality gate");
+    for (auto &cam : cameras)
+        out << "strawberry_quality_skipped_saves_total{serial=\"" << cam->GetSerialNumber() << "\"} "
+            << cam->Count(Counter::QUALITY_SKIPS) << "\n";
+
+    header("duplicate_skipped_saves_total", "counter", "Saves skipped as near duplicates of a recent save");
+    for (auto &cam : cameras)
+        out << "strawberry_duplicate_skipped_saves_total{serial=\"" << cam->GetSerialNumber() << "\"} "
+            << cam->Count(Counter::DUPLICATE_SKIPS) << "\n";
+
+    header("reattaches_total", "counter", "Times the camera was unplugged and resumed without a full restart");
+    for (auto &cam : cameras)
+        out << "strawberry_reattaches_total{serial=\"" << cam->GetSerialNumber() << "\"} "
+            << cam->Count(Counter::REATTACHES) << "\n";
+
+    header("written_bytes_total", "counter", "Bytes written to disk per stream");
+    for (auto &cam : cameras)
+        for (int s = 0; s < static_cast<int>(Stage::COUNT); ++s)
+            if (cam->Bytes(static_cast<Stage>(s)) > 0)
+                out << "strawberry_written_bytes_total{serial=\"" << cam->GetSerialNumber() << "\",stage=\""
+                    << StageToString(static_cast<Stage>(s)) << "\"} " << cam->Bytes(static_cast<Stage>(s)) << "\n";
+
+    // Rates are averaged over the time since the previous scrape
+    header("fps", "gauge", "Framesets per second since the previous scrape");
+    std::ostringstream write_rate;
+    for (auto &cam : cameras) {
+        Sample current;
+        current.frames = cam->Count(Counter::FRAMES);
+        current.bytes = cam->Count(Counter::BYTES_WRITTEN);
+        current.time = now;
+
+        double fps = 0, mb_per_second = 0;
+        auto itr = last_samples_.find(cam->GetSerialNumber());
+        if (itr != last_samples_.end()) {
+            double seconds = std::chrono::duration<double>(now - itr->second.time).count();
+            if (seconds > 0) {
+                fps = (current.frames - itr->second.frames) / seconds;
+                mb_per_second = (current.bytes - itr->second.bytes) / seconds / 1e6;
+            }
+        }
+        last_samples_[cam->GetSerialNumber()] = current;
+
+        out << "strawberry_fps{serial=\"" << cam->GetSerialNumber() << "\"} " << fps << "\n";
+        write_rate << "strawberry_write_megabytes_per_second{serial=\"" << cam->GetSerialNumber() << "\"} "
+                   << mb_per_second << "\n";
+    }
+    header("write_megabytes_per_second", "gauge", "Write throughput since the previous scrape");
+    out << write_rate.str();
+
+    header("stage_seconds", "summary", "Latency of each capture and save stage, image writes are encoder time");
+    for (auto &cam : cameras) {
+        for (int s = 0; s < static_cast<int>(Stage::COUNT); ++s) {
+            const LatencyHistogram &histogram = cam->Histogram(static_cast<Stage>(s));
+            if (histogram.Count() == 0)
+                continue;
+
+            std::string labels = "serial=\"" + cam->GetSerialNumber() + "\",stage=\"" +
+                                 StageToString(static_cast<Stage>(s)) + "\"";
+            for (double quantile : {0.5, 0.9, 0.99})
+                out << "strawberry_stage_seconds{" << labels << ",quantile=\"" << quantile << "\"} "
+                    << histogram.Percentile(quantile * 100) / 1e9 << "\n";
+            out << "strawberry_stage_seconds_sum{" << labels << "} " << histogram.Sum() / 1e9 << "\n";
+            out << "strawberry_stage_seconds_count{" << labels << "} " << histogram.Count() << "\n";
+        }
+    }
+
+    const char *gauge_help[] = {"Cameras currently streaming", "Captures waiting to be written to disk"};
+    for (int g = 0; g < static_cast<int>(Gauge::COUNT); ++g) {
+        header(GaugeToString(static_cast<Gauge>(g)), "gauge", gauge_help[g]);
+        out << "strawberry_" << GaugeToString(static_cast<Gauge>(g)) << " " << Metrics::GetGauge(static_cast<Gauge>(g))
+            << "\n";
+    }
+
+    header("disk_free_bytes", "gauge", "Space available to the grabber on the save path");
+    boost::system::error_code error;
+    boost::filesystem::space_info space = boost::filesystem::space(DiskPath(), error);
+    out << "strawberry_disk_free_bytes " << (error ? 0 : space.available) << "\n";
+
+    return out.str();
+}
@@ -1,37 +1,102 @@
+#include <algorithm>
+#include <future>
+#include <iomanip>
+#include <limits>
+#include <set>
+
 #include "MultiCamD400.hpp"
+#include "BagCamera.hpp"
+#include "SyntheticCamera.hpp"
+#include "Tracer.hpp"
 
 MultiCamD400::MultiCamD400(unsigned int hz) : ThreadClass(hz) {
     StartThread();
 }
 
+MultiCamD400::~MultiCamD400() {
+    // Stop acquisition before the members go, writer_ then finishes any queued saves
+    config_watcher_.reset();
+    cancel_thread_ = true;
+    if (thread_.joinable())
+        thread_.join();
+}
+
 const void MultiCamD400::Setup() {
     // Get the first real sense device
     rs2::context ctx;
 
-    // When devices are changed update connected devices
-    ctx.set_devices_changed_callback([&](rs2::event_information &info) {
-        initialised = false;
-        RemoveDevice(info);
-        for (auto &&dev : info.get_new_devices())
-            AddDevice(dev);
-        initialised = true;
-    });
-
-    // Get the list of currently connected devices
-    auto list = ctx.query_devices();
+    Tracer::SetThreadName("acquisition");
+
+    // Throws on an invalid config before any camera is touched
+    settings_ = CaptureSettings::Current();
+
+    const CameraSettings &defaults = settings_->Defaults();
+
+    // Saves queued by the capture triggers are encoded here so acquisition never waits on the disk
+    writer_.reset(new WorkerPool(static_cast<unsigned int>(defaults.writer.threads),
+                                 static_cast<size_t>(defaults.writer.queue), "writer"));
+
+    // Physical cameras can be turned off to run only recorded or synthetic ones (e.g. on machines without cameras)
+    bool physical = defaults.cameras.physical;
+
+    // Cameras read depth-fusion and exposure-bracket themselves, the fuse and bracket commands change them for all
+    depth_fusion_ = defaults.fusion.enabled;
+    exposure_bracket_ = defaults.bracket.enabled;
+
+    // Every camera found below is started at once by AddCameras
+    std::vector<PendingCamera> pending;
+    if (physical) {
+        // When devices are changed update connected devices
+        ctx.set_devices_changed_callback([&](rs2::event_information &info) {
+            Tracer::SetThreadName("hot-plug");
+            TraceScope trace("DevicesChanged");
+            initialised = false;
+            RemoveDevice(info);
+            std::vector<PendingCamera> pending;
+            for (auto &&dev : info.get_new_devices())
+                pending.push_back(PendingDevice(dev));
+            AddCameras(pending);
+            initialised = true;
+        });
+
+        // Get the list of currently connected devices
+        auto list = ctx.query_devices();
+
+        if (list.size() == 0) {
+            //throw std::runtime_error("No device detected.");
+            std::cerr << "No devices connected in at run time, verify with 'lsusb'" << std::endl;
+        }
 
-    if (list.size() == 0) {
-        //throw std::runtime_error("No device detected.");
-        std::cerr << "No devices connected in at run time, verify with 'lsusb'" << std::endl;
+        // Initialise the devices
+        for (auto &&cam : list)
+            pending.push_back(PendingDevice(cam));
     }
 
-    // Initialise the devices
-    for (auto &&cam : list)
-        AddDevice(cam);
+    AddVirtualCameras(defaults.cameras.virtual_cameras, pending);
+
+    AddCameras(pending);
 
     initialised = true;
 
-    loop_paused_ = !ConfigManager::IGet("gui-enabled");
+    loop_paused_ = !defaults.gui_enabled;
+
+    if (defaults.quality.enabled) {
+        const std::string &policy = defaults.quality.policy;
+        quality_gate_ = QualityGate(policy == "wait" ? QualityGate::Policy::WAIT :
+                                    policy == "skip" ? QualityGate::Policy::SKIP : QualityGate::Policy::RECORD,
+                                    defaults.quality.wait_ms);
+    }
+
+    if (defaults.rolling.enabled)
+        SetRollingCapture(true);
+
+    if (defaults.paired.enabled)
+        SetPairedCapture(true);
+
+    if (defaults.reload.enabled)
+        config_watcher_.reset(new ConfigWatcher([this](const ConfigSnapshot &previous, const ConfigSnapshot &current) {
+            ReloadConfig(previous, current);
+        }, defaults.reload.debounce_ms));
 
     while (ThreadAlive()) {
         try {
@@ -59,67 +124,541 @@ const void MultiCamD400::Loop() {
         std::lock_guard<std::mutex> lock(lock_mutex_);
         for (auto &&cam : cameras_)
             cam.second->WaitForFrames();
+        AlignFrames();
+        if (rolling_capture_)
+            EvaluateTriggers();
     }
 }
 
-const void MultiCamD400::AddDevice(rs2::device dev) {
+const void MultiCamD400::SetRollingCapture(bool enabled) {
+    std::lock_guard<std::mutex> lock(lock_mutex_);
+    const RollingSettings &rolling = settings_->Defaults().rolling;
+    for (auto &&cam : cameras_)
+        cam.second->SetChangeDetection(enabled, rolling.on_colour, rolling.decimation);
+
+    rolling_capture_ = enabled;
+    last_rolling_save_ = std::chrono::steady_clock::now();
+    quality_gate_.Reset();
+
+    // Triggers are evaluated by the acquisition loop, which is paused while headless
+    if (enabled)
+        loop_paused_ = false;
+    std::cout << "Rolling capture " << (enabled ? "enabled" : "disabled") << std::endl;
+}
+
+const bool MultiCamD400::RollingCapture() {
+    return rolling_capture_;
+}
+
+const void MultiCamD400::SetPairedCapture(bool enabled) {
+    TraceScope trace("SetPairedCapture");
     flip_guard<bool> pause(&loop_paused_, true);
     std::lock_guard<std::mutex> lock(lock_mutex_);
 
+    // Cameras without emitter on/off keep saving their current frames
+    size_t paired = 0;
+    for (auto &&cam : cameras_)
+        paired += cam.second->SetPairedCapture(enabled);
+    paired_capture_ = enabled && paired > 0;
+    if (enabled)
+        std::cout << "Paired capture on " << paired << " of " << cameras_.size() << " cameras" << std::endl;
+}
+
+const bool MultiCamD400::PairedCapture() {
+    return paired_capture_;
+}
+
+const void MultiCamD400::SetDepthFusion(bool enabled) {
+    TraceScope trace("SetDepthFusion");
+    flip_guard<bool> pause(&loop_paused_, true);
+    std::lock_guard<std::mutex> lock(lock_mutex_);
+
+    size_t fused = 0;
+    for (auto &&cam : cameras_)
+        fused += cam.second->SetDepthFusion(enabled);
+    depth_fusion_ = enabled && fused > 0;
+}
+
+const bool MultiCamD400::DepthFusion() {
+    return depth_fusion_;
+}
+
+const void MultiCamD400::SetExposureBracket(bool enabled) {
+    TraceScope trace("SetExposureBracket");
+    flip_guard<bool> pause(&loop_paused_, true);
+    std::lock_guard<std::mutex> lock(lock_mutex_);
+
+    // Cameras without manual colour exposure keep saving a single colour frame
+    size_t bracketed = 0;
+    for (auto &&cam : cameras_)
+        bracketed += cam.second->SetExposureBracket(enabled);
+    exposure_bracket_ = enabled && bracketed > 0;
+}
+
+const bool MultiCamD400::ExposureBracket() {
+    return exposure_bracket_;
+}
+
+const void MultiCamD400::EvaluateTriggers() {
+    if (cameras_.empty())
+        return;
+
+    // settings_ only changes under lock_mutex_, which the acquisition loop holds
+    const RollingSettings &rolling = settings_->Defaults().rolling;
+    int interval_ms = rolling.interval_ms, min_gap_ms = rolling.min_gap_ms;
+    double threshold = rolling.change_threshold;
+    double elapsed_ms = std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - last_rolling_save_).count();
+
+    std::string trigger;
+    if (interval_ms > 0 && elapsed_ms >= interval_ms) {
+        trigger = "interval";
+    } else if (threshold > 0 && elapsed_ms >= min_gap_ms) {
+        // Any camera seeing enough change saves every camera so the capture group stays complete
+        double change = 0;
+        for (auto &&cam : cameras_)
+            change = std::max(change, cam.second->GetChangeScore());
+        if (change >= threshold)
+            trigger = "change";
+    }
+
+    // A failing frame defers the save to a later loop instead of blocking acquisition, the trigger stays armed
+    auto now = std::chrono::steady_clock::now();
+    bool passed = trigger.empty() || quality_gate_.GetPolicy() == QualityGate::Policy::RECORD || QualityPassed();
+    switch (quality_gate_.Evaluate(!trigger.empty(), passed, now)) {
+        case QualityGate::Decision::SAVE:
+            QueueSave(trigger);
+            break;
+        case QualityGate::Decision::SKIP:
+            last_rolling_save_ = now;
+            SkipSave(trigger);
+            break;
+        case QualityGate::Decision::NONE:
+        case QualityGate::Decision::HOLD:
+            break;
+    }
+}
+
+const bool MultiCamD400::QualityPassed(int index) {
+    int i = 0;
+    for (auto &&cam : cameras_)
+        if ((index < 0 || index == i++) && !cam.second->GetQuality().passed)
+            return false;
+    return true;
+}
+
+const bool MultiCamD400::AwaitQuality(int index) {
+    if (quality_gate_.GetPolicy() == QualityGate::Policy::RECORD || QualityPassed(index))
+        return true;
+
+    // Saves pause acquisition, so keep pulling aligned frames here until they pass or the wait runs out
+    TraceScope trace("AwaitQuality");
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(quality_gate_.GetWaitMs());
+    while (!QualityPassed(index) && std::chrono::steady_clock::now() < deadline) {
+        for (auto &&cam : cameras_)
+            cam.second->WaitForFrames();
+        AlignFrames();
+    }
+
+    if (QualityPassed(index) || quality_gate_.GetPolicy() == QualityGate::Policy::WAIT)
+        return true;
+    SkipSave("manual", index);
+    return false;
+}
+
+const void MultiCamD400::SkipSave(const std::string &trigger, int index) {
+    int i = 0;
+    for (auto &&cam : cameras_) {
+        if ((index >= 0 && index != i++) || cam.second->GetQuality().passed)
+            continue;
+
+        const FrameQuality &quality = cam.second->GetQuality();
+        Metrics::GetInstance()->Camera(cam.first)->Add(Counter::QUALITY_SKIPS);
+        std::cerr << "Camera " << cam.first << ": Skipped " << trigger << " save, frame failed the quality gate "
+                  << "(sharpness " << quality.sharpness << ", clipped " << quality.under_exposed + quality.over_exposed
+                  << ", depth valid " << quality.depth_valid << ")" << std::endl;
+    }
+}
+
+const void MultiCamD400::QueueSave(const std::string &trigger) {
+    TraceScope trace("QueueSave");
+    last_rolling_save_ = std::chrono::steady_clock::now();
+
+    // A fused or bracketed capture waits for several frames, the cameras then collect theirs side by side.
+    // Otherwise each capture is taken in turn on this thread when its result is asked for
+    std::vector<std::future<std::shared_ptr<Capture>>> captures;
+    std::launch policy = depth_fusion_ || exposure_bracket_ ? std::launch::async : std::launch::deferred;
+    for (auto &&cam : cameras_) {
+        Camera *camera = cam.second.get();
+        captures.push_back(std::async(policy, [camera, &trigger]() { return camera->TakeCapture(trigger); }));
+    }
+
+    auto next = captures.begin();
+    for (auto &&cam : cameras_) {
+        Camera *camera = cam.second.get();
+        std::shared_ptr<Capture> capture;
+        try {
+            capture = (next++)->get();
+        } catch (const std::exception &e) {
+            std::cerr << "Camera " << cam.first << ": Could not take " << trigger << " capture (" << e.what() << ")"
+                      << std::endl;
+            continue;
+        }
+
+        // A full queue means the disk can not keep up, drop the capture rather than stall the frames
+        Metrics::AddGauge(Gauge::SAVE_QUEUE_DEPTH, 1);
+        bool queued = writer_->TrySubmit([camera, capture]() {
+            camera->WriteCapture(*capture);
+            Metrics::AddGauge(Gauge::SAVE_QUEUE_DEPTH, -1);
+        });
+
+        if (!queued) {
+            Metrics::AddGauge(Gauge::SAVE_QUEUE_DEPTH, -1);
+            std::cerr << "Camera " << cam.first << ": Writer queue full, dropped " << trigger << " capture" << std::endl;
+        }
+    }
+}
+
+Camera *MultiCamD400::ReferenceCamera() {
+    // The hardware master defines the group id, otherwise fall back to the first camera
+    for (auto &&cam : cameras_)
+        if (cam.second->GetSyncMode() == SyncMode::MASTER)
+            return cam.second.get();
+    return cameras_.empty() ? nullptr : cameras_.begin()->second.get();
+}
+
+const void MultiCamD400::AlignFrames() {
+    TraceScope trace("AlignFrames");
+    Camera *reference = ReferenceCamera();
+    if (reference == nullptr)
+        return;
+
+    int max_attempts = settings_->Defaults().sync.alignment_attempts;
+    double tolerance = reference->GetFramePeriod() / 2.0;
+
+    bool hardware = std::all_of(cameras_.begin(), cameras_.end(), [](const CameraMap::value_type &cam) {
+        return cam.second->HardwareSynced();
+    });
+
+    // Hardware synced cameras expose together, so once the counter offsets are known frames are grouped by counter.
+    // Until then (or without sync) frames are grouped by host timestamp to within half a frame period
+    bool use_counters = hardware && counter_offsets_.size() == cameras_.size();
+    bool aligned = false;
+    for (int attempt = 0; !aligned && attempt <= max_attempts; ++attempt) {
+        long long newest_counter = std::numeric_limits<long long>::min();
+        double newest_timestamp = std::numeric_limits<double>::lowest();
+        for (auto &&cam : cameras_) {
+            if (use_counters)
+                newest_counter = std::max(newest_counter,
+                                          cam.second->GetFrameCounter() - counter_offsets_[cam.first]);
+            else
+                newest_timestamp = std::max(newest_timestamp, cam.second->GetFrameTimestamp());
+        }
+
+        // Pull another frame from any camera lagging behind the newest frame
+        aligned = true;
+        for (auto &&cam : cameras_) {
+            bool behind = use_counters ?
+                          cam.second->GetFrameCounter() - counter_offsets_[cam.first] < newest_counter :
+                          cam.second->GetFrameTimestamp() < newest_timestamp - tolerance;
+            if (behind && attempt < max_attempts) {
+                cam.second->WaitForFrames();
+                aligned = false;
+            } else if (behind) {
+                aligned = false;
+            }
+        }
+    }
+
+    if (aligned && hardware) {
+        auto timestamps = std::minmax_element(cameras_.begin(), cameras_.end(),
+            [](const CameraMap::value_type &a, const CameraMap::value_type &b) {
+                return a.second->GetFrameTimestamp() < b.second->GetFrameTimestamp();
+            });
+        double spread = timestamps.second->second->GetFrameTimestamp() - timestamps.first->second->GetFrameTimestamp();
+
+        if (!use_counters) {
+            // Calibrate the counter offsets from a timestamp aligned set
+            for (auto &&cam : cameras_)
+                counter_offsets_[cam.first] = cam.second->GetFrameCounter() - reference->GetFrameCounter();
+        } else if (spread > tolerance) {
+            // A camera restarted its counter, recalibrate on the next loop
+            std::cerr << "Frame counters out of step (" << spread << "ms), recalibrating sync offsets" << std::endl;
+            counter_offsets_.clear();
+            aligned = false;
+        }
+    }
+
+    long long group = aligned ? reference->GetFrameCounter() : -1;
+    for (auto &&cam : cameras_)
+        cam.second->SetCaptureGroup(group, aligned && hardware);
+}
+
+const void MultiCamD400::ReloadConfig(const ConfigSnapshot &previous, const ConfigSnapshot &current) {
+    // Typed settings are applied to the running cameras, everything else is only read at start up
+    static const std::set<std::string> live = {"stream-depth", "stream-colour", "options", "advanced-preset",
+                                               "file-names", "save-path-prefix", "project-name", "camera-overrides",
+                                               "rolling-capture"};
+    std::set<std::string> keys;
+    for (auto *config : {&previous.Json(), &current.Json()})
+        for (auto it = config->begin(); it != config->end(); ++it)
+            keys.insert(it.key());
+    for (auto &key : keys)
+        if (previous[key] != current[key])
+            std::cout << "Config: " << key << " changed" << (live.count(key) ? "" : ", applied after a restart")
+                      << std::endl;
+
+    std::shared_ptr<const CaptureSettings> settings = CaptureSettings::Current();
+    TraceScope trace("ReloadConfig");
+    flip_guard<bool> pause(&loop_paused_, true);
+    std::lock_guard<std::mutex> lock(lock_mutex_);
+    std::shared_ptr<const CaptureSettings> replaced = std::atomic_exchange(&settings_, settings);
+
+    // The rolling trigger reads settings_ every loop, only a new change stream resets the cameras' references
+    const RollingSettings &rolling = settings_->Defaults().rolling, &old_rolling = replaced->Defaults().rolling;
+    bool detection = rolling_capture_ && (rolling.on_colour != old_rolling.on_colour ||
+                                          rolling.decimation != old_rolling.decimation);
+    for (auto &&cam : cameras_) {
+        try {
+            cam.second->ApplySettings(settings_->Camera(cam.first));
+            if (detection)
+                cam.second->SetChangeDetection(true, rolling.on_colour, rolling.decimation);
+        } catch (const rs2::error &e) {
+            std::cerr << "Camera " << cam.first << ": Could not apply the new settings (" << e.what() << ")"
+                      << std::endl;
+        }
+    }
+}
+
+const void MultiCamD400::AddDevice(rs2::device dev) {
+    AddCameras({PendingDevice(dev)});
+}
+
+MultiCamD400::PendingCamera MultiCamD400::PendingDevice(rs2::device dev) {
+    // The settings are held by the task, a config reload may replace settings_ (hot-plug runs outside the lock)
     std::string serial_number(dev.get_info(RS2_CAMERA_INFO_SERIAL_NUMBER));
+    std::shared_ptr<const CaptureSettings> settings = std::atomic_load(&settings_);
+    return {serial_number, [dev, settings, serial_number]() {
+        return new RealSenseD400(dev, settings->Camera(serial_number));
+    }, dev};
+}
+
+const void MultiCamD400::AddCamera(const std::string &serial_number, const std::function<Camera*()> &create) {
+    AddCameras({{serial_number, create, rs2::device()}});
+}
+
+const void MultiCamD400::AddCameras(const std::vector<PendingCamera> &pending) {
+    TraceScope trace("AddDevice");
+    flip_guard<bool> pause(&loop_paused_, true);
+    std::lock_guard<std::mutex> lock(lock_mutex_);
+    auto start = std::chrono::steady_clock::now();
+
+    // Each camera is created on its own thread, start up then takes about as long as the slowest camera
+    struct Created {
+        std::unique_ptr<Camera> camera;
+        double seconds;
+        bool reattached;
+    };
+    std::vector<std::pair<std::string, std::future<Created>>> starting;
+    for (auto &camera : pending) {
+        // Skip devices that are already connected
+        if (cameras_.find(camera.serial_number) != cameras_.end())
+            continue;
+
+        // A replugged camera resumes where it was, only when that fails is it created from scratch
+        std::unique_ptr<Camera> detached;
+        auto previous = detached_.find(camera.serial_number);
+        if (previous != detached_.end() && camera.device) {
+            detached = std::move(previous->second);
+            detached_.erase(previous);
+        }
 
-    // Return if the device is already connected
-    if (cameras_.find(serial_number) != cameras_.end())
+        const PendingCamera &task = camera;
+        starting.emplace_back(camera.serial_number, std::async(std::launch::async,
+                [&task, start, detached = std::move(detached)]() mutable {
+            Tracer::SetThreadName("start " + task.serial_number);
+            TraceScope trace("CreateCamera", task.serial_number);
+            Created created{nullptr, 0, false};
+            try {
+                if (detached && detached->Reattach(task.device)) {
+                    created.camera = std::move(detached);
+                    created.reattached = true;
+                }
+                detached.reset();
+                if (!created.camera)
+                    created.camera.reset(task.create());
+            } catch (rs2::error &e) {
+                std::cerr << "Camera " << task.serial_number << ": " << e.what() << std::endl;
+            }
+            created.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            return created;
+        }));
+    }
+    if (starting.empty())
         return;
 
-    try {
-        cameras_.emplace(serial_number, new RealSenseD400(dev));
-    } catch (rs2::error &e) {
-        std::cerr << e.what() << std::endl;
+    counter_offsets_.clear();
+    std::string slowest;
+    double slowest_time = 0;
+    size_t started = 0;
+
+    // New cameras start with depth-fusion.enabled and exposure-bracket.enabled, the commands may have changed them
+    bool fusion_configured = settings_->Defaults().fusion.enabled;
+    bool bracket_configured = settings_->Defaults().bracket.enabled;
+    for (auto &camera : starting) {
+        Created created = camera.second.get();
+        if (!created.camera)
+            continue;
+
+        // The config may have been reloaded while the camera was unplugged
+        if (created.reattached)
+            created.camera->ApplySettings(settings_->Camera(camera.first));
+        if (rolling_capture_) {
+            const RollingSettings &rolling = settings_->Defaults().rolling;
+            created.camera->SetChangeDetection(true, rolling.on_colour, rolling.decimation);
+        }
+        if (paired_capture_ && !created.reattached)
+            created.camera->SetPairedCapture(true);
+        if (depth_fusion_ != fusion_configured && !created.reattached)
+            created.camera->SetDepthFusion(depth_fusion_);
+        if (exposure_bracket_ != bracket_configured && !created.reattached)
+            created.camera->SetExposureBracket(exposure_bracket_);
+        cameras_.emplace(camera.first, std::move(created.camera));
+        ++started;
+        if (created.seconds >= slowest_time) {
+            slowest = camera.first;
+            slowest_time = created.seconds;
+        }
+    }
+    Metrics::SetGauge(Gauge::CAMERAS_CONNECTED, cameras_.size());
+
+    if (starting.size() > 1)
+        std::cout << std::fixed << std::setprecision(2) << "Started " << started << " of " << starting.size()
+                  << " cameras in " << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count()
+                  << "s (slowest " << slowest << " " << slowest_time << "s)" << std::defaultfloat << std::endl;
+}
+
+const void MultiCamD400::AddVirtualCameras(const std::vector<VirtualCameraSettings> &cameras,
+                                           std::vector<PendingCamera> &pending) {
+    for (auto &camera : cameras) {
+        const std::string &type = camera.type;
+        std::string serial_number = camera.serial;
+        int count = camera.count;
+
+        // A recording's serial number is only known once it is opened
+        if (serial_number.empty() && type == "bag") {
+            try {
+                serial_number = rs2::context().load_device(camera.path).get_info(RS2_CAMERA_INFO_SERIAL_NUMBER);
+            } catch (rs2::error &e) {
+                std::cerr << "Could not open " << camera.path << ": " << e.what() << std::endl;
+                continue;
+            }
+        } else if (serial_number.empty()) {
+            serial_number = "synthetic";
+        }
+
+        for (int i = 0; i < count; ++i) {
+            // Several cameras from one entry are told apart by an index suffix
+            std::string serial = count > 1 ? serial_number + "-" + std::to_string(i) : serial_number;
+            bool queued = std::any_of(pending.begin(), pending.end(), [&serial](const PendingCamera &camera) {
+                return camera.serial_number == serial;
+            });
+            if (queued || cameras_.find(serial) != cameras_.end()) {
+                std::cerr << "Camera " << serial << ": Already added, give each virtual camera a unique serial"
+                          << std::endl;
+                continue;
+            }
+
+            if (type == "bag") {
+                std::string path = camera.path;
+                bool repeat = camera.repeat, real_time = camera.real_time;
+                pending.push_back({serial, [=]() { return new BagCamera(path, serial, repeat, real_time); }});
+            } else {
+                const CameraSettings &settings = settings_->Camera(serial);
+                int width = camera.width > 0 ? camera.width : settings.depth.width;
+                int height = camera.height > 0 ? camera.height : settings.depth.height;
+                int colour_width = camera.colour_width > 0 ? camera.colour_width : settings.colour.width;
+                int colour_height = camera.colour_height > 0 ? camera.colour_height : settings.colour.height;
+                int fps = camera.frame_rate > 0 ? camera.frame_rate : settings.depth.frame_rate;
+                pending.push_back({serial, [=]() {
+                    return new SyntheticCamera(serial, width, height, colour_width, colour_height, fps);
+                }});
+            }
+        }
     }
 }
 
 const void MultiCamD400::RemoveDevice(const rs2::event_information &info) {
+    TraceScope trace("RemoveDevice");
     flip_guard<bool> pause(&loop_paused_, true);
     std::lock_guard<std::mutex> lock(lock_mutex_);
 
-    // Go over the list of devices and check if it was disconnected if so remove it
+    counter_offsets_.clear();
+
+    // Queued saves hold on to their camera
+    if (writer_)
+        writer_->Wait();
+
+    // Go over the list of devices and check if it was disconnected if so detach it until it comes back
     auto itr = cameras_.begin();
     while (itr != cameras_.end())
-        if (info.was_removed(itr->second->GetProfile().get_device())) {
-            itr->second->CloseGUI();
+        if (itr->second->WasRemoved(info)) {
+            itr->second->Detach();
+            detached_[itr->first] = std::move(itr->second);
             itr = cameras_.erase(itr);
         } else
             ++itr;
+
+    Metrics::SetGauge(Gauge::CAMERAS_CONNECTED, cameras_.size());
 }
 
 const void MultiCamD400::SaveFrames() {
+    TraceScope trace("SaveFrames");
     flip_guard<bool> pause(&loop_paused_, true);
     std::lock_guard<std::mutex> lock(lock_mutex_);
 
-    if(!CamerasAvailable())
+    if(!CamerasAvailable() || !AwaitQuality())
         return;
 
     std::vector<std::thread> threads;
+    Metrics::AddGauge(Gauge::SAVE_QUEUE_DEPTH, cameras_.size());
     for (auto &&cam : cameras_)
-        threads.emplace_back(std::bind([&cam]() { cam.second->WriteData(); }));
+        threads.emplace_back(std::bind([&cam]() {
+            Tracer::SetThreadName("writer " + cam.first);
+            // An exception escaping the thread would terminate the grabber, e.g. a camera unplugged mid save
+            try {
+                cam.second->WriteData();
+            } catch (const std::exception &e) {
+                std::cerr << "Camera " << cam.first << ": Save failed (" << e.what() << ")" << std::endl;
+            }
+            Metrics::AddGauge(Gauge::SAVE_QUEUE_DEPTH, -1);
+        }));
     std::for_each(threads.begin(), threads.end(), [](std::thread &t) { t.join(); });
 }
 
 const void MultiCamD400::SaveFrames(int index) {
+    TraceScope trace("SaveFrames");
     flip_guard<bool> pause(&loop_paused_, true);
     std::lock_guard<std::mutex> lock(lock_mutex_);
 
-    if(!CamerasAvailable())
+    if(!CamerasAvailable() || !AwaitQuality(index))
         return;
 
     int i = 0;
     for (auto &&cam : cameras_)
-        if (index == i++)
-            cam.second->WriteData();
+        if (index == i++) {
+            Metrics::AddGauge(Gauge::SAVE_QUEUE_DEPTH, 1);
+            try {
+                cam.second->WriteData();
+            } catch (const std::exception &e) {
+                std::cerr << "Camera " << cam.first << ": Save failed (" << e.what() << ")" << std::endl;
+            }
+            Metrics::AddGauge(Gauge::SAVE_QUEUE_DEPTH, -1);
+        }
 }
 
 const void MultiCamD400::SetLaser(bool laser, float power) {
+    TraceScope trace("SetLaser");
     flip_guard<bool> pause(&loop_paused_, true);
     std::lock_guard<std::mutex> lock(lock_mutex_);
 
@@ -131,6 +670,7 @@ const void MultiCamD400::SetLaser(bool laser, float power) {
 }
 
 const void MultiCamD400::SetLaser(int index, bool laser, float power) {
+    TraceScope trace("SetLaser");
     flip_guard<bool> pause(&loop_paused_, true);
     std::lock_guard<std::mutex> lock(lock_mutex_);
 
@@ -148,19 +688,29 @@ void MultiCamD400::Available() {
 }
 
 const void MultiCamD400::StabiliseExposure() {
+    TraceScope trace("StabiliseExposure");
     flip_guard<bool> pause(&loop_paused_, true);
     std::lock_guard<std::mutex> lock(lock_mutex_);
 
     if(!CamerasAvailable())
         return;
 
+    // Every camera waits for its own exposure to settle, together they take as long as the slowest
+    auto start = std::chrono::steady_clock::now();
     std::vector<std::thread> threads;
     for (auto &&cam : cameras_)
-        threads.emplace_back(std::bind([&cam]() { cam.second->StabiliseExposure(); }));
+        threads.emplace_back(std::bind([&cam]() {
+            Tracer::SetThreadName("stabilise " + cam.first);
+            cam.second->StabiliseExposure();
+        }));
     std::for_each(threads.begin(), threads.end(), [](std::thread &t) { t.join(); });
+    std::cout << std::fixed << std::setprecision(2) << "Stabilised exposure on " << cameras_.size() << " cameras in "
+              << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() << "s"
+              << std::defaultfloat << std::endl;
 }
 
 const void MultiCamD400::StabiliseExposure(int index) {
+    TraceScope trace("StabiliseExposure");
     flip_guard<bool> pause(&loop_paused_, true);
     std::lock_guard<std::mutex> lock(lock_mutex_);
 
@@ -174,6 +724,7 @@ const void MultiCamD400::StabiliseExposure(int index) {
 }
 
 const void MultiCamD400::UpdateDataConfiguration() {
+    TraceScope trace("UpdateDataConfiguration");
     flip_guard<bool> pause(&loop_paused_, true);
     std::lock_guard<std::mutex> lock(lock_mutex_);
 
@@ -200,6 +751,59 @@ const bool MultiCamD400::CamerasAvailable() {
     return true;
 }
 
+const void MultiCamD400::PrintFrameStatistics() {
+    std::lock_guard<std::mutex> lock(lock_mutex_);
+
+    if(!CamerasAvailable())
+        return;
+
+    for (auto &&cam : cameras_)
+        cam.second->PrintFrameStatistics();
+}
+
+const void MultiCamD400::StartRecording() {
+    TraceScope trace("StartRecording");
+    flip_guard<bool> pause(&loop_paused_, true);
+    std::lock_guard<std::mutex> lock(lock_mutex_);
+
+    if(!CamerasAvailable())
+        return;
+
+    // Restarting a pipeline takes a while, do every camera at once so the recordings start together
+    std::vector<std::thread> threads;
+    for (auto &&cam : cameras_)
+        threads.emplace_back(std::bind([&cam]() {
+            Tracer::SetThreadName("recorder " + cam.first);
+            cam.second->StartRecording();
+        }));
+    std::for_each(threads.begin(), threads.end(), [](std::thread &t) { t.join(); });
+
+    recording_ = std::any_of(cameras_.begin(), cameras_.end(), [](const CameraMap::value_type &cam) {
+        return cam.second->Recording();
+    });
+}
+
+const void MultiCamD400::StopRecording() {
+    TraceScope trace("StopRecording");
+    flip_guard<bool> pause(&loop_paused_, true);
+    std::lock_guard<std::mutex> lock(lock_mutex_);
+
+    std::vector<std::thread> threads;
+    for (auto &&cam : cameras_)
+        if (cam.second->Recording())
+            threads.emplace_back(std::bind([&cam]() {
+                Tracer::SetThreadName("recorder " + cam.first);
+                cam.second->StopRecording();
+            }));
+    std::for_each(threads.begin(), threads.end(), [](std::thread &t) { t.join(); });
+
+    recording_ = false;
+}
+
+const bool MultiCamD400::Recording() {
+    return recording_;
+}
+
 const void MultiCamD400::Pause(bool pause) {
     loop_paused_ = pause;
 }
\ No newline at end of file
@@ -0,0 +1,42 @@
+#include "QualityGate.hpp"
+
+QualityGate::QualityGate(Policy policy, int wait_ms) : policy_(policy), wait_ms_(wait_ms) {}
+
+QualityGate::Decision QualityGate::Evaluate(bool triggered, bool passed, std::chrono::steady_clock::time_point now) {
+    // A wait belongs to one trigger, the next one starts its own
+    if (!triggered) {
+        waiting_ = false;
+        return Decision::NONE;
+    }
+
+    if (policy_ == Policy::RECORD || passed) {
+        waiting_ = false;
+        return Decision::SAVE;
+    }
+
+    if (!waiting_) {
+        waiting_ = true;
+        wait_start_ = now;
+    }
+    if (now - wait_start_ < std::chrono::milliseconds(wait_ms_))
+        return Decision::HOLD;
+
+    waiting_ = false;
+    return policy_ == Policy::SKIP ? Decision::SKIP : Decision::SAVE;
+}
+
+void QualityGate::Reset() {
+    waiting_ = false;
+}
+
+QualityGate::Policy QualityGate::GetPolicy() const {
+    return policy_;
+}
+
+int QualityGate::GetWaitMs() const {
+    return wait_ms_;
+}
+
+bool QualityGate::Waiting() const {
+    return waiting_;
+}
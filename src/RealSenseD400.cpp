@@ -1,95 +1,474 @@
+#include <cmath>
+#include <iomanip>
+#include <set>
+#include <sstream>
+
 #include <ConfigManager.hpp>
 #include "RealSenseD400.hpp"
+#include "Tracer.hpp"
+#include "ImageKernels.hpp"
 
-RealSenseD400::RealSenseD400(rs2::device dev) : dev_(dev), depth_sensor_(dev.first<rs2::depth_sensor>()),
-                                                depth_(nullptr), colour_(nullptr),
-                                                lir_(nullptr),
-                                                rir_(nullptr), c_depth_(nullptr),
-                                                data_structure_(dev),
-                                                advanced_dev_(dev){
+RealSenseD400::RealSenseD400(rs2::device dev) :
+        RealSenseD400(dev, CaptureSettings::Current()->Camera(dev.get_info(RS2_CAMERA_INFO_SERIAL_NUMBER))) {}
+
+RealSenseD400::RealSenseD400(rs2::device dev, const CameraSettings &settings) :
+        RealSenseD400(dev, dev.get_info(RS2_CAMERA_INFO_SERIAL_NUMBER), settings) {
     // Check device is in advanced mode before trying to enable all streams
     // Will cause a could not enable all streams error
-    if(!DeviceInAdvancedMode()) {
+    rs400::advanced_mode advanced_dev(dev);
+    if(!DeviceInAdvancedMode(advanced_dev)) {
         std::cout << "Device " << serial_number_ << ": Not in advanced mode, enabling advanced mode" << std::endl;
-        //advanced_dev_ = dev.as<rs400::advanced_mode>();
-        advanced_dev_.toggle_advanced_mode(true);
+        advanced_dev.toggle_advanced_mode(true);
 
-        //TODO: Change workflow so that it will reconnect in order to the camera with the same serial
-        throw rs2::error("Device advanced mode enabled, device will disconnect and reconnect");
+        // The device resets and enumerates again, carry on with the new handle
+        dev_ = WaitForReconnect();
+        depth_sensor_ = dev_.first<rs2::depth_sensor>();
     }
-    
+    StartupStage("advanced-mode");
+
+    // Before the sensor options, those take precedence over the preset's controls
+    LoadPreset();
+    StartupStage("preset");
+
     // Print the device information
     PrintDeviceInfo();
+    StartupStage("info");
 
-    // Get resolution etc from config file
-    ConfigManager *config = ConfigManager::GetInstance();
-    nlohmann::json depth_config = config->Get("stream-depth");
-    nlohmann::json colour_config = config->Get("stream-colour");
+    EnableStreams(cfg);
+    SetFramePeriods(settings_.depth.frame_rate, settings_.colour.frame_rate);
 
-    int d_width = depth_config["width"], c_width = colour_config["width"];
-    int d_height = depth_config["height"], c_height = colour_config["height"];
-    int d_fps = depth_config["frame-rate"], c_fps = colour_config["frame-rate"];
+    // Set sensor options
+    SetSensorOptions();
+    StartupStage("options");
+
+    // Define pipeline with parameters above
+    selection = pipe_.start(cfg);
+    pipeline_started_ = true;
+    StartupStage("pipeline");
+
+    Open();
+}
+
+void RealSenseD400::EnableStreams(rs2::config &config) {
+    // Resolution and frame rate from the camera's settings
+    const StreamSettings &depth = settings_.depth, &colour = settings_.colour;
+    int d_width = depth.width, c_width = colour.width;
+    int d_height = depth.height, c_height = colour.height;
+    int d_fps = depth.frame_rate, c_fps = colour.frame_rate;
 
     // Enable IR, depth and colour_ streams at the highest quality streams
-    cfg.enable_stream(RS2_STREAM_INFRARED, 1, d_width, d_height, RS2_FORMAT_Y8, d_fps); // Left IR (Colour registered)
-    cfg.enable_stream(RS2_STREAM_INFRARED, 2, d_width, d_height, RS2_FORMAT_Y8, d_fps); // Right IR
-    cfg.enable_stream(RS2_STREAM_DEPTH, d_width, d_height, RS2_FORMAT_Z16, d_fps);
+    config.enable_stream(RS2_STREAM_INFRARED, 1, d_width, d_height, RS2_FORMAT_Y8, d_fps); // Left IR (Colour registered)
+    config.enable_stream(RS2_STREAM_INFRARED, 2, d_width, d_height, RS2_FORMAT_Y8, d_fps); // Right IR
+    config.enable_stream(RS2_STREAM_DEPTH, d_width, d_height, RS2_FORMAT_Z16, d_fps);
 
     // Read in BGR so OpenCV automatically displays/saves it as RGB
-    cfg.enable_stream(RS2_STREAM_COLOR, c_width, c_height, RS2_FORMAT_BGR8, c_fps);
-    serial_number_ = std::string(dev.get_info(RS2_CAMERA_INFO_SERIAL_NUMBER));
-    cfg.enable_device(serial_number_);
+    config.enable_stream(RS2_STREAM_COLOR, c_width, c_height, RS2_FORMAT_BGR8, c_fps);
+    config.enable_device(serial_number_);
+}
 
-    // Set sensor options
-    SetSensorOptions();
+RealSenseD400::RealSenseD400(rs2::device dev, const std::string &serial_number) :
+        RealSenseD400(dev, serial_number, CaptureSettings::Current()->Camera(serial_number)) {}
 
-    // Define pipeline with parameters above
-    selection = pipe_.start(cfg);
+RealSenseD400::RealSenseD400(rs2::device dev, const std::string &serial_number, const CameraSettings &settings) :
+                                                dev_(dev),
+                                                depth_sensor_(dev.first<rs2::depth_sensor>()),
+                                                serial_number_(serial_number), settings_(settings),
+                                                depth_(nullptr), colour_(nullptr),
+                                                lir_(nullptr),
+                                                rir_(nullptr), c_depth_(nullptr),
+                                                data_structure_(serial_number) {
+    metrics_ = Metrics::GetInstance()->Camera(serial_number_);
+}
 
+void RealSenseD400::Open() {
     // Get depth scale (device specific)
     depth_sensor_scale_ = depth_sensor_.get_depth_scale();
 
-    gui_enabled_ = config->Get("gui-enabled");
+    gui_enabled_ = settings_.gui_enabled;
+
+    const QualitySettings &quality = settings_.quality;
+    quality_enabled_ = quality.enabled;
+    quality_on_colour_ = quality.on_colour;
+    quality_decimation_ = quality.decimation;
+    min_sharpness_ = quality.min_sharpness;
+    max_clipped_ = quality.max_clipped;
+    min_depth_valid_ = quality.min_depth_valid;
+
+    paired_max_gap_ = settings_.paired.max_frame_gap;
+
+    const FusionSettings &fusion = settings_.fusion;
+    depth_fusion_ = fusion.enabled;
+    fusion_frames_ = fusion.frames;
+    fusion_median_ = fusion.median;
+    fusion_tolerance_ = static_cast<float>(fusion.tolerance);
+    fusion_min_valid_ = fusion.min_valid;
+
+    const BracketSettings &bracket = settings_.bracket;
+    bracket_exposures_.assign(bracket.exposures.begin(), bracket.exposures.end());
+    bracket_tolerance_ = bracket.tolerance;
+    bracket_metadata_scale_ = bracket.metadata_scale;
+    bracket_max_frames_ = bracket.max_frames;
+    merge_bracket_ = bracket.merge;
+    if (bracket.enabled)
+        SetExposureBracket(true);
+
+    const DuplicateSettings &duplicates = settings_.duplicates;
+    duplicate_enabled_ = duplicates.enabled;
+    duplicate_skip_ = duplicates.skip;
+    duplicate_history_ = static_cast<size_t>(duplicates.history);
+    duplicate_max_distance_ = duplicates.max_distance;
 
     // Throwaway some frames to stabilise the exposure
-    if (config->Get("stabilise-exposure"))
-        StabiliseExposure(config->Get("stabilise-exposure-count"));
+    if (settings_.stabilise_exposure) {
+        StabiliseExposure(settings_.stabilise_exposure_count);
+        StartupStage("exposure");
+    }
 
     // Update save path
     ConfigureDataset();
+    StartupStage("dataset");
 
     Setup();
+    ReportStartup("Started");
+}
+
+void RealSenseD400::StartupStage(const std::string &stage) {
+    auto now = std::chrono::steady_clock::now();
+    startup_stages_.emplace_back(stage, std::chrono::duration<double>(now - stage_start_).count());
+    stage_start_ = now;
+}
+
+double RealSenseD400::ReportStartup(const std::string &action) {
+    // Cameras start concurrently, one line each keeps the report readable
+    std::ostringstream report;
+    double total = 0;
+    for (auto &stage : startup_stages_)
+        total += stage.second;
+    report << std::fixed << std::setprecision(2) << "Camera " << serial_number_ << ": " << action << " in " << total
+           << "s (";
+    for (size_t i = 0; i < startup_stages_.size(); ++i)
+        report << (i > 0 ? ", " : "") << startup_stages_[i].first << " " << startup_stages_[i].second << "s";
+    std::cout << report.str() << ")" << std::endl;
+    return total;
+}
+
+void RealSenseD400::Detach() {
+    TraceScope trace("Detach", serial_number_);
+
+    // The bag is finalised by stopping the pipeline, recording is not resumed on reattach
+    if (recording_)
+        std::cerr << "Camera " << serial_number_ << ": Unplugged while recording to " << recording_path_ << std::endl;
+    recording_ = false;
+
+    if (pipeline_started_) {
+        try {
+            pipe_.stop();
+        } catch (const rs2::error &) {
+            // Already stopped by the device going away
+        }
+        pipeline_started_ = false;
+    }
+
+    // Frames hold on to the device's frame pool, release every one (and the images viewing them) while detached
+    frames_ = rs2::frameset();
+    depth_ = colour_ = lir_ = rir_ = c_depth_ = rs2::video_frame(nullptr);
+    point_cloud_ = rs2::points();
+    for (cv::Mat *mat : {&colour_mat_, &depth_mat_, &c_depth_mat_, &lir_mat_, &rir_mat_})
+        mat->release();
+    CloseGUI();
+
+    detached_at_ = std::chrono::steady_clock::now();
+    std::cout << "Camera " << serial_number_ << ": Detached, waiting for it to be plugged in again" << std::endl;
+}
+
+bool RealSenseD400::Reattach(rs2::device dev) {
+    TraceScope trace("Reattach", serial_number_);
+    double unplugged = std::chrono::duration<double>(std::chrono::steady_clock::now() - detached_at_).count();
+    startup_stages_.clear();
+    stage_start_ = std::chrono::steady_clock::now();
+
+    // Everything configured at start up (cfg, settings, dataset folders) is kept, only the device side is redone
+    try {
+        dev_ = dev;
+        depth_sensor_ = dev_.first<rs2::depth_sensor>();
+        rs400::advanced_mode advanced_dev(dev_);
+        if (!DeviceInAdvancedMode(advanced_dev)) {
+            advanced_dev.toggle_advanced_mode(true);
+            dev_ = WaitForReconnect();
+            depth_sensor_ = dev_.first<rs2::depth_sensor>();
+        }
+        StartupStage("advanced-mode");
+
+        // Both are skipped when the device kept them, which it does over a cable glitch
+        LoadPreset();
+        SetSensorOptions();
+        StartupStage("options");
+
+        selection = pipe_.start(cfg);
+        pipeline_started_ = true;
+        StartupStage("pipeline");
+
+        // Reattached means frames are flowing again
+        NextFrameset();
+        StartupStage("first-frame");
+    } catch (const rs2::error &e) {
+        std::cerr << "Camera " << serial_number_ << ": Could not reattach (" << e.what() << ")" << std::endl;
+        return false;
+    }
+
+    double seconds = ReportStartup("Reattached after " + std::to_string(static_cast<int>(unplugged)) + "s unplugged");
+    metrics_->Add(Counter::REATTACHES);
+    metrics_->Record(Stage::REATTACH, static_cast<uint64_t>(seconds * 1e9));
+    return true;
 }
 
 RealSenseD400::~RealSenseD400() {
     CloseGUI();
-    pipe_.stop();
+    if (pipeline_started_) {
+        try {
+            pipe_.stop();
+        } catch (const rs2::error &e) {
+            std::cerr << "Camera " << serial_number_ << ": Could not stop the pipeline (" << e.what() << ")"
+                      << std::endl;
+        }
+    }
+}
+
+void RealSenseD400::SetFramePeriods(int depth_fps, int colour_fps) {
+    frame_period_ = 1000.0 / depth_fps;
+    frame_monitor_.Reset(frame_period_, 1000.0 / colour_fps);
+}
+
+rs2::frameset RealSenseD400::NextFrameset() {
+    return pipe_.wait_for_frames();
+}
+
+bool RealSenseD400::WasRemoved(const rs2::event_information &info) {
+    // While recording the pipeline device is the recorder wrapping dev_
+    return info.was_removed(dev_);
+}
+
+bool RealSenseD400::StartRecording() {
+    if (recording_)
+        return true;
+
+    // Each recording gets its own session folder next to the stills
+    data_structure_.UpdateFolderPaths();
+    recording_path_ = data_structure_.FilePath(RsType::RECORDING);
+
+    // A config can not drop a recorder once set, so recordings use their own config and cfg stays record free
+    rs2::config record_cfg;
+    EnableStreams(record_cfg);
+    record_cfg.enable_record_to_file(recording_path_);
+
+    try {
+        if (pipeline_started_)
+            pipe_.stop();
+        pipeline_started_ = false;
+        selection = pipe_.start(record_cfg);
+        pipeline_started_ = true;
+    } catch (const rs2::error &e) {
+        std::cerr << "Camera " << serial_number_ << ": Could not start recording (" << e.what() << ")" << std::endl;
+        ResumeStreams();
+        return false;
+    }
+
+    recording_ = true;
+    recording_start_ = std::chrono::steady_clock::now();
+    std::cout << "Camera " << serial_number_ << ": Recording to " << recording_path_ << std::endl;
+    return true;
+}
+
+void RealSenseD400::StopRecording() {
+    if (!recording_)
+        return;
+
+    // Stopping the pipeline closes the recorder and finalises the bag
+    recording_ = false;
+    try {
+        pipe_.stop();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - recording_start_).count();
+        std::cout << "Camera " << serial_number_ << ": Recorded " << std::fixed << std::setprecision(1) << seconds
+                  << "s to " << recording_path_ << std::defaultfloat << std::endl;
+    } catch (const rs2::error &e) {
+        std::cerr << "Camera " << serial_number_ << ": Could not finalise " << recording_path_ << " (" << e.what()
+                  << ")" << std::endl;
+    }
+    pipeline_started_ = false;
+
+    ResumeStreams();
+}
+
+bool RealSenseD400::ResumeStreams() {
+    try {
+        selection = pipe_.start(cfg);
+        pipeline_started_ = true;
+        return true;
+    } catch (const rs2::error &e) {
+        pipeline_started_ = false;
+        std::cerr << "Camera " << serial_number_ << ": Stopped, could not restart the streams (" << e.what() << ")"
+                  << std::endl;
+        return false;
+    }
+}
+
+bool RealSenseD400::Recording() {
+    return recording_;
 }
 
 void RealSenseD400::ConfigureDataset(std::string data_name, std::string data_root) {
-    // If no parameters passed use the global defaults
+    // If no parameters passed use the current settings, the paths may have been changed since the camera was opened
+    settings_.paths = CaptureSettings::Current()->Camera(serial_number_).paths;
     if(data_root.empty())
-        data_root = ConfigManager::IGet("save-path-prefix");
+        data_root = settings_.paths.save_path_prefix;
     if(data_name.empty())
-        data_name = ConfigManager::IGet("project-name");
+        data_name = settings_.paths.project_name;
 
     //Update folder structure and create necessary folders
     data_structure_.UpdatePathPrefix(data_root, data_name);
-    data_structure_.SetFileConstructionNames();
+    data_structure_.SetFileConstructionNames(settings_.file_names);
     data_structure_.UpdateFolderPaths(true);
     WriteDeviceData(data_structure_.folder_.string() + serial_number_ + "_meta.csv");
 }
 
+void RealSenseD400::ApplySettings(const CameraSettings &settings) {
+    TraceScope trace("ApplySettings", serial_number_);
+    bool streams = settings.depth != settings_.depth || settings.colour != settings_.colour;
+    bool preset = settings.preset != settings_.preset;
+    bool options = settings.options != settings_.options || preset;
+    bool dataset = settings.file_names != settings_.file_names || settings.paths != settings_.paths;
+    CameraSettings previous = settings_;
+    settings_ = settings;
+
+    // A camera that can not restart keeps its streams, the next reload compares against what is running
+    if (streams && !RestartStreams()) {
+        settings_.depth = previous.depth;
+        settings_.colour = previous.colour;
+    }
+
+    if (options) {
+        try {
+            if (preset)
+                LoadPreset();
+            SetSensorOptions();
+        } catch (const rs2::error &e) {
+            std::cerr << "Camera " << serial_number_ << ": Could not apply sensor options (" << e.what() << ")"
+                      << std::endl;
+        }
+    }
+
+    if (dataset)
+        ConfigureDataset();
+}
+
+bool RealSenseD400::RestartStreams() {
+    if (recording_) {
+        std::cerr << "Camera " << serial_number_ << ": Stop recording before changing stream settings" << std::endl;
+        return false;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    rs2::config restart_cfg;
+    EnableStreams(restart_cfg);
+    try {
+        if (pipeline_started_)
+            pipe_.stop();
+        pipeline_started_ = false;
+        selection = pipe_.start(restart_cfg);
+    } catch (const rs2::error &e) {
+        // Back to the streams that worked
+        std::cerr << "Camera " << serial_number_ << ": Could not start the new streams (" << e.what() << ")"
+                  << std::endl;
+        ResumeStreams();
+        return false;
+    }
+    cfg = restart_cfg;
+    pipeline_started_ = true;
+    SetFramePeriods(settings_.depth.frame_rate, settings_.colour.frame_rate);
+
+    if (settings_.stabilise_exposure)
+        StabiliseExposure(settings_.stabilise_exposure_count);
+
+    std::cout << "Camera " << serial_number_ << ": Restarted streams at " << settings_.depth.width << "x"
+              << settings_.depth.height << "@" << settings_.depth.frame_rate << " depth, " << settings_.colour.width
+              << "x" << settings_.colour.height << "@" << settings_.colour.frame_rate << " colour in "
+              << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() << "s" << std::endl;
+    return true;
+}
+
 void RealSenseD400::StabiliseExposure(int stabilization_window) {
-    // Allow auto exposure to stabilize
-    std::cout << "Camera " << serial_number_ << ": Dropping " << stabilization_window << " frames" << std::endl;
-    for (int i = 0; i < stabilization_window; i++)
-        rs2::frameset exposure_frames = pipe_.wait_for_frames();
+    // Allow auto exposure to stabilize, frames are dropped until the exposure, gain and white balance they report stop
+    // changing. Without that metadata a fixed number of frames is dropped instead
+    TraceScope trace("StabiliseExposure", serial_number_);
+    ScopedTimer timer(metrics_, Stage::STABILISE_EXPOSURE);
+    const ConvergenceSettings &convergence = settings_.convergence;
+    auto start = std::chrono::steady_clock::now();
+    auto deadline = start + std::chrono::milliseconds(convergence.timeout_ms);
+
+    std::vector<double> previous, current;
+    int frames = 0, stable = 0;
+    bool metadata = false, settled = false;
+    while (!settled && std::chrono::steady_clock::now() < deadline) {
+        rs2::frameset exposure_frames = NextFrameset();
+        ++frames;
+
+        current.clear();
+        metadata = ExposureState(exposure_frames, current);
+        if (!metadata) {
+            settled = frames >= stabilization_window;
+            continue;
+        }
+
+        stable = ExposureSettled(previous, current, convergence.tolerance) ? stable + 1 : 0;
+        previous.swap(current);
+        settled = stable >= convergence.stable_frames;
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::ostringstream report;
+    report << std::fixed << std::setprecision(2) << "Camera " << serial_number_ << ": ";
+    if (!metadata)
+        report << "No exposure metadata, dropped " << frames << " frames in " << seconds << "s";
+    else if (settled)
+        report << "Exposure settled after " << frames << " frames in " << seconds << "s";
+    else
+        report << "Exposure still changing after " << frames << " frames, gave up after " << seconds << "s";
+    std::cout << report.str() << std::endl;
+}
+
+bool RealSenseD400::ExposureState(const rs2::frameset &frames, std::vector<double> &state) {
+    // IR exposure and gain are reported on the depth frame
+    const rs2_frame_metadata_value ir[] = {RS2_FRAME_METADATA_ACTUAL_EXPOSURE, RS2_FRAME_METADATA_GAIN_LEVEL};
+    const rs2_frame_metadata_value colour[] = {RS2_FRAME_METADATA_ACTUAL_EXPOSURE, RS2_FRAME_METADATA_GAIN_LEVEL,
+                                               RS2_FRAME_METADATA_WHITE_BALANCE};
+
+    rs2::frame depth = frames.get_depth_frame(), colour_frame = frames.get_color_frame();
+    if (depth)
+        for (auto value : ir)
+            if (depth.supports_frame_metadata(value))
+                state.push_back(static_cast<double>(depth.get_frame_metadata(value)));
+    if (colour_frame)
+        for (auto value : colour)
+            if (colour_frame.supports_frame_metadata(value))
+                state.push_back(static_cast<double>(colour_frame.get_frame_metadata(value)));
+    return !state.empty();
+}
+
+bool RealSenseD400::ExposureSettled(const std::vector<double> &previous, const std::vector<double> &current,
+                                    double tolerance) {
+    if (previous.size() != current.size())
+        return false;
+    for (size_t i = 0; i < current.size(); ++i)
+        if (std::fabs(current[i] - previous[i]) > tolerance * std::max(std::fabs(previous[i]), 1.0))
+            return false;
+    return true;
 }
 
 void RealSenseD400::PrintDeviceInfo() {
-    // Check available device information and print it to console
-    std::cout << "Device Information: " << std::endl;
+    // Check available device information and print it to console, in one write so cameras starting together
+    // do not interleave their lines
+    std::ostringstream info;
+    info << "Device Information: " << '\n';
     for (int i = 0; i < RS2_CAMERA_INFO_COUNT; ++i) {
         std::string output = std::string(rs2_camera_info_to_string((rs2_camera_info) i)) + ": ";
 
@@ -99,50 +478,219 @@ void RealSenseD400::PrintDeviceInfo() {
             output += "Not available";
         }
 
-        std::cout << "\t" << output << std::endl;
+        info << "\t" << output << '\n';
     }
+    std::cout << info.str() << std::flush;
 }
 
-bool RealSenseD400::DeviceInAdvancedMode() {
+rs2::device RealSenseD400::WaitForReconnect() {
+    // First wait for the old handle to go, it can still report the new mode until the device has reset
+    auto start = std::chrono::steady_clock::now();
+    bool disconnected = false;
+    rs2::context ctx;
+    while (std::chrono::steady_clock::now() - start < std::chrono::seconds(kReconnectTimeout)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+        rs2::device found;
+        for (auto &&candidate : ctx.query_devices()) {
+            try {
+                if (serial_number_ == candidate.get_info(RS2_CAMERA_INFO_SERIAL_NUMBER))
+                    found = candidate;
+            } catch (const rs2::error &) {
+                // Still enumerating
+            }
+        }
+
+        if (!found) {
+            disconnected = true;
+            continue;
+        }
+
+        try {
+            if (disconnected && rs400::advanced_mode(found).is_enabled()) {
+                std::cout << "Device " << serial_number_ << ": Reconnected in advanced mode after "
+                          << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() << "s"
+                          << std::endl;
+                return found;
+            }
+        } catch (const rs2::error &) {
+            // Not ready for control transfers yet
+        }
+    }
+
+    throw rs2::error("Device " + serial_number_ + " did not reconnect in advanced mode within " +
+                     std::to_string(kReconnectTimeout) + "s, replug it");
+}
+
+void RealSenseD400::LoadPreset() {
+    const PresetSettings &preset = settings_.preset;
+    if (preset.path.empty())
+        return;
+
+    // Relative paths are relative to config.json, not to the directory the grabber was started from
+    boost::filesystem::path config_dir = boost::filesystem::path(ConfigManager::GetInstance()->GetPath()).parent_path();
+    std::string path = boost::filesystem::absolute(preset.path, config_dir).string();
+    std::string cache_path = preset.cache.empty() ? "" : boost::filesystem::absolute(preset.cache, config_dir).string();
+
+    std::ifstream in(path);
+    if (!in.is_open()) {
+        std::cerr << "Camera " << serial_number_ << ": Could not open preset " << path << std::endl;
+        return;
+    }
+    std::string json((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+    // Loading writes every advanced mode parameter over USB (seconds per camera). The cache holds the hash of the
+    // preset and of the device state it produced, reading the state back is much cheaper and also catches a device
+    // changed by another tool since
+    static std::mutex cache_lock;
+    rs400::advanced_mode advanced_dev(dev_);
+    std::string preset_hash = Fnv1a(json), device_hash = Fnv1a(advanced_dev.serialize_json());
+    if (!preset.cache.empty()) {
+        std::lock_guard<std::mutex> lock(cache_lock);
+        nlohmann::json cache = ReadPresetCache(cache_path);
+        auto entry = cache.find(serial_number_);
+        if (entry != cache.end() && entry->is_object() && entry->value("preset-hash", "") == preset_hash &&
+            entry->value("device-hash", "") == device_hash) {
+            std::cout << "Camera " << serial_number_ << ": Preset " << preset.path << " already loaded" << std::endl;
+            return;
+        }
+    }
+
+    try {
+        advanced_dev.load_json(json);
+    } catch (const rs2::error &e) {
+        std::cerr << "Camera " << serial_number_ << ": Could not load preset " << preset.path << " (" << e.what()
+                  << ")" << std::endl;
+        return;
+    }
+    std::cout << "Camera " << serial_number_ << ": Loaded preset " << preset.path << std::endl;
+
+    if (preset.cache.empty())
+        return;
+    std::lock_guard<std::mutex> lock(cache_lock);
+    nlohmann::json cache = ReadPresetCache(cache_path);
+    cache[serial_number_] = {{"preset", preset.path}, {"preset-hash", preset_hash},
+                             {"device-hash", Fnv1a(advanced_dev.serialize_json())}};
+    std::ofstream out(cache_path);
+    out << cache.dump(4) << std::endl;
+}
+
+nlohmann::json RealSenseD400::ReadPresetCache(const std::string &file_name) {
+    // A missing or damaged cache only means the preset is loaded again
+    nlohmann::json cache = nlohmann::json::object();
+    std::ifstream in(file_name);
+    if (!in.is_open())
+        return cache;
+    try {
+        in >> cache;
+    } catch (const std::exception &) {
+        return nlohmann::json::object();
+    }
+    return cache.is_object() ? cache : nlohmann::json::object();
+}
+
+std::string RealSenseD400::Fnv1a(const std::string &data) {
+    uint64_t hash = 14695981039346656037ull;
+    for (unsigned char c : data)
+        hash = (hash ^ c) * 1099511628211ull;
+    std::ostringstream hex;
+    hex << std::hex << std::setw(16) << std::setfill('0') << hash;
+    return hex.str();
+}
+
+bool RealSenseD400::DeviceInAdvancedMode(rs400::advanced_mode &advanced_dev) {
     //    if(dev_.supports(RS2_CAMERA_INFO_ADVANCED_MODE)) {
     //        return dev_.get_info(RS2_CAMERA_INFO_ADVANCED_MODE) == "YES";
     //    }
     //
     //    return false;
-    return advanced_dev_.is_enabled();
+    return advanced_dev.is_enabled();
 }
 
 void RealSenseD400::SetSensorOptions() {
-    // Get resolution etc from config file
-    ConfigManager *config = ConfigManager::GetInstance();
-    nlohmann::json options = config->Get("options");
-    bool auto_exposure_opt =  options["auto-exposure"];
-    bool back_light_compensation_opt =  options["back-light-compensation"];
-    bool auto_white_balance_opt =  options["auto-white-balance"];
+    // Sensor options from the camera's settings
+    bool auto_exposure_opt = settings_.options.auto_exposure;
+    bool back_light_compensation_opt = settings_.options.back_light_compensation;
+    bool auto_white_balance_opt = settings_.options.auto_white_balance;
 
-    std::cout << "Setting Device Sensor Parameters:" << std::endl;
+    std::ostringstream log;
+    log << "Setting Device Sensor Parameters (" << serial_number_ << "):" << '\n';
 
     //Find any sensors that support the options above
     std::vector<rs2::sensor> sensors = dev_.query_sensors();
     for(auto &sensor : sensors) {
-        auto sensor_name = sensor.get_info(RS2_CAMERA_INFO_NAME);
-        if (sensor.supports(RS2_OPTION_BACKLIGHT_COMPENSATION)) {
-            std::cout << "\tSet back light compensation to " << back_light_compensation_opt << " for " << sensor_name <<
-                std::endl;
-            sensor.set_option(RS2_OPTION_BACKLIGHT_COMPENSATION, back_light_compensation_opt);
-        }
+        SetOption(sensor, RS2_OPTION_BACKLIGHT_COMPENSATION, back_light_compensation_opt, log);
+        SetOption(sensor, RS2_OPTION_ENABLE_AUTO_EXPOSURE, auto_exposure_opt, log);
+        SetOption(sensor, RS2_OPTION_ENABLE_AUTO_WHITE_BALANCE, auto_white_balance_opt, log);
+    }
 
-        if (sensor.supports(RS2_OPTION_ENABLE_AUTO_EXPOSURE)) {
-            std::cout << "\tSet enable auto exposure to " << auto_exposure_opt << " for " << sensor_name << std::endl;
-            sensor.set_option(RS2_OPTION_ENABLE_AUTO_EXPOSURE, auto_exposure_opt);
-        }
+    // A reattached or reset device comes back with the emitter on
+    if (paired_capture_)
+        SetOption(depth_sensor_, RS2_OPTION_EMITTER_ON_OFF, 1, log);
+    std::cout << log.str() << std::flush;
 
-        if (sensor.supports(RS2_OPTION_ENABLE_AUTO_WHITE_BALANCE)) {
-            std::cout << "\tSet enable auto white balance to " << auto_white_balance_opt << " for " << sensor_name <<
-                std::endl;
-            sensor.set_option(RS2_OPTION_ENABLE_AUTO_WHITE_BALANCE, auto_white_balance_opt);
-        }
+    SetSyncMode();
+}
+
+bool RealSenseD400::SetOption(const rs2::sensor &sensor, rs2_option option, float value, std::ostream &log) {
+    if (!sensor.supports(option))
+        return false;
+
+    // Every write is a control transfer (and some reset the sensor's auto exposure), the device keeps its options
+    // between sessions so most of them are already set
+    const char *sensor_name = sensor.get_info(RS2_CAMERA_INFO_NAME);
+    if (sensor.get_option(option) == value) {
+        log << "\t" << rs2_option_to_string(option) << " already " << value << " for " << sensor_name << '\n';
+        return false;
+    }
+
+    sensor.set_option(option, value);
+    log << "\tSet " << rs2_option_to_string(option) << " to " << value << " for " << sensor_name << '\n';
+    return true;
+}
+
+void RealSenseD400::SetSyncMode() {
+    bool sync_enabled = settings_.sync.enabled;
+    bool sync_supported = depth_sensor_.supports(RS2_OPTION_INTER_CAM_SYNC_MODE);
+
+    sync_mode_ = SyncMode::DEFAULT;
+    hardware_synced_ = false;
+
+    if (!sync_enabled) {
+        // Clear any role left on the device by a previous session
+        if (sync_supported && depth_sensor_.get_option(RS2_OPTION_INTER_CAM_SYNC_MODE) != 0)
+            depth_sensor_.set_option(RS2_OPTION_INTER_CAM_SYNC_MODE, static_cast<float>(SyncMode::DEFAULT));
+        return;
+    }
+
+    const std::string &master = settings_.sync.master;
+    if (master.empty()) {
+        std::cerr << "Camera " << serial_number_ << ": No inter-cam-sync master assigned, using software alignment"
+                  << std::endl;
+        return;
+    }
+
+    // Recorded (bag) devices and older firmware do not expose the option, frames are then aligned in software
+    if (!sync_supported) {
+        std::cerr << "Camera " << serial_number_ << ": Hardware sync not supported, using software alignment"
+                  << std::endl;
+        return;
+    }
+
+    SyncMode mode = master == serial_number_ ? SyncMode::MASTER : SyncMode::SLAVE;
+    try {
+        if (depth_sensor_.get_option(RS2_OPTION_INTER_CAM_SYNC_MODE) != static_cast<float>(mode))
+            depth_sensor_.set_option(RS2_OPTION_INTER_CAM_SYNC_MODE, static_cast<float>(mode));
+    } catch (const rs2::error &e) {
+        std::cerr << "Camera " << serial_number_ << ": Could not set sync mode (" << e.what()
+                  << "), using software alignment" << std::endl;
+        return;
     }
+
+    sync_mode_ = mode;
+    hardware_synced_ = true;
+    std::cout << "\tSet inter camera sync mode to " << (mode == SyncMode::MASTER ? "master" : "slave") << " for "
+              << serial_number_ << std::endl;
 }
 
 bool RealSenseD400::WindowsAreOpen() {
@@ -170,23 +718,319 @@ void RealSenseD400::Visualise() {
 }
 
 void RealSenseD400::WriteData() {
-    //Update folder structure and create necessary folders
-    data_structure_.UpdateFolderPaths();
+    std::shared_ptr<Capture> capture = TakeCapture();
+    WriteCapture(*capture);
+}
+
+std::shared_ptr<Capture> RealSenseD400::TakeCapture(const std::string &trigger) {
+    auto capture = std::make_shared<Capture>(data_structure_);
+    long long trigger_counter = frame_counter_;
+    capture->depth = depth_;
+    capture->colour = colour_;
+    capture->lir = lir_;
+    capture->rir = rir_;
+    capture->c_depth = c_depth_;
+    capture->point_cloud = point_cloud_;
+    capture->frame_counter = frame_counter_;
+    capture->frame_timestamp = frame_timestamp_;
+    capture->change_score = change_score_;
+    capture->quality = quality_;
+
+    // Everything but the IR comes from the emitter on frame, the colour stays with the depth it textures
+    if (paired_capture_) {
+        long long gap = std::abs(emitter_on_.frame_counter - emitter_off_.frame_counter);
+        if (emitter_on_.depth && emitter_off_.lir && gap <= paired_max_gap_) {
+            capture->depth = emitter_on_.depth;
+            capture->colour = emitter_on_.colour;
+            capture->c_depth = emitter_on_.c_depth;
+            capture->point_cloud = emitter_on_.point_cloud;
+            capture->lir = emitter_off_.lir;
+            capture->rir = emitter_off_.rir;
+            capture->frame_counter = emitter_on_.frame_counter;
+            capture->ir_frame_counter = emitter_off_.frame_counter;
+            capture->paired_frame_gap = gap;
+            capture->depth_emitter_mode = EmitterMode(emitter_on_.depth);
+            capture->ir_emitter_mode = EmitterMode(emitter_off_.lir);
+            capture->paired = true;
+        } else {
+            std::cerr << "Camera " << serial_number_ << ": No emitter on/off frames within " << paired_max_gap_
+                      << " frames, saving the current frames unpaired" << std::endl;
+        }
+    } else if (depth_fusion_) {
+        FuseDepth(*capture);
+    }
+
+    // The bracket moves the current frames on to off exposure frames, the next change score is measured against
+    // the frame saved here instead
+    std::vector<uint8_t> reference;
+    if (change_detection_)
+        reference = thumbnail_;
+    if (exposure_bracket_)
+        BracketExposure(*capture);
+
+    // Kept frames no longer count against the pipeline's frame pool, so queued saves can not stall acquisition
+    std::initializer_list<rs2::frame *> frames = {&capture->depth, &capture->colour, &capture->lir, &capture->rir,
+                                                  &capture->c_depth, &capture->point_cloud};
+    for (rs2::frame *frame : frames)
+        if (*frame)
+            frame->keep();
+
+    capture->timestamp_ms = std::chrono::duration<double, std::milli>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+    capture->sync_mode = sync_mode_;
+    capture->hardware_aligned = capture_hardware_aligned_;
+
+    // The group was given to the trigger frame set. Pairing and fusion save other frames, hardware synced counters
+    // advance together so the group moves with the frame counter of what is written. Timestamp aligned groups keep
+    // referring to the trigger frame set
+    capture->capture_group = capture_group_;
+    if (capture_group_ >= 0 && capture_hardware_aligned_) {
+        capture->capture_group += capture->frame_counter - trigger_counter;
+        for (long long &group : capture->bracket_groups)
+            group += capture_group_ - trigger_counter;
+    } else {
+        capture->bracket_groups.clear();
+    }
+    capture->frame_monitor = frame_monitor_;
+    capture->trigger = trigger;
+    if (duplicate_enabled_)
+        HashCapture(*capture);
+
+    // The next change score is measured against this capture
+    if (change_detection_)
+        reference_thumbnail_ = std::move(reference);
+    return capture;
+}
+
+void RealSenseD400::FuseDepth(Capture &capture) {
+    TraceScope trace("FuseDepth", serial_number_);
+    if (!depth_) {
+        std::cerr << "Camera " << serial_number_ << ": No depth frame to start fusing from, saving unfused" << std::endl;
+        return;
+    }
+
+    int frames = fusion_median_ ? std::min(fusion_frames_, ImageKernels::kMaxMedianFrames) : fusion_frames_;
+    size_t size = static_cast<size_t>(depth_.get_width()) * depth_.get_height();
+    if (!fusion_median_) {
+        fusion_sum_.assign(size, 0);
+        fusion_count_.assign(size, 0);
+    }
 
+    // The current frame is the first of the window, the rest are read here so the save takes frames - 1 frame
+    // periods. They still pass through WaitForFrames (frame loss, triggers) but are not shown, this may run on a
+    // writer thread
+    flip_guard<bool> hide(&gui_enabled_, false);
+    std::vector<rs2::frame> window;
+    rs2::frame middle = depth_;
+    capture.fused_first_counter = frame_counter_;
+    for (int i = 0; i < frames; ++i) {
+        if (i > 0) {
+            long long previous = frame_counter_;
+            WaitForFrames();
+            if (frame_counter_ == previous || static_cast<size_t>(depth_.get_width()) * depth_.get_height() != size)
+                break;
+        }
+
+        {
+            // Z16 frames are dense, the stride is always width * 2
+            ScopedTimer timer(metrics_, Stage::FUSE_DEPTH);
+            if (fusion_median_) {
+                window.push_back(depth_);
+                window.back().keep();
+            } else {
+                ImageKernels::AccumulateDepth(static_cast<const uint16_t *>(depth_.get_data()), size,
+                                              fusion_tolerance_, fusion_sum_.data(), fusion_count_.data());
+            }
+        }
+
+        // Colour and IR stay with the frame in the middle, the depth frame there lends its profile and metadata
+        if (i == frames / 2) {
+            middle = depth_;
+            capture.colour = colour_;
+            capture.lir = lir_;
+            capture.rir = rir_;
+            capture.frame_counter = frame_counter_;
+            capture.frame_timestamp = frame_timestamp_;
+        }
+        capture.fused_last_counter = frame_counter_;
+        capture.fused_frames = i + 1;
+    }
+
+    if (capture.fused_frames < frames)
+        std::cerr << "Camera " << serial_number_ << ": Fused " << capture.fused_frames << " of " << frames
+                  << " depth frames, the stream stalled or changed" << std::endl;
+
+    // The result is a depth frame librealsense allocated (so the colouriser, point cloud and metadata writer take it
+    // like any other), filled straight from the fusion buffers
+    std::vector<const uint16_t *> depth;
+    for (rs2::frame &frame : window)
+        depth.push_back(static_cast<const uint16_t *>(frame.get_data()));
+    rs2::frame_queue fused;
+    rs2::processing_block fuse([&](rs2::frame original, rs2::frame_source &source) {
+        rs2::frame result = source.allocate_video_frame(original.get_profile(), original, 0, 0, 0, 0,
+                                                        RS2_EXTENSION_DEPTH_FRAME);
+        auto *data = static_cast<uint16_t *>(const_cast<void *>(result.get_data()));
+
+        ScopedTimer timer(metrics_, Stage::FUSE_DEPTH);
+        if (fusion_median_)
+            ImageKernels::MedianDepth(depth.data(), static_cast<int>(depth.size()), size, fusion_min_valid_, data);
+        else
+            ImageKernels::ResolveDepthMean(fusion_sum_.data(), fusion_count_.data(), size, fusion_min_valid_, data);
+        source.frame_ready(result);
+    });
+    fuse.start(fused);
+    fuse.invoke(middle);
+
+    capture.depth = fused.wait_for_frame();
+    {
+        ScopedTimer timer(metrics_, Stage::COLOURISE);
+        capture.c_depth = color_map.process(capture.depth);
+    }
+    {
+        ScopedTimer timer(metrics_, Stage::POINT_CLOUD);
+        pc_.map_to(capture.depth);
+        capture.point_cloud = pc_.calculate(capture.depth);
+    }
+    capture.fusion = fusion_median_ ? "median" : "mean";
+}
+
+void RealSenseD400::BracketExposure(Capture &capture) {
+    TraceScope trace("BracketExposure", serial_number_);
+    ScopedTimer timer(metrics_, Stage::EXPOSURE_BRACKET);
+    if (bracket_exposures_.empty())
+        return;
+
+    // Saved and restored around the bracket, the sensor keeps its manual exposure otherwise
+    rs2::sensor sensor;
+    bool auto_exposure;
+    float exposure;
     try {
+        sensor = dev_.first<rs2::color_sensor>();
+        auto_exposure = sensor.supports(RS2_OPTION_ENABLE_AUTO_EXPOSURE) &&
+                        sensor.get_option(RS2_OPTION_ENABLE_AUTO_EXPOSURE) != 0;
+        exposure = sensor.get_option(RS2_OPTION_EXPOSURE);
+    } catch (const rs2::error &e) {
+        std::cerr << "Camera " << serial_number_ << ": No colour exposure to bracket (" << e.what() << ")"
+                  << std::endl;
+        return;
+    }
+
+    // Bracket frames pass through WaitForFrames (frame loss, triggers) but are not shown, this may run on a writer
+    // thread
+    flip_guard<bool> hide(&gui_enabled_, false);
+    size_t next = 0;
+    try {
+        if (auto_exposure)
+            sensor.set_option(RS2_OPTION_ENABLE_AUTO_EXPOSURE, 0);
+        sensor.set_option(RS2_OPTION_EXPOSURE, bracket_exposures_[0]);
+
+        // Option changes take effect a frame or more later depending on the firmware, the metadata shows when
+        while (next < bracket_exposures_.size() && capture.bracket_frames < bracket_max_frames_) {
+            long long previous = frame_counter_;
+            WaitForFrames();
+            if (frame_counter_ == previous)
+                break;
+            ++capture.bracket_frames;
+
+            if (!colour_.supports_frame_metadata(RS2_FRAME_METADATA_ACTUAL_EXPOSURE)) {
+                std::cerr << "Camera " << serial_number_ << ": Colour frames have no exposure metadata, can not "
+                          << "match them to the bracket" << std::endl;
+                break;
+            }
+
+            double actual = colour_.get_frame_metadata(RS2_FRAME_METADATA_ACTUAL_EXPOSURE) / bracket_metadata_scale_;
+            double target = bracket_exposures_[next];
+            if (std::abs(actual - target) > bracket_tolerance_ * target + 1)
+                continue;
+
+            capture.bracket.push_back(colour_);
+            capture.bracket.back().keep();
+            capture.bracket_exposures.push_back(actual);
+            capture.bracket_groups.push_back(frame_counter_);
+            if (++next < bracket_exposures_.size())
+                sensor.set_option(RS2_OPTION_EXPOSURE, bracket_exposures_[next]);
+        }
+    } catch (const rs2::error &e) {
+        std::cerr << "Camera " << serial_number_ << ": Exposure bracket failed (" << e.what() << ")" << std::endl;
+    }
+
+    try {
+        sensor.set_option(RS2_OPTION_EXPOSURE, exposure);
+        if (auto_exposure)
+            sensor.set_option(RS2_OPTION_ENABLE_AUTO_EXPOSURE, 1);
+    } catch (const rs2::error &e) {
+        std::cerr << "Camera " << serial_number_ << ": Could not restore the colour exposure (" << e.what() << ")"
+                  << std::endl;
+    }
+
+    if (next < bracket_exposures_.size())
+        std::cerr << "Camera " << serial_number_ << ": Exposure bracket has " << next << " of "
+                  << bracket_exposures_.size() << " exposures after " << capture.bracket_frames << " frames"
+                  << std::endl;
+    capture.merge_bracket = merge_bracket_;
+}
+
+void RealSenseD400::WriteCapture(Capture &capture) {
+    // Operators asked for manual saves, only triggered saves are dropped as duplicates
+    if (capture.duplicate && duplicate_skip_ && capture.trigger != "manual") {
+        metrics_->Add(Counter::DUPLICATE_SKIPS);
+        std::cout << "Camera " << serial_number_ << ": Skipped " << capture.trigger << " save, near duplicate ("
+                  << capture.duplicate_distance << " bits) of a recent save" << std::endl;
+        return;
+    }
+
+    ScopedTimer write_timer(metrics_, Stage::WRITE_DATA);
+    Strawberry::DataStructure &data_structure = capture.data_structure;
+
+    // Everything touching the disk stays in the try, the writer task has to finish to release its queue slot
+    try {
+        //Update folder structure and create necessary folders
+        {
+            ScopedTimer timer(metrics_, Stage::CREATE_DIRECTORIES);
+            data_structure.UpdateFolderPaths(false, capture.timestamp_ms);
+        }
+
+        if (!capture.depth || !capture.colour || !capture.lir || !capture.rir || !capture.c_depth)
+            throw std::runtime_error("Camera " + serial_number_ + ": No frames to write yet");
+
         // Save the files to disk
-        std::cout << "Camera " << serial_number_ << ": Writing " << data_structure_.sub_folder_.string() << std::endl;
-        cv::imwrite(data_structure_.FilePath(RsType::DEPTH), depth_mat_);
-        cv::imwrite(data_structure_.FilePath(RsType::COLOURED_DEPTH), c_depth_mat_);
-        cv::imwrite(data_structure_.FilePath(RsType::COLOUR), colour_mat_);
-        cv::imwrite(data_structure_.FilePath(RsType::IR_LEFT), lir_mat_);
-        cv::imwrite(data_structure_.FilePath(RsType::IR_RIGHT), rir_mat_);
-        point_cloud_.export_to_ply(data_structure_.FilePath(RsType::POINT_CLOUD), colour_);
+        std::cout << "Camera " << serial_number_ << ": Writing " << data_structure.sub_folder_.string() << std::endl;
+        WriteImage(data_structure, RsType::DEPTH, capture.depth, CV_16UC1, Stage::WRITE_DEPTH);
+        WriteImage(data_structure, RsType::COLOURED_DEPTH, capture.c_depth, CV_8UC3, Stage::WRITE_COLOURED_DEPTH);
+        WriteImage(data_structure, RsType::COLOUR, capture.colour, CV_8UC3, Stage::WRITE_COLOUR);
+        WriteImage(data_structure, RsType::IR_LEFT, capture.lir, CV_8UC1, Stage::WRITE_IR_LEFT);
+        WriteImage(data_structure, RsType::IR_RIGHT, capture.rir, CV_8UC1, Stage::WRITE_IR_RIGHT);
+        for (size_t i = 0; i < capture.bracket.size(); ++i)
+            WriteImage(data_structure, RsType::COLOUR, capture.bracket[i], CV_8UC3, Stage::WRITE_COLOUR,
+                       "_exposure_" + std::to_string(i));
+        if (capture.merge_bracket && capture.bracket.size() > 1) {
+            // Mertens exposure fusion weights every pixel by contrast, saturation and well exposedness, no exposure
+            // times or camera response needed
+            ScopedTimer timer(metrics_, Stage::MERGE_EXPOSURES);
+            std::vector<cv::Mat> exposures;
+            for (const rs2::video_frame &frame : capture.bracket)
+                exposures.emplace_back(cv::Size(frame.get_width(), frame.get_height()), CV_8UC3,
+                                       (void *) frame.get_data());
+            cv::Mat merged;
+            cv::createMergeMertens()->process(exposures, merged);
+            merged.convertTo(merged, CV_8UC3, 255);
+            cv::imwrite(data_structure.FilePath(RsType::COLOUR, false, "_merged"), merged);
+        }
+        {
+            ScopedTimer timer(metrics_, Stage::EXPORT_PLY);
+            capture.point_cloud.export_to_ply(data_structure.FilePath(RsType::POINT_CLOUD), capture.colour);
+        }
 
         // Write meta data
-        WriteVideoFrameMetaData(data_structure_.FilePath(RsType::DEPTH, true), depth_);
-        WriteVideoFrameMetaData(data_structure_.FilePath(RsType::COLOUR, true), colour_);
-        WriteVideoFrameMetaData(data_structure_.FilePath(RsType::IR, true), lir_);
+        ScopedTimer timer(metrics_, Stage::WRITE_METADATA);
+        WriteVideoFrameMetaData(data_structure.FilePath(RsType::DEPTH, true), capture.depth);
+        WriteVideoFrameMetaData(data_structure.FilePath(RsType::COLOUR, true), capture.colour);
+        WriteVideoFrameMetaData(data_structure.FilePath(RsType::IR, true), capture.lir);
+        for (size_t i = 0; i < capture.bracket.size(); ++i)
+            WriteVideoFrameMetaData(data_structure.FilePath(RsType::COLOUR, true, "_exposure_" + std::to_string(i)),
+                                    capture.bracket[i]);
+        WriteCaptureMetaData(data_structure.FilePath(RsType::CAPTURE, true), capture);
+        metrics_->Add(Counter::SAVES);
     }
     catch (const rs2::error &e) {
         std::cerr << "RealSense error calling " << e.get_failed_function() << "(" << e.get_failed_args() << "):\n    "
@@ -197,8 +1041,20 @@ void RealSenseD400::WriteData() {
     }
 }
 
+void RealSenseD400::WriteImage(Strawberry::DataStructure &data_structure, RsType type, const rs2::video_frame &frame,
+                               int cv_type, Stage stage, const std::string &suffix) {
+    ScopedTimer timer(metrics_, stage);
+    std::string file_name = data_structure.FilePath(type, false, suffix);
+    cv::Mat image(cv::Size(frame.get_width(), frame.get_height()), cv_type, (void *) frame.get_data());
+    cv::imwrite(file_name, image);
+
+    // Only stat the file when someone is looking at the numbers
+    if (Metrics::Enabled())
+        metrics_->AddBytes(stage, boost::filesystem::file_size(file_name));
+}
+
 
-void RealSenseD400::WriteVideoFrameMetaData(const std::string &file_name, rs2::video_frame &frame) {
+void RealSenseD400::WriteVideoFrameMetaData(const std::string &file_name, const rs2::video_frame &frame) {
     std::ofstream csv;
     csv.open(file_name);
 
@@ -216,23 +1072,111 @@ void RealSenseD400::WriteVideoFrameMetaData(const std::string &file_name, rs2::v
     csv.close();
 }
 
-void RealSenseD400::WriteDeviceData(const std::string &file_name) {
+void RealSenseD400::WriteCaptureMetaData(const std::string &file_name, const Capture &capture) {
     std::ofstream csv;
     csv.open(file_name);
 
-    std::cout << "Camera " << serial_number_ << ": Writing device data " << file_name << std::endl;
+    // Captures from every camera that share a group were exposed together (hardware) or within half a frame (software)
+    csv << "Capture Attribute,Value\n";
+    csv << "Capture Group," << capture.capture_group << '\n';
+    csv << "Sync Mode," << (capture.sync_mode == SyncMode::MASTER ? "master" :
+                            capture.sync_mode == SyncMode::SLAVE ? "slave" : "default") << '\n';
+    csv << "Alignment," << (capture.hardware_aligned ? "hardware" : "software") << '\n';
+    csv << "Frame Counter," << capture.frame_counter << '\n';
+    if (capture.paired) {
+        // The emitter modes the halves were picked by, a mis-paired capture shows the same mode twice
+        csv << "Paired IR Frame Counter," << capture.ir_frame_counter << '\n';
+        csv << "Paired Frame Gap," << capture.paired_frame_gap << '\n';
+        csv << "Depth Emitter Mode," << capture.depth_emitter_mode << '\n';
+        csv << "IR Emitter Mode," << capture.ir_emitter_mode << '\n';
+    }
+    if (!capture.fusion.empty()) {
+        csv << "Depth Fusion," << capture.fusion << '\n';
+        csv << "Fused Depth Frames," << capture.fused_frames << '\n';
+        csv << "Fused Frame Counters," << capture.fused_first_counter << " - " << capture.fused_last_counter << '\n';
+    }
+    if (capture.bracket_frames > 0) {
+        // Exposures in RS2_OPTION_EXPOSURE units, in the order of the _exposure_N files
+        csv << "Exposure Bracket,";
+        for (size_t i = 0; i < capture.bracket_exposures.size(); ++i)
+            csv << (i ? " " : "") << capture.bracket_exposures[i];
+        csv << '\n';
+        csv << "Bracket Frames," << capture.bracket_frames << '\n';
+        if (!capture.bracket_groups.empty()) {
+            csv << "Bracket Capture Groups,";
+            for (size_t i = 0; i < capture.bracket_groups.size(); ++i)
+                csv << (i ? " " : "") << capture.bracket_groups[i];
+            csv << '\n';
+        }
+    }
+    csv << "Frame Timestamp (ms)," << std::fixed << std::setprecision(3) << capture.frame_timestamp << '\n';
+    csv << std::defaultfloat;
+    csv << "Trigger," << capture.trigger << '\n';
+    csv << "Change Score," << capture.change_score << '\n';
+
+    if (capture.quality.measured) {
+        const FrameQuality &quality = capture.quality;
+        csv << "Quality," << (quality.passed ? "pass" : "fail") << '\n';
+        csv << "Sharpness," << quality.sharpness << '\n';
+        csv << "Brightness," << quality.brightness << '\n';
+        csv << "Under Exposed," << quality.under_exposed << '\n';
+        csv << "Over Exposed," << quality.over_exposed << '\n';
+        csv << "Depth Valid," << quality.depth_valid << '\n';
+
+        // 16 bins of 16 levels each, separated by spaces to stay a single CSV value
+        csv << "Exposure Histogram,";
+        for (size_t i = 0; i < quality.histogram.size(); ++i)
+            csv << (i ? " " : "") << quality.histogram[i];
+        csv << '\n';
+    }
+
+    if (duplicate_enabled_) {
+        csv << "Image Hash," << std::hex << std::setw(16) << std::setfill('0') << capture.image_hash << std::dec
+            << std::setfill(' ') << '\n';
+        csv << "Duplicate Distance," << capture.duplicate_distance << '\n';
+        csv << "Near Duplicate," << (capture.duplicate ? "yes" : "no") << '\n';
+    }
+
+    // Frame loss up to this capture
+    capture.frame_monitor.WriteCsv(csv);
+
+    csv.close();
+}
+
+void RealSenseD400::WriteDeviceData(const std::string &file_name) {
+    std::ostringstream csv;
 
     // Camera Info
     for (int i = 0; i < RS2_CAMERA_INFO_COUNT; ++i)
         if (dev_.supports((rs2_camera_info) i))
             csv << rs2_camera_info_to_string((rs2_camera_info) i) << "," << dev_.get_info((rs2_camera_info) i) << '\n';
 
-    // Depth Options
+    // Depth Options, read only ones (temperatures) differ on every read so they are written but not compared
+    std::set<std::string> telemetry;
     for (int i = 0; i < RS2_OPTION_COUNT; ++i)
-        if (depth_sensor_.supports((rs2_option) i))
+        if (depth_sensor_.supports((rs2_option) i)) {
             csv << rs2_option_to_string((rs2_option) i) << "," << depth_sensor_.get_option((rs2_option) i) << '\n';
+            if (depth_sensor_.is_option_read_only((rs2_option) i))
+                telemetry.insert(rs2_option_to_string((rs2_option) i));
+        }
 
-    csv.close();
+    // The file is written again on every start and dataset change, keep it when the device settings are the same
+    auto settings = [&telemetry](std::istream &in) {
+        std::string line, kept;
+        while (std::getline(in, line))
+            if (telemetry.count(line.substr(0, line.find(','))) == 0)
+                kept += line + '\n';
+        return kept;
+    };
+    std::ifstream existing(file_name);
+    std::istringstream current(csv.str());
+    if (existing.is_open() && settings(existing) == settings(current))
+        return;
+    existing.close();
+
+    std::cout << "Camera " << serial_number_ << ": Writing device data " << file_name << std::endl;
+    std::ofstream out(file_name);
+    out << csv.str();
 }
 
 const void RealSenseD400::Setup() {
@@ -250,36 +1194,87 @@ const void RealSenseD400::Setup() {
 
 const void RealSenseD400::WaitForFrames() {
     //std::cout << "Camera " << serial_number_ << " waiting for frames" << std::endl;
+    TraceScope trace("WaitForFrames", serial_number_);
+
+    // Only replace the current frames once a complete set arrives so the OpenCV views never dangle
+    rs2::frameset frames;
+    rs2::video_frame depth(nullptr), colour(nullptr), lir(nullptr), rir(nullptr), c_depth(nullptr);
+    rs2::points point_cloud;
 
     int attempts = 0;
     do {
+        if (attempts == max_frame_attempts_) {
+            std::cerr << "Camera " << serial_number_ << ": No coherent frame set after " << attempts
+                      << " attempts, keeping the previous frames" << std::endl;
+            return;
+        }
+
         try {
-            if (attempts > 0)
+            if (attempts > 0) {
                 std::cerr << "\nCamera " << serial_number_ << ": Invalid frame, waiting for next coherent set (Attempt"
                           << attempts << ")" << std::endl;
+                metrics_->Add(Counter::INVALID_FRAMES);
+            }
 
             // Wait for a coherent set of frames
-            //if(pipe_.poll_for_frames(&frames_)) {
-            frames_ = pipe_.wait_for_frames();
-            depth_ = frames_.get_depth_frame();
-            colour_ = frames_.get_color_frame();
-            lir_ = frames_.get_infrared_frame(1);
-            rir_ = frames_.get_infrared_frame(2);
-            c_depth_ = color_map.process(depth_);
-
-            // Map to depth_ frame
-            pc_.map_to(depth_);
-            point_cloud_ = pc_.calculate(depth_);
-
-            // Validate the frames
-            attempts++;
-            //}
+            {
+                ScopedTimer timer(metrics_, Stage::WAIT_FOR_FRAMES);
+                frames = NextFrameset();
+            }
+            depth = frames.get_depth_frame();
+            colour = frames.get_color_frame();
+            lir = frames.get_infrared_frame(1);
+            rir = frames.get_infrared_frame(2);
+            if (depth) {
+                ScopedTimer timer(metrics_, Stage::COLOURISE);
+                c_depth = color_map.process(depth);
+            }
+
+            // Map to depth frame
+            if (depth) {
+                ScopedTimer timer(metrics_, Stage::POINT_CLOUD);
+                pc_.map_to(depth);
+                point_cloud = pc_.calculate(depth);
+            }
         } catch (rs2::error &e) {
             std::cerr << "Camera " << serial_number_ << ": " << e.what() << std::endl;
-            attempts++;
         }
-    } while (!colour_ || !depth_ || !c_depth_ || !lir_ || !rir_ || !point_cloud_);
+        attempts++;
+    } while (!colour || !depth || !c_depth || !lir || !rir || !point_cloud);
+
+    frames_ = frames;
+    depth_ = depth;
+    colour_ = colour;
+    lir_ = lir;
+    rir_ = rir;
+    c_depth_ = c_depth;
+    point_cloud_ = point_cloud;
+    metrics_->Add(Counter::FRAMES);
+
+    // Record the hardware frame counter and a host comparable timestamp used to group captures across cameras
+    frame_counter_ = depth_.supports_frame_metadata(RS2_FRAME_METADATA_FRAME_COUNTER) ?
+                     depth_.get_frame_metadata(RS2_FRAME_METADATA_FRAME_COUNTER) :
+                     static_cast<long long>(depth_.get_frame_number());
 
+    // While the emitter alternates only emitter on frames are analysed, the pattern would otherwise flicker in the
+    // change score and every other frame would fail the depth check
+    int emitter = paired_capture_ ? EmitterState(depth_) : -1;
+    if (emitter >= 0)
+        (emitter ? emitter_on_ : emitter_off_) = {depth_, colour_, lir_, rir_, c_depth_, point_cloud_, frame_counter_};
+
+    MonitorFrames();
+    if (change_detection_ && emitter != 0)
+        UpdateChangeScore();
+    if (quality_enabled_ && emitter != 0) {
+        ScopedTimer timer(metrics_, Stage::QUALITY);
+        UpdateQuality();
+    }
+
+    if (depth_.get_frame_timestamp_domain() == RS2_TIMESTAMP_DOMAIN_HARDWARE_CLOCK &&
+        depth_.supports_frame_metadata(RS2_FRAME_METADATA_TIME_OF_ARRIVAL))
+        frame_timestamp_ = depth_.get_frame_metadata(RS2_FRAME_METADATA_TIME_OF_ARRIVAL);
+    else
+        frame_timestamp_ = depth_.get_timestamp();
 
     // Create OpenCV objects
     colour_mat_ = cv::Mat(cv::Size(colour_.get_width(), colour_.get_height()), CV_8UC3, (void *) colour_.get_data());
@@ -321,10 +1316,252 @@ const void RealSenseD400::SetLaser(bool status, float power) {
     }
 }
 
+bool RealSenseD400::SetPairedCapture(bool enabled) {
+    if (!depth_sensor_.supports(RS2_OPTION_EMITTER_ON_OFF)) {
+        std::cerr << "Camera " << serial_number_ << ": Emitter on/off not supported, update the firmware for paired "
+                  << "capture" << std::endl;
+        return false;
+    }
+
+    try {
+        // The alternation only shows while the emitter is enabled
+        if (enabled && depth_sensor_.supports(RS2_OPTION_EMITTER_ENABLED))
+            depth_sensor_.set_option(RS2_OPTION_EMITTER_ENABLED, 1);
+        depth_sensor_.set_option(RS2_OPTION_EMITTER_ON_OFF, enabled);
+    } catch (const rs2::error &e) {
+        std::cerr << "Camera " << serial_number_ << ": Could not set emitter on/off (" << e.what() << ")" << std::endl;
+        return false;
+    }
+
+    paired_capture_ = enabled;
+    emitter_on_ = emitter_off_ = EmitterFrames();
+    std::cout << "Camera " << serial_number_ << ": Paired capture " << (enabled ? "enabled" : "disabled") << std::endl;
+    return true;
+}
+
+bool RealSenseD400::SetDepthFusion(bool enabled) {
+    depth_fusion_ = enabled;
+    std::cout << "Camera " << serial_number_ << ": Depth fusion " << (enabled ? "enabled" : "disabled");
+    if (enabled)
+        std::cout << " (" << (fusion_median_ ? "median" : "mean") << " of " << fusion_frames_ << " frames)";
+    std::cout << std::endl;
+    return true;
+}
+
+bool RealSenseD400::SetExposureBracket(bool enabled) {
+    if (enabled) {
+        try {
+            rs2::color_sensor sensor = dev_.first<rs2::color_sensor>();
+            if (!sensor.supports(RS2_OPTION_EXPOSURE))
+                throw std::runtime_error("no manual exposure");
+
+            // Values outside the sensor's range would fail on every save
+            rs2::option_range range = sensor.get_option_range(RS2_OPTION_EXPOSURE);
+            for (float &exposure : bracket_exposures_)
+                exposure = std::min(std::max(exposure, range.min), range.max);
+        } catch (const std::exception &e) {
+            std::cerr << "Camera " << serial_number_ << ": Exposure bracket not supported (" << e.what() << ")"
+                      << std::endl;
+            return false;
+        }
+    }
+
+    exposure_bracket_ = enabled;
+    std::cout << "Camera " << serial_number_ << ": Exposure bracket " << (enabled ? "enabled" : "disabled");
+    if (enabled) {
+        std::cout << " (";
+        for (size_t i = 0; i < bracket_exposures_.size(); ++i)
+            std::cout << (i ? ", " : "") << bracket_exposures_[i];
+        std::cout << ")";
+    }
+    std::cout << std::endl;
+    return true;
+}
+
+int RealSenseD400::EmitterState(const rs2::frame &frame) {
+    long long mode = EmitterMode(frame);
+    return mode < 0 ? -1 : mode != 0 ? 1 : 0;
+}
+
+long long RealSenseD400::EmitterMode(const rs2::frame &frame) {
+    // Older librealsense versions only report the laser power mode, both are 0 with the emitter off
+    for (auto value : {RS2_FRAME_METADATA_FRAME_EMITTER_MODE, RS2_FRAME_METADATA_FRAME_LASER_POWER_MODE})
+        if (frame.supports_frame_metadata(value))
+            return frame.get_frame_metadata(value);
+    return -1;
+}
+
 rs2::pipeline_profile RealSenseD400::GetProfile() {
     return selection;
 }
 
+void RealSenseD400::MonitorFrames() {
+    // Compare hardware frame counters with the previous set to find frames lost on the way (e.g. USB contention)
+    long long missing[FrameMonitor::COUNT] = {
+            frame_monitor_.Update(FrameMonitor::DEPTH, depth_),
+            frame_monitor_.Update(FrameMonitor::COLOUR, colour_),
+            frame_monitor_.Update(FrameMonitor::IR_LEFT, lir_),
+            frame_monitor_.Update(FrameMonitor::IR_RIGHT, rir_)
+    };
+
+    for (int i = 0; i < FrameMonitor::COUNT; ++i) {
+        if (missing[i] <= 0)
+            continue;
+
+        metrics_->Add(Counter::DROPPED_FRAMES, static_cast<uint64_t>(missing[i]));
+
+        // Report live but at most once a second per camera so a struggling bus does not flood the console
+        auto now = std::chrono::steady_clock::now();
+        if (now - last_drop_report_ < std::chrono::seconds(1))
+            continue;
+        last_drop_report_ = now;
+
+        const StreamMonitor &stream = frame_monitor_.Get(static_cast<FrameMonitor::Stream>(i));
+        std::cerr << "Camera " << serial_number_ << ": " << stream.GetName() << " dropped " << missing[i]
+                  << " frame(s) before counter " << stream.LastCounter() << " (" << std::fixed
+                  << std::setprecision(1) << stream.DropRate() * 100 << "% of the last " << StreamMonitor::kWindow
+                  << ")" << std::defaultfloat << std::endl;
+    }
+}
+
+void RealSenseD400::SetChangeDetection(bool enabled, bool colour, int decimation) {
+    change_detection_ = enabled;
+    change_on_colour_ = colour;
+    change_decimation_ = std::max(1, decimation);
+    thumbnail_.clear();
+    reference_thumbnail_.clear();
+    change_score_ = 0;
+}
+
+void RealSenseD400::UpdateChangeScore() {
+    // Green carries most of the luminance, sampling one channel avoids a colour conversion
+    const rs2::video_frame &frame = change_on_colour_ ? colour_ : lir_;
+    int channels = change_on_colour_ ? 3 : 1, channel = change_on_colour_ ? 1 : 0;
+    int width = frame.get_width(), height = frame.get_height();
+
+    thumbnail_.resize(static_cast<size_t>(width / change_decimation_) * (height / change_decimation_));
+    ImageKernels::Decimate(static_cast<const uint8_t *>(frame.get_data()), width, height,
+                           frame.get_stride_in_bytes(), channels, channel, change_decimation_, thumbnail_.data());
+
+    // Until the first save every frame counts as changed
+    if (reference_thumbnail_.size() != thumbnail_.size()) {
+        change_score_ = 255;
+        return;
+    }
+    change_score_ = ImageKernels::MeanAbsDifference(thumbnail_.data(), reference_thumbnail_.data(), thumbnail_.size());
+}
+
+double RealSenseD400::GetChangeScore() {
+    return change_score_;
+}
+
+void RealSenseD400::UpdateQuality() {
+    // Levels at or below/above these count as clipped
+    const int dark_level = 5, bright_level = 250;
+
+    const rs2::video_frame &frame = quality_on_colour_ ? colour_ : lir_;
+    int channels = quality_on_colour_ ? 3 : 1, channel = quality_on_colour_ ? 1 : 0;
+    int width = frame.get_width() / quality_decimation_, height = frame.get_height() / quality_decimation_;
+
+    // Blur shows at any scale, decimating first keeps the sharpness and histogram to a few hundred microseconds
+    quality_thumbnail_.resize(static_cast<size_t>(width) * height);
+    ImageKernels::Decimate(static_cast<const uint8_t *>(frame.get_data()), frame.get_width(), frame.get_height(),
+                           frame.get_stride_in_bytes(), channels, channel, quality_decimation_,
+                           quality_thumbnail_.data());
+    quality_.sharpness = ImageKernels::LaplacianVariance(quality_thumbnail_.data(), width, height);
+
+    uint32_t histogram[256];
+    ImageKernels::Histogram(quality_thumbnail_.data(), quality_thumbnail_.size(), histogram);
+    double pixels = std::max<size_t>(quality_thumbnail_.size(), 1), total = 0, dark = 0, bright = 0;
+    quality_.histogram.fill(0);
+    for (int level = 0; level < 256; ++level) {
+        total += static_cast<double>(level) * histogram[level];
+        dark += level <= dark_level ? histogram[level] : 0;
+        bright += level >= bright_level ? histogram[level] : 0;
+        quality_.histogram[level / 16] += static_cast<float>(histogram[level] / pixels);
+    }
+    quality_.brightness = total / pixels;
+    quality_.under_exposed = dark / pixels;
+    quality_.over_exposed = bright / pixels;
+
+    size_t depth_pixels = static_cast<size_t>(depth_.get_width()) * depth_.get_height();
+    quality_.depth_valid = depth_pixels == 0 ? 0 : static_cast<double>(ImageKernels::CountNonZero(
+            static_cast<const uint16_t *>(depth_.get_data()), depth_.get_width(), depth_.get_height(),
+            depth_.get_stride_in_bytes())) / depth_pixels;
+
+    quality_.measured = true;
+    quality_.passed = quality_.sharpness >= min_sharpness_ &&
+                      quality_.under_exposed + quality_.over_exposed <= max_clipped_ &&
+                      quality_.depth_valid >= min_depth_valid_;
+}
+
+void RealSenseD400::HashCapture(Capture &capture) {
+    // Colour green channel decimated by 8, dHash only looks at 9x8 cell means so fine detail does not matter. The
+    // saved colour frame, fusion and bracketing move the current one on
+    const int decimation = 8;
+    const rs2::video_frame &colour = capture.colour;
+    if (!colour)
+        return;
+
+    int width = colour.get_width() / decimation, height = colour.get_height() / decimation;
+    hash_thumbnail_.resize(static_cast<size_t>(width) * height);
+    ImageKernels::Decimate(static_cast<const uint8_t *>(colour.get_data()), colour.get_width(),
+                           colour.get_height(), colour.get_stride_in_bytes(), 3, 1, decimation,
+                           hash_thumbnail_.data());
+    capture.image_hash = ImageKernels::DifferenceHash(hash_thumbnail_.data(), width, height);
+
+    for (uint64_t hash : saved_hashes_) {
+        int distance = ImageKernels::HammingDistance(capture.image_hash, hash);
+        if (capture.duplicate_distance < 0 || distance < capture.duplicate_distance)
+            capture.duplicate_distance = distance;
+    }
+    capture.duplicate = capture.duplicate_distance >= 0 && capture.duplicate_distance <= duplicate_max_distance_;
+
+    // Skipped captures stay out of the history so a slow drift is still compared with what is on disk
+    if (capture.duplicate && duplicate_skip_ && capture.trigger != "manual")
+        return;
+    saved_hashes_.push_back(capture.image_hash);
+    if (saved_hashes_.size() > duplicate_history_)
+        saved_hashes_.pop_front();
+}
+
+const FrameQuality &RealSenseD400::GetQuality() {
+    return quality_;
+}
+
+void RealSenseD400::PrintFrameStatistics() {
+    frame_monitor_.Print(std::cout, serial_number_);
+}
+
+const std::string &RealSenseD400::GetSerialNumber() {
+    return serial_number_;
+}
+
+SyncMode RealSenseD400::GetSyncMode() {
+    return sync_mode_;
+}
+
+bool RealSenseD400::HardwareSynced() {
+    return hardware_synced_;
+}
+
+long long RealSenseD400::GetFrameCounter() {
+    return frame_counter_;
+}
+
+double RealSenseD400::GetFrameTimestamp() {
+    return frame_timestamp_;
+}
+
+double RealSenseD400::GetFramePeriod() {
+    return frame_period_;
+}
+
+void RealSenseD400::SetCaptureGroup(long long group, bool hardware_aligned) {
+    capture_group_ = group;
+    capture_hardware_aligned_ = hardware_aligned;
+}
+
 void RealSenseD400::CloseGUI() {
     if (gui_enabled_) {
         cv::destroyWindow(win_colour_);
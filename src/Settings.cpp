@@ -0,0 +1,401 @@
+#include <algorithm>
+#include <mutex>
+#include <stdexcept>
+
+#include "Settings.hpp"
+#include "ConfigManager.hpp"
+
+namespace {
+    // Reads the keys of one config object into fields, recording every problem instead of stopping at the first
+    class SettingsReader {
+    public:
+        // A section of the config (e.g. "options"), keys nobody reads are reported as unknown
+        SettingsReader(const nlohmann::json &config, const std::string &name, const std::string &prefix,
+                       std::vector<std::string> &errors) : errors_(errors), prefix_(prefix + name + "."),
+                                                           check_unknown_(true) {
+            auto section = config.find(name);
+            if (section == config.end() || section->is_null())
+                return;
+            if (!section->is_object()) {
+                errors_.push_back(prefix + name + ": expected an object, got " + section->dump());
+                return;
+            }
+            object_ = &*section;
+        }
+
+        // Top level settings, the rest of the object belongs to other readers. A list entry checks its own keys
+        SettingsReader(const nlohmann::json &config, const std::string &prefix, std::vector<std::string> &errors,
+                       bool check_unknown = false) : errors_(errors), prefix_(prefix), object_(&config),
+                                                     check_unknown_(check_unknown) {}
+
+        ~SettingsReader() {
+            if (object_ == nullptr || !check_unknown_)
+                return;
+            for (auto it = object_->begin(); it != object_->end(); ++it)
+                if (std::find(read_.begin(), read_.end(), it.key()) == read_.end())
+                    errors_.push_back(prefix_ + it.key() + ": unknown setting");
+        }
+
+        void Read(const std::string &key, int &value, int min, int max) {
+            const nlohmann::json *setting = Find(key);
+            if (setting == nullptr)
+                return;
+            if (!setting->is_number_integer())
+                Error(key, "expected an integer", *setting);
+            else if (setting->get<long long>() < min || setting->get<long long>() > max)
+                Error(key, "expected " + std::to_string(min) + " to " + std::to_string(max), *setting);
+            else
+                value = setting->get<int>();
+        }
+
+        void Read(const std::string &key, double &value, double min, double max) {
+            const nlohmann::json *setting = Find(key);
+            if (setting == nullptr)
+                return;
+            if (!setting->is_number())
+                Error(key, "expected a number", *setting);
+            else if (setting->get<double>() < min || setting->get<double>() > max)
+                Error(key, "expected " + std::to_string(min) + " to " + std::to_string(max), *setting);
+            else
+                value = setting->get<double>();
+        }
+
+        void Read(const std::string &key, bool &value) {
+            const nlohmann::json *setting = Find(key);
+            if (setting == nullptr)
+                return;
+            if (!setting->is_boolean())
+                Error(key, "expected true or false", *setting);
+            else
+                value = setting->get<bool>();
+        }
+
+        // File and folder names must not be empty or contain '/' (they would escape the capture folder), paths may
+        void Read(const std::string &key, std::string &value, bool path = false) {
+            const nlohmann::json *setting = Find(key);
+            if (setting == nullptr)
+                return;
+            if (!setting->is_string())
+                Error(key, "expected a string", *setting);
+            else if (!path && setting->get<std::string>().empty())
+                Error(key, "must not be empty", *setting);
+            else if (!path && setting->get<std::string>().find('/') != std::string::npos)
+                Error(key, "must not contain '/'", *setting);
+            else
+                value = setting->get<std::string>();
+        }
+        // One of a fixed set of names (e.g. a policy)
+        void Read(const std::string &key, std::string &value, const std::vector<std::string> &choices) {
+            const nlohmann::json *setting = Find(key);
+            if (setting == nullptr)
+                return;
+            if (!setting->is_string() ||
+                std::find(choices.begin(), choices.end(), setting->get<std::string>()) == choices.end()) {
+                std::string expected = "expected";
+                for (size_t i = 0; i < choices.size(); ++i)
+                    expected += (i == 0 ? " '" : i + 1 == choices.size() ? " or '" : ", '") + choices[i] + "'";
+                Error(key, expected, *setting);
+            } else {
+                value = setting->get<std::string>();
+            }
+        }
+
+        // A non empty list of numbers, each in range
+        void Read(const std::string &key, std::vector<double> &value, double min, double max) {
+            const nlohmann::json *setting = Find(key);
+            if (setting == nullptr)
+                return;
+            bool valid = setting->is_array() && !setting->empty();
+            for (size_t i = 0; valid && i < setting->size(); ++i)
+                valid = (*setting)[i].is_number() && (*setting)[i].get<double>() >= min &&
+                        (*setting)[i].get<double>() <= max;
+            if (!valid)
+                Error(key, "expected a list of numbers from " + std::to_string(min) + " to " + std::to_string(max),
+                      *setting);
+            else
+                value = setting->get<std::vector<double>>();
+        }
+
+        // The objects of a list, each read by its own reader
+        std::vector<const nlohmann::json *> Objects(const std::string &key) {
+            std::vector<const nlohmann::json *> objects;
+            const nlohmann::json *setting = Find(key);
+            if (setting == nullptr)
+                return objects;
+            if (!setting->is_array()) {
+                Error(key, "expected a list", *setting);
+                return objects;
+            }
+            for (size_t i = 0; i < setting->size(); ++i) {
+                if ((*setting)[i].is_object())
+                    objects.push_back(&(*setting)[i]);
+                else
+                    Error(key + "." + std::to_string(i), "expected an object", (*setting)[i]);
+            }
+            return objects;
+        }
+
+        const std::string &Prefix() const { return prefix_; }
+    private:
+        const nlohmann::json *Find(const std::string &key) {
+            read_.push_back(key);
+            if (object_ == nullptr)
+                return nullptr;
+            auto setting = object_->find(key);
+            return setting == object_->end() || setting->is_null() ? nullptr : &*setting;
+        }
+
+        void Error(const std::string &key, const std::string &problem, const nlohmann::json &setting) {
+            errors_.push_back(prefix_ + key + ": " + problem + ", got " + setting.dump());
+        }
+
+        std::vector<std::string> &errors_;
+        std::string prefix_;
+        const nlohmann::json *object_ = nullptr;
+        bool check_unknown_;
+        std::vector<std::string> read_;
+    };
+}
+
+CameraSettings CaptureSettings::ParseCamera(const nlohmann::json &config, const std::string &prefix,
+                                            std::vector<std::string> &errors) {
+    CameraSettings camera;
+    for (auto stream : {std::make_pair("stream-depth", &camera.depth), std::make_pair("stream-colour", &camera.colour)}) {
+        SettingsReader section(config, stream.first, prefix, errors);
+        section.Read("width", stream.second->width, 1, 8192);
+        section.Read("height", stream.second->height, 1, 8192);
+        section.Read("frame-rate", stream.second->frame_rate, 1, 300);
+    }
+
+    {
+        SettingsReader options(config, "options", prefix, errors);
+        options.Read("auto-exposure", camera.options.auto_exposure);
+        options.Read("back-light-compensation", camera.options.back_light_compensation);
+        options.Read("auto-white-balance", camera.options.auto_white_balance);
+    }
+
+    {
+        SettingsReader preset(config, "advanced-preset", prefix, errors);
+        preset.Read("path", camera.preset.path, true);
+        preset.Read("cache", camera.preset.cache, true);
+    }
+
+    {
+        FileNameSettings &names = camera.file_names;
+        SettingsReader file_names(config, "file-names", prefix, errors);
+        file_names.Read("video_frame_ext", names.video_frame_ext);
+        file_names.Read("point_cloud_ext", names.point_cloud_ext);
+        file_names.Read("metadata_ext", names.metadata_ext);
+        file_names.Read("recording_ext", names.recording_ext);
+        file_names.Read("depth", names.depth);
+        file_names.Read("coloured_depth", names.coloured_depth);
+        file_names.Read("colour", names.colour);
+        file_names.Read("ir", names.ir);
+        file_names.Read("ir_left", names.ir_left);
+        file_names.Read("ir_right", names.ir_right);
+        file_names.Read("point_cloud", names.point_cloud);
+        file_names.Read("capture", names.capture);
+        file_names.Read("recording", names.recording);
+    }
+
+    {
+        SettingsReader convergence(config, "stabilise-exposure-convergence", prefix, errors);
+        convergence.Read("tolerance", camera.convergence.tolerance, 0.0, 1.0);
+        convergence.Read("stable-frames", camera.convergence.stable_frames, 1, 1000);
+        convergence.Read("timeout-ms", camera.convergence.timeout_ms, 0, 600000);
+    }
+
+    {
+        QualitySettings &quality = camera.quality;
+        SettingsReader section(config, "quality-gate", prefix, errors);
+        std::string stream = quality.on_colour ? "colour" : "ir";
+        section.Read("enabled", quality.enabled);
+        section.Read("stream", stream, {"colour", "ir"});
+        section.Read("decimation", quality.decimation, 1, 64);
+        section.Read("min-sharpness", quality.min_sharpness, 0.0, 1e9);
+        section.Read("max-clipped", quality.max_clipped, 0.0, 1.0);
+        section.Read("min-depth-valid", quality.min_depth_valid, 0.0, 1.0);
+        section.Read("policy", quality.policy, {"record", "wait", "skip"});
+        section.Read("wait-ms", quality.wait_ms, 0, 600000);
+        quality.on_colour = stream == "colour";
+    }
+
+    {
+        DuplicateSettings &duplicates = camera.duplicates;
+        SettingsReader section(config, "duplicate-suppression", prefix, errors);
+        std::string policy = duplicates.skip ? "skip" : "flag";
+        section.Read("enabled", duplicates.enabled);
+        section.Read("policy", policy, {"flag", "skip"});
+        section.Read("history", duplicates.history, 1, 10000);
+        section.Read("max-distance", duplicates.max_distance, 0, 64);
+        duplicates.skip = policy == "skip";
+    }
+
+    {
+        SettingsReader section(config, "paired-capture", prefix, errors);
+        section.Read("enabled", camera.paired.enabled);
+        section.Read("max-frame-gap", camera.paired.max_frame_gap, 1, 1000);
+    }
+
+    {
+        FusionSettings &fusion = camera.fusion;
+        SettingsReader section(config, "depth-fusion", prefix, errors);
+        std::string method = fusion.median ? "median" : "mean";
+        section.Read("enabled", fusion.enabled);
+        section.Read("frames", fusion.frames, 1, 1000);
+        section.Read("method", method, {"median", "mean"});
+        section.Read("tolerance", fusion.tolerance, 0.0, 1.0);
+        section.Read("min-valid", fusion.min_valid, 1, 1000);
+        fusion.median = method == "median";
+    }
+
+    {
+        BracketSettings &bracket = camera.bracket;
+        SettingsReader section(config, "exposure-bracket", prefix, errors);
+        section.Read("enabled", bracket.enabled);
+        section.Read("exposures", bracket.exposures, 1.0, 100000.0);
+        section.Read("tolerance", bracket.tolerance, 0.0, 1.0);
+        section.Read("metadata-scale", bracket.metadata_scale, 1e-6, 1e6);
+        section.Read("max-frames", bracket.max_frames, 1, 1000);
+        section.Read("merge", bracket.merge);
+    }
+
+    {
+        RollingSettings &rolling = camera.rolling;
+        SettingsReader section(config, "rolling-capture", prefix, errors);
+        std::string stream = rolling.on_colour ? "colour" : "ir";
+        section.Read("enabled", rolling.enabled);
+        section.Read("interval-ms", rolling.interval_ms, 0, 86400000);
+        section.Read("change-threshold", rolling.change_threshold, 0.0, 255.0);
+        section.Read("min-gap-ms", rolling.min_gap_ms, 0, 86400000);
+        section.Read("stream", stream, {"colour", "ir"});
+        section.Read("decimation", rolling.decimation, 1, 64);
+        rolling.on_colour = stream == "colour";
+    }
+
+    {
+        SettingsReader section(config, "inter-cam-sync", prefix, errors);
+        section.Read("enabled", camera.sync.enabled);
+        section.Read("master", camera.sync.master, true);
+        section.Read("alignment-attempts", camera.sync.alignment_attempts, 0, 100);
+    }
+
+    {
+        SettingsReader section(config, "async-writer", prefix, errors);
+        section.Read("threads", camera.writer.threads, 1, 64);
+        section.Read("queue", camera.writer.queue, 1, 10000);
+    }
+
+    {
+        SettingsReader section(config, "cameras", prefix, errors);
+        section.Read("physical", camera.cameras.physical);
+        std::vector<const nlohmann::json *> entries = section.Objects("virtual");
+        for (size_t i = 0; i < entries.size(); ++i) {
+            VirtualCameraSettings virtual_camera;
+            SettingsReader entry(*entries[i], section.Prefix() + "virtual." + std::to_string(i) + ".", errors, true);
+            entry.Read("type", virtual_camera.type, {"bag", "synthetic"});
+            entry.Read("path", virtual_camera.path, true);
+            entry.Read("serial", virtual_camera.serial, true);
+            entry.Read("count", virtual_camera.count, 1, 64);
+            entry.Read("repeat", virtual_camera.repeat);
+            entry.Read("real-time", virtual_camera.real_time);
+            entry.Read("width", virtual_camera.width, 1, 8192);
+            entry.Read("height", virtual_camera.height, 1, 8192);
+            entry.Read("colour-width", virtual_camera.colour_width, 1, 8192);
+            entry.Read("colour-height", virtual_camera.colour_height, 1, 8192);
+            entry.Read("frame-rate", virtual_camera.frame_rate, 1, 300);
+            if (virtual_camera.type.empty())
+                errors.push_back(entry.Prefix() + "type: expected 'bag' or 'synthetic'");
+            else if (virtual_camera.type == "bag" && virtual_camera.path.empty())
+                errors.push_back(entry.Prefix() + "path: a bag camera needs the recording's path");
+            // An empty serial is looked up (bag) or generated (synthetic), it names the camera's folders otherwise
+            if (virtual_camera.serial.find('/') != std::string::npos)
+                errors.push_back(entry.Prefix() + "serial: must not contain '/', got \"" + virtual_camera.serial +
+                                 "\"");
+            camera.cameras.virtual_cameras.push_back(virtual_camera);
+        }
+    }
+
+    {
+        SettingsReader section(config, "config-reload", prefix, errors);
+        section.Read("enabled", camera.reload.enabled);
+        section.Read("debounce-ms", camera.reload.debounce_ms, 0, 600000);
+    }
+
+    SettingsReader top_level(config, prefix, errors);
+    top_level.Read("save-path-prefix", camera.paths.save_path_prefix, true);
+    top_level.Read("project-name", camera.paths.project_name);
+    top_level.Read("gui-enabled", camera.gui_enabled);
+    top_level.Read("stabilise-exposure", camera.stabilise_exposure);
+    top_level.Read("stabilise-exposure-count", camera.stabilise_exposure_count, 0, 1000);
+    return camera;
+}
+
+CaptureSettings CaptureSettings::Parse(const nlohmann::json &config) {
+    CaptureSettings settings;
+    std::vector<std::string> errors;
+    if (!config.is_object())
+        throw std::invalid_argument("Invalid config: expected an object");
+    settings.defaults_ = ParseCamera(config, "", errors);
+
+    // An override is merged into the global settings before parsing, so it only has to list what differs. Problems
+    // of the global settings would be reported again for every camera, those are only parsed once they are fixed
+    bool defaults_valid = errors.empty();
+    auto overrides = config.find("camera-overrides");
+    if (overrides != config.end() && !overrides->is_null()) {
+        if (!overrides->is_object())
+            errors.push_back("camera-overrides: expected an object of serial numbers, got " + overrides->dump());
+        else
+            for (auto it = overrides->begin(); it != overrides->end(); ++it) {
+                std::string prefix = "camera-overrides." + it.key() + ".";
+                if (!it->is_object()) {
+                    errors.push_back(prefix.substr(0, prefix.size() - 1) + ": expected an object, got " + it->dump());
+                    continue;
+                }
+
+                for (auto key = it->begin(); key != it->end(); ++key)
+                    if (key.key() != "stream-depth" && key.key() != "stream-colour" && key.key() != "options" &&
+                        key.key() != "advanced-preset" && key.key() != "file-names" &&
+                        key.key() != "save-path-prefix" && key.key() != "project-name")
+                        errors.push_back(prefix + key.key() + ": can not be set per camera");
+
+                if (!defaults_valid)
+                    continue;
+                nlohmann::json merged = config;
+                merged.merge_patch(*it);
+                settings.cameras_[it.key()] = ParseCamera(merged, prefix, errors);
+            }
+    }
+
+    if (!errors.empty()) {
+        std::string message = "Invalid config:";
+        for (auto &error : errors)
+            message += "\n\t" + error;
+        throw std::invalid_argument(message);
+    }
+    return settings;
+}
+
+std::shared_ptr<const CaptureSettings> CaptureSettings::Current() {
+    static std::mutex lock;
+    static uint64_t version = 0;
+    static std::shared_ptr<const CaptureSettings> settings;
+
+    ConfigManager *config = ConfigManager::GetInstance();
+    std::lock_guard<std::mutex> guard(lock);
+    if (settings == nullptr || version != config->Version()) {
+        std::shared_ptr<const ConfigSnapshot> snapshot = config->GetShared();
+        settings = std::make_shared<const CaptureSettings>(Parse(snapshot->Json()));
+        version = snapshot->Version();
+    }
+    return settings;
+}
+
+const CameraSettings &CaptureSettings::Camera(const std::string &serial_number) const {
+    auto camera = cameras_.find(serial_number);
+    return camera == cameras_.end() ? defaults_ : camera->second;
+}
+
+const CameraSettings &CaptureSettings::Defaults() const {
+    return defaults_;
+}
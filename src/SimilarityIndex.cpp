@@ -0,0 +1,152 @@
+#include <algorithm>
+#include <cstdint>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+
+#include "SimilarityIndex.hpp"
+#include "ImageKernels.hpp"
+
+void SimilarityIndex::Insert(uint64_t hash, size_t id) {
+    entries_.emplace_back(hash, id);
+    max_radius_ = -1;
+}
+
+void SimilarityIndex::Build(int max_radius) {
+    // Collapse identical hashes, near duplicate heavy datasets have many
+    std::sort(entries_.begin(), entries_.end());
+    hashes_.clear();
+    ids_.clear();
+    offsets_.clear();
+    for (auto &entry : entries_) {
+        if (hashes_.empty() || hashes_.back() != entry.first) {
+            hashes_.push_back(entry.first);
+            offsets_.push_back(ids_.size());
+        }
+        ids_.push_back(entry.second);
+    }
+    offsets_.push_back(ids_.size());
+
+    // max_radius + 1 chunks of (nearly) equal width
+    max_radius_ = std::max(0, std::min(max_radius, 63));
+    int chunks = max_radius_ + 1;
+    chunk_shift_.assign(static_cast<size_t>(chunks), 0);
+    chunk_bits_.assign(static_cast<size_t>(chunks), 0);
+    for (int chunk = 0, shift = 0; chunk < chunks; ++chunk) {
+        chunk_bits_[chunk] = 64 / chunks + (chunk < 64 % chunks ? 1 : 0);
+        chunk_shift_[chunk] = shift;
+        shift += chunk_bits_[chunk];
+    }
+
+    tables_.assign(static_cast<size_t>(chunks), {});
+    for (int chunk = 0; chunk < chunks; ++chunk) {
+        uint64_t mask = chunk_bits_[chunk] == 64 ? ~0ull : (1ull << chunk_bits_[chunk]) - 1;
+        auto &table = tables_[chunk];
+        table.reserve(hashes_.size());
+        for (size_t i = 0; i < hashes_.size(); ++i)
+            table.emplace_back((hashes_[i] >> chunk_shift_[chunk]) & mask, static_cast<uint32_t>(i));
+        std::sort(table.begin(), table.end());
+    }
+}
+
+void SimilarityIndex::Candidates(uint64_t hash, int radius, std::vector<uint32_t> &found) const {
+    found.clear();
+    if (radius > max_radius_) {
+        for (size_t i = 0; i < hashes_.size(); ++i)
+            if (ImageKernels::HammingDistance(hash, hashes_[i]) <= radius)
+                found.push_back(static_cast<uint32_t>(i));
+        return;
+    }
+
+    // Pigeonhole, a hash within radius bits matches at least one of radius + 1 chunks exactly, checking the first
+    // radius + 1 tables is enough even when more were built
+    for (int chunk = 0; chunk <= radius; ++chunk) {
+        uint64_t mask = chunk_bits_[chunk] == 64 ? ~0ull : (1ull << chunk_bits_[chunk]) - 1;
+        uint64_t key = (hash >> chunk_shift_[chunk]) & mask;
+        auto &table = tables_[chunk];
+        auto range = std::equal_range(table.begin(), table.end(), std::make_pair(key, 0u),
+                                      [](const std::pair<uint64_t, uint32_t> &a,
+                                         const std::pair<uint64_t, uint32_t> &b) { return a.first < b.first; });
+        for (auto it = range.first; it != range.second; ++it)
+            if (ImageKernels::HammingDistance(hash, hashes_[it->second]) <= radius)
+                found.push_back(it->second);
+    }
+    std::sort(found.begin(), found.end());
+    found.erase(std::unique(found.begin(), found.end()), found.end());
+}
+
+std::vector<SimilarityIndex::Match> SimilarityIndex::Query(uint64_t hash, int radius) const {
+    if (radius < 0)
+        throw std::invalid_argument("SimilarityIndex: radius must not be negative, got " + std::to_string(radius));
+    std::vector<uint32_t> found;
+    Candidates(hash, radius, found);
+
+    std::vector<Match> matches;
+    for (uint32_t index : found) {
+        int distance = ImageKernels::HammingDistance(hash, hashes_[index]);
+        for (size_t i = offsets_[index]; i < offsets_[index + 1]; ++i)
+            matches.push_back({ids_[i], distance});
+    }
+    std::stable_sort(matches.begin(), matches.end(), [](const Match &a, const Match &b) {
+        return a.distance < b.distance;
+    });
+    return matches;
+}
+
+std::vector<std::vector<size_t>> SimilarityIndex::Cluster(int radius) const {
+    // Build clamps a negative radius to 0, so the matching index below would be rebuilt forever
+    if (radius < 0)
+        throw std::invalid_argument("SimilarityIndex: radius must not be negative, got " + std::to_string(radius));
+
+    // Chunks narrower than the radius needs return far more candidates, every hash is queried so use a matching index
+    if (radius != max_radius_ && radius < 64) {
+        SimilarityIndex matching;
+        matching.entries_ = entries_;
+        matching.Build(radius);
+        return matching.Cluster(radius);
+    }
+
+    // Union find over the distinct hashes, path halving keeps the trees flat
+    std::vector<uint32_t> parent(hashes_.size());
+    std::iota(parent.begin(), parent.end(), 0);
+    auto find = [&parent](uint32_t i) {
+        while (parent[i] != i)
+            i = parent[i] = parent[parent[i]];
+        return i;
+    };
+
+    std::vector<uint32_t> found;
+    for (size_t i = 0; i < hashes_.size(); ++i) {
+        Candidates(hashes_[i], radius, found);
+        for (uint32_t j : found) {
+            uint32_t a = find(static_cast<uint32_t>(i)), b = find(j);
+            if (a != b)
+                parent[std::max(a, b)] = std::min(a, b);
+        }
+    }
+
+    std::vector<std::vector<size_t>> clusters;
+    std::vector<size_t> cluster_of(hashes_.size(), SIZE_MAX);
+    for (size_t i = 0; i < hashes_.size(); ++i) {
+        size_t &cluster = cluster_of[find(static_cast<uint32_t>(i))];
+        if (cluster == SIZE_MAX) {
+            cluster = clusters.size();
+            clusters.emplace_back();
+        }
+        clusters[cluster].insert(clusters[cluster].end(), ids_.begin() + offsets_[i], ids_.begin() + offsets_[i + 1]);
+    }
+
+    std::stable_sort(clusters.begin(), clusters.end(), [](const std::vector<size_t> &a,
+                                                          const std::vector<size_t> &b) {
+        return a.size() > b.size();
+    });
+    return clusters;
+}
+
+size_t SimilarityIndex::Size() const {
+    return entries_.size();
+}
+
+size_t SimilarityIndex::DistinctHashes() const {
+    return hashes_.size();
+}
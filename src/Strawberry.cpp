@@ -22,8 +22,8 @@ const void Strawberry::DataStructure::UpdatePathPrefix(std::string path_prefix,
     parent_ += boost::filesystem::path(data_set_name_ + "/" + serial_number_ + "/");
 }
 
-const void Strawberry::DataStructure::UpdateFolderPaths(bool stop_at_folder_depth) {
-    UpdateTimestamp();
+const void Strawberry::DataStructure::UpdateFolderPaths(bool stop_at_folder_depth, double timestamp_ms) {
+    UpdateTimestamp(timestamp_ms);
 
     folder_ = boost::filesystem::path(parent_.string() + date_ + "/");
     sub_folder_ = boost::filesystem::path(folder_.string() + time_ + "/");
@@ -38,14 +38,17 @@ const void Strawberry::DataStructure::UpdateFolderPaths(bool stop_at_folder_dept
     }
 }
 
-const std::string Strawberry::DataStructure::FilePath(RsType file_type, bool meta) {
+const std::string Strawberry::DataStructure::FilePath(RsType file_type, bool meta, const std::string &suffix) {
     auto i = static_cast<int>(file_type);
-    return sub_folder_.string() + file_names_[i] + ext_[meta ? 2 : file_type == RsType::POINT_CLOUD ? 1 : 0];
+    return sub_folder_.string() + file_names_[i] + suffix + ext_[meta ? 2 : file_type == RsType::POINT_CLOUD ? 1 :
+                                                        file_type == RsType::RECORDING ? 3 : 0];
 }
 
-const void Strawberry::DataStructure::UpdateTimestamp() {
+const void Strawberry::DataStructure::UpdateTimestamp(double timestamp_ms) {
     std::chrono::high_resolution_clock::time_point p = std::chrono::high_resolution_clock::now();
-    std::chrono::milliseconds ms = std::chrono::duration_cast<std::chrono::milliseconds>(p.time_since_epoch());
+    std::chrono::milliseconds ms = timestamp_ms >= 0 ?
+                                   std::chrono::milliseconds(static_cast<long long>(timestamp_ms)) :
+                                   std::chrono::duration_cast<std::chrono::milliseconds>(p.time_since_epoch());
     std::time_t t = std::chrono::duration_cast<std::chrono::seconds>(ms).count();
 
     std::stringstream date, time;
@@ -55,21 +58,24 @@ const void Strawberry::DataStructure::UpdateTimestamp() {
     time_ = time.str();
 }
 
-const void Strawberry::DataStructure::SetFileConstructionNames(ConfigManager *config) {
-    if(config == nullptr)
-        config = ConfigManager::GetInstance();
-    nlohmann::json file_names = config->Get("file-names");
-
-    video_frame_ext = file_names["video_frame_ext"];
-    point_cloud_ext = file_names["point_cloud_ext"];
-    metadata_ext = file_names["metadata_ext"];
-    depth_ = file_names["depth"];
-    coloured_depth_ = file_names["coloured_depth"];
-    colour_ = file_names["colour"];
-    ir = file_names["ir"];
-    ir_left_ = file_names["ir_left"];
-    ir_right_ = file_names["ir_right"];
-    point_cloud_ = file_names["point_cloud"];
+const void Strawberry::DataStructure::SetFileConstructionNames() {
+    SetFileConstructionNames(CaptureSettings::Current()->Defaults().file_names);
+}
+
+const void Strawberry::DataStructure::SetFileConstructionNames(const FileNameSettings &file_names) {
+    video_frame_ext = file_names.video_frame_ext;
+    point_cloud_ext = file_names.point_cloud_ext;
+    metadata_ext = file_names.metadata_ext;
+    recording_ext = file_names.recording_ext;
+    depth_ = file_names.depth;
+    coloured_depth_ = file_names.coloured_depth;
+    colour_ = file_names.colour;
+    ir = file_names.ir;
+    ir_left_ = file_names.ir_left;
+    ir_right_ = file_names.ir_right;
+    point_cloud_ = file_names.point_cloud;
+    capture_ = file_names.capture;
+    recording_ = file_names.recording;
 
     file_names_[0] = depth_;
     file_names_[1] = coloured_depth_;
@@ -78,8 +84,11 @@ const void Strawberry::DataStructure::SetFileConstructionNames(ConfigManager *co
     file_names_[4] = ir_left_;
     file_names_[5] = ir_right_;
     file_names_[6] = point_cloud_;
+    file_names_[7] = capture_;
+    file_names_[8] = recording_;
 
     ext_[0] = video_frame_ext;
     ext_[1] = point_cloud_ext;
     ext_[2] = metadata_ext;
+    ext_[3] = recording_ext;
 }
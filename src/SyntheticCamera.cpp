@@ -0,0 +1,194 @@
+#include <cmath>
+#include <cstring>
+#include <thread>
+
+#include "SyntheticCamera.hpp"
+
+namespace {
+    // Pinhole intrinsics with a D400 like field of view
+    rs2_intrinsics Intrinsics(int width, int height) {
+        rs2_intrinsics intrinsics{};
+        intrinsics.width = width;
+        intrinsics.height = height;
+        intrinsics.ppx = width / 2.0f;
+        intrinsics.ppy = height / 2.0f;
+        intrinsics.fx = intrinsics.fy = width * 0.9f;
+        intrinsics.model = RS2_DISTORTION_BROWN_CONRADY;
+        return intrinsics;
+    }
+
+    // Cheap deterministic noise for the IR speckle and depth holes
+    uint32_t Hash(uint32_t x, uint32_t y) {
+        uint32_t h = x * 374761393u + y * 668265263u;
+        h = (h ^ (h >> 13)) * 1274126177u;
+        return h ^ (h >> 16);
+    }
+
+    const double kPi = 3.14159265358979323846;
+    const int kScrollPixels = 8, kDisparityPixels = 16;
+}
+
+SyntheticDevice::SyntheticDevice(const std::string &serial_number, int width, int height, int colour_width,
+                                 int colour_height, int fps) : software_depth_(software_device_.add_sensor("Stereo Module")),
+                                                               software_colour_(software_device_.add_sensor("RGB Camera")),
+                                                               width_(width), height_(height),
+                                                               colour_width_(colour_width),
+                                                               colour_height_(colour_height), fps_(fps) {
+    software_device_.register_info(RS2_CAMERA_INFO_NAME, "Synthetic D400");
+    software_device_.register_info(RS2_CAMERA_INFO_SERIAL_NUMBER, serial_number);
+
+    // Depth units make the software sensor a depth sensor (and give it a depth scale)
+    software_depth_.add_read_only_option(RS2_OPTION_DEPTH_UNITS, 0.001f);
+
+    depth_profile_ = software_depth_.add_video_stream({RS2_STREAM_DEPTH, 0, 0, width, height, fps, 2, RS2_FORMAT_Z16,
+                                                      Intrinsics(width, height)});
+    lir_profile_ = software_depth_.add_video_stream({RS2_STREAM_INFRARED, 1, 1, width, height, fps, 1, RS2_FORMAT_Y8,
+                                                    Intrinsics(width, height)});
+    rir_profile_ = software_depth_.add_video_stream({RS2_STREAM_INFRARED, 2, 2, width, height, fps, 1, RS2_FORMAT_Y8,
+                                                    Intrinsics(width, height)});
+    colour_profile_ = software_colour_.add_video_stream({RS2_STREAM_COLOR, 0, 3, colour_width, colour_height, fps, 3,
+                                                        RS2_FORMAT_BGR8, Intrinsics(colour_width, colour_height)});
+
+    // All streams share one optical centre, the point cloud only needs depth to colour
+    rs2_extrinsics identity = {{1, 0, 0, 0, 1, 0, 0, 0, 1}, {0, 0, 0}};
+    depth_profile_.register_extrinsics_to(colour_profile_, identity);
+    depth_profile_.register_extrinsics_to(lir_profile_, identity);
+    depth_profile_.register_extrinsics_to(rir_profile_, identity);
+
+    // Emit a frame set once depth, both IR and colour frames with the same timestamp arrive
+    software_device_.create_matcher(RS2_MATCHER_DLR_C);
+}
+
+SyntheticCamera::SyntheticCamera(const std::string &serial_number, int width, int height, int colour_width,
+                                 int colour_height, int fps) :
+        SyntheticDevice(serial_number, width, height, colour_width, colour_height, fps),
+        RealSenseD400(software_device_, serial_number) {
+    std::cout << "Camera " << serial_number_ << ": Generating " << width_ << "x" << height_ << " depth/IR and "
+              << colour_width_ << "x" << colour_height_ << " colour at " << fps_ << "fps" << std::endl;
+
+    GeneratePatterns();
+
+    software_depth_.open({depth_profile_, lir_profile_, rir_profile_});
+    software_colour_.open({colour_profile_});
+    software_depth_.start(sync_);
+    software_colour_.start(sync_);
+    streaming_ = true;
+
+    SetFramePeriods(fps_, fps_);
+    next_frame_ = std::chrono::steady_clock::now();
+    StartupStage("pipeline");
+
+    Open();
+}
+
+SyntheticCamera::~SyntheticCamera() {
+    if (streaming_) {
+        software_depth_.stop();
+        software_colour_.stop();
+        software_depth_.close();
+        software_colour_.close();
+    }
+}
+
+void SyntheticCamera::GeneratePatterns() {
+    // Patterns repeat every frame width so scrolling through them wraps seamlessly
+    int pattern_width = width_ * 2, colour_pattern_width = colour_width_ * 2;
+    depth_pattern_.resize(static_cast<size_t>(pattern_width) * height_);
+    ir_pattern_.resize(static_cast<size_t>(pattern_width) * height_);
+    colour_pattern_.resize(static_cast<size_t>(colour_pattern_width) * colour_height_ * 3);
+
+    for (int y = 0; y < height_; ++y) {
+        for (int x = 0; x < pattern_width; ++x) {
+            int px = x % width_;
+            double u = static_cast<double>(px) / width_, v = static_cast<double>(y) / height_;
+            size_t i = static_cast<size_t>(y) * pattern_width + x;
+
+            // Sloped ground plane with rolling hills (mm) and sparse holes like a real stereo matcher
+            double depth = 800.0 + 1200.0 * v + 250.0 * std::sin(2 * kPi * 3 * u) * std::cos(2 * kPi * 2 * v);
+            depth_pattern_[i] = Hash(px / 4, y / 4) % 37 == 0 ? 0 : static_cast<uint16_t>(depth);
+
+            // Projected speckle over a soft vignette
+            double vignette = 1.0 - 0.5 * ((u - 0.5) * (u - 0.5) + (v - 0.5) * (v - 0.5));
+            ir_pattern_[i] = static_cast<uint8_t>((Hash(px, y) % 160 + 60) * vignette);
+        }
+    }
+
+    for (int y = 0; y < colour_height_; ++y) {
+        for (int x = 0; x < colour_pattern_width; ++x) {
+            double u = static_cast<double>(x % colour_width_) / colour_width_;
+            double v = static_cast<double>(y) / colour_height_;
+            uint8_t *bgr = &colour_pattern_[(static_cast<size_t>(y) * colour_pattern_width + x) * 3];
+            bgr[0] = static_cast<uint8_t>(127.5 + 127.5 * std::sin(2 * kPi * u));
+            bgr[1] = static_cast<uint8_t>(127.5 + 127.5 * std::sin(2 * kPi * (u + v)));
+            bgr[2] = static_cast<uint8_t>(127.5 + 127.5 * std::cos(2 * kPi * (2 * u - v)));
+        }
+    }
+}
+
+void SyntheticCamera::PushFrame(rs2::software_sensor &sensor, const rs2::stream_profile &profile,
+                                const uint8_t *pattern, int width, int height, int bpp, double timestamp) {
+    size_t stride = static_cast<size_t>(width) * bpp, pattern_stride = stride * 2;
+    auto *pixels = new uint8_t[stride * height];
+    for (int y = 0; y < height; ++y)
+        std::memcpy(pixels + y * stride, pattern + y * pattern_stride, stride);
+
+    rs2_software_video_frame frame{};
+    frame.pixels = pixels;
+    frame.deleter = [](void *p) { delete[] static_cast<uint8_t *>(p); };
+    frame.stride = static_cast<int>(stride);
+    frame.bpp = bpp;
+    frame.timestamp = timestamp;
+    frame.domain = RS2_TIMESTAMP_DOMAIN_SYSTEM_TIME;
+    frame.frame_number = static_cast<int>(frame_number_);
+    frame.profile = profile.get();
+    sensor.on_video_frame(frame);
+}
+
+rs2::frameset SyntheticCamera::NextFrameset() {
+    // Pace frames like a sensor, frames that were due while nobody was reading are dropped as a camera would
+    auto period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double, std::milli>(frame_period_));
+    auto now = std::chrono::steady_clock::now();
+    if (now < next_frame_) {
+        std::this_thread::sleep_until(next_frame_);
+    } else if (now - next_frame_ >= period) {
+        long long missed = (now - next_frame_) / period;
+        frame_number_ += missed;
+        next_frame_ += missed * period;
+    }
+    next_frame_ += period;
+    frame_number_++;
+
+    double timestamp = std::chrono::duration<double, std::milli>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+    int offset = static_cast<int>((frame_number_ * kScrollPixels) % width_);
+    int right_offset = (offset + kDisparityPixels) % width_;
+    int colour_offset = static_cast<int>((frame_number_ * kScrollPixels * colour_width_ / width_) % colour_width_);
+
+    software_depth_.set_metadata(RS2_FRAME_METADATA_FRAME_COUNTER, frame_number_);
+    software_colour_.set_metadata(RS2_FRAME_METADATA_FRAME_COUNTER, frame_number_);
+    PushFrame(software_depth_, depth_profile_, reinterpret_cast<const uint8_t *>(depth_pattern_.data() + offset),
+              width_, height_, 2, timestamp);
+    PushFrame(software_depth_, lir_profile_, ir_pattern_.data() + offset, width_, height_, 1, timestamp);
+    PushFrame(software_depth_, rir_profile_, ir_pattern_.data() + right_offset, width_, height_, 1, timestamp);
+    PushFrame(software_colour_, colour_profile_, colour_pattern_.data() + colour_offset * 3, colour_width_,
+              colour_height_, 3, timestamp);
+
+    return sync_.wait_for_frames();
+}
+
+bool SyntheticCamera::StartRecording() {
+    std::cerr << "Camera " << serial_number_ << ": Synthetic cameras can not be recorded" << std::endl;
+    return false;
+}
+
+bool SyntheticCamera::RestartStreams() {
+    std::cerr << "Camera " << serial_number_ << ": Synthetic streams are set by the virtual camera entry, ignoring new "
+                                               "stream settings" << std::endl;
+    return false;
+}
+
+bool SyntheticCamera::WasRemoved(const rs2::event_information &info) {
+    // Software devices are never unplugged
+    return false;
+}
@@ -16,12 +16,14 @@ ThreadClass::~ThreadClass() {
 const bool ThreadClass::StartThread()
 {
     thread_ = std::thread(std::bind(&ThreadClass::Setup, this));
+    return thread_.joinable();
 }
 
 template<typename _Function_ref, typename _Scope>
 const bool ThreadClass::StartThread(_Function_ref &&__f, _Scope __scope)
 {
     thread_ = std::thread(std::bind(__f, __scope));
+    return thread_.joinable();
 }
 
 const bool ThreadClass::ThreadAlive() {
@@ -0,0 +1,172 @@
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+
+#include <json.hpp>
+
+#include "Tracer.hpp"
+
+std::atomic<bool> Tracer::enabled_(false);
+
+void TraceBuffer::Push(const char *name, const char *arg, uint32_t thread_id, uint64_t start_ns, uint64_t end_ns) {
+    uint64_t index = head_.load(std::memory_order_relaxed);
+    TraceEvent &event = events_[index & (kCapacity - 1)];
+
+    // Mark the slot as being written before touching the payload so a concurrent flush skips it
+    event.sequence.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    event.name = name;
+    std::strncpy(event.arg, arg, sizeof(event.arg) - 1);
+    event.arg[sizeof(event.arg) - 1] = '\0';
+    event.thread_id = thread_id;
+    event.start_ns = start_ns;
+    event.duration_ns = end_ns - start_ns;
+
+    event.sequence.store(index + 1, std::memory_order_release);
+    head_.store(index + 1, std::memory_order_release);
+}
+
+template<typename F>
+void TraceBuffer::ForEach(F &&f) const {
+    uint64_t head = head_.load(std::memory_order_acquire);
+    uint64_t first = head > kCapacity ? head - kCapacity : 0;
+
+    for (uint64_t index = first; index < head; ++index) {
+        const TraceEvent &event = events_[index & (kCapacity - 1)];
+        uint64_t before = event.sequence.load(std::memory_order_acquire);
+        if (before != index + 1)
+            continue;
+
+        TraceEvent copy;
+        copy.name = event.name;
+        std::memcpy(copy.arg, event.arg, sizeof(copy.arg));
+        copy.thread_id = event.thread_id;
+        copy.start_ns = event.start_ns;
+        copy.duration_ns = event.duration_ns;
+
+        // Discard the copy if the writer lapped us while reading
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (event.sequence.load(std::memory_order_relaxed) == before)
+            f(copy);
+    }
+}
+
+// Buffers are recycled with their thread id when threads exit (the per save writer threads are short lived), so ids
+// and thread names stay bounded by the most threads alive at once. Events are kept
+struct Tracer::ThreadState {
+    TraceBuffer *buffer = nullptr;
+    uint32_t thread_id = 0;
+    ~ThreadState() {
+        if (buffer != nullptr)
+            Tracer::GetInstance()->ReleaseBuffer(buffer, thread_id);
+    }
+};
+
+Tracer *Tracer::GetInstance() {
+    // Intentionally leaked so exiting threads can still return their buffers during shutdown
+    static Tracer *self = new Tracer();
+    return self;
+}
+
+void Tracer::SetEnabled(bool enabled) {
+    enabled_.store(enabled, std::memory_order_relaxed);
+}
+
+uint64_t Tracer::Now() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+Tracer::ThreadState &Tracer::Local() {
+    thread_local ThreadState state;
+    if (state.buffer == nullptr)
+        state.buffer = GetInstance()->AcquireBuffer(state.thread_id);
+    return state;
+}
+
+void Tracer::SetThreadName(const std::string &name) {
+    if (!Enabled())
+        return;
+
+    uint32_t thread_id = Local().thread_id;
+    std::lock_guard<std::mutex> lock(GetInstance()->lock_);
+    GetInstance()->thread_names_[thread_id] = name;
+}
+
+TraceBuffer *Tracer::AcquireBuffer(uint32_t &thread_id) {
+    std::lock_guard<std::mutex> lock(lock_);
+
+    // The previous thread's name is dropped, a new thread that sets none would otherwise be shown as it
+    if (!free_buffers_.empty()) {
+        TraceBuffer *buffer = free_buffers_.back().first;
+        thread_id = free_buffers_.back().second;
+        free_buffers_.pop_back();
+        thread_names_.erase(thread_id);
+        return buffer;
+    }
+
+    thread_id = next_thread_id_++;
+    buffers_.emplace_back(new TraceBuffer());
+    return buffers_.back().get();
+}
+
+void Tracer::ReleaseBuffer(TraceBuffer *buffer, uint32_t thread_id) {
+    std::lock_guard<std::mutex> lock(lock_);
+    free_buffers_.emplace_back(buffer, thread_id);
+}
+
+void Tracer::Record(const char *name, const char *arg, uint64_t start_ns, uint64_t end_ns) {
+    ThreadState &state = Local();
+    state.buffer->Push(name, arg, state.thread_id, start_ns, end_ns);
+}
+
+bool Tracer::Flush(const std::string &file_name) {
+    std::ofstream out(file_name);
+    if (!out.is_open()) {
+        std::cerr << "Tracer: Could not open " << file_name << std::endl;
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(lock_);
+    size_t count = 0;
+
+    // Chrome trace event format, complete ("X") events with microsecond timestamps
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    out << std::fixed << std::setprecision(3);
+    for (auto &thread : thread_names_) {
+        out << (count++ ? ",\n" : "") << "{\"ph\":\"M\",\"pid\":1,\"tid\":" << thread.first
+            << ",\"name\":\"thread_name\",\"args\":{\"name\":" << nlohmann::json(thread.second).dump() << "}}";
+    }
+
+    for (auto &buffer : buffers_) {
+        buffer->ForEach([&](const TraceEvent &event) {
+            out << (count++ ? ",\n" : "") << "{\"ph\":\"X\",\"cat\":\"grabber\",\"pid\":1,\"tid\":" << event.thread_id
+                << ",\"name\":\"" << event.name << "\",\"ts\":" << event.start_ns / 1e3 << ",\"dur\":"
+                << event.duration_ns / 1e3;
+            if (event.arg[0] != '\0')
+                out << ",\"args\":{\"camera\":" << nlohmann::json(std::string(event.arg)).dump() << "}";
+            out << "}";
+        });
+    }
+    out << "\n]}\n";
+
+    std::cout << "Tracer: Wrote " << count << " events to " << file_name << std::endl;
+    return out.good();
+}
+
+TraceScope::TraceScope(const char *name, const std::string &arg) : name_(name) {
+    if (!Tracer::Enabled())
+        return;
+
+    std::strncpy(arg_, arg.c_str(), sizeof(arg_) - 1);
+    arg_[sizeof(arg_) - 1] = '\0';
+    start_ = Tracer::Now();
+}
+
+TraceScope::~TraceScope() {
+    if (start_ != 0)
+        Tracer::GetInstance()->Record(name_, arg_, start_, Tracer::Now());
+}
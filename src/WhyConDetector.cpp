@@ -0,0 +1,223 @@
+#include <algorithm>
+#include <cmath>
+
+#include "WhyConDetector.hpp"
+#include "ImageKernels.hpp"
+
+void WhyConDetector::Region::Add(const Region &other) {
+    area += other.area;
+    sx += other.sx;
+    sy += other.sy;
+    sxx += other.sxx;
+    syy += other.syy;
+    sxy += other.sxy;
+    min_x = std::min(min_x, other.min_x);
+    min_y = std::min(min_y, other.min_y);
+    max_x = std::max(max_x, other.max_x);
+    max_y = std::max(max_y, other.max_y);
+}
+
+WhyConDetector::WhyConDetector(int id_bits, int min_diameter) : id_bits_(std::max(0, std::min(id_bits, 30))),
+                                                                min_diameter_(std::max(4, min_diameter)) {}
+
+uint32_t WhyConDetector::Find(uint32_t label) {
+    while (parent_[label] != label)
+        label = parent_[label] = parent_[parent_[label]];
+    return label;
+}
+
+void WhyConDetector::Label(int width, int height) {
+    runs_.clear();
+    parent_.clear();
+
+    // Every row is split into alternating dark and light runs, a run joins the runs of the same kind it touches in
+    // the row above (4 connected). Both rows partition the width, so walking them by run end visits exactly the
+    // overlapping pairs
+    size_t previous_begin = 0, previous_end = 0;
+    for (int y = 0; y < height; ++y) {
+        const uint8_t *row = mask_.data() + static_cast<size_t>(y) * width;
+        size_t begin = runs_.size();
+        for (int x = 0; x < width;) {
+            int start = x;
+            uint8_t value = row[x];
+            while (x < width && row[x] == value)
+                ++x;
+            auto label = static_cast<uint32_t>(parent_.size());
+            parent_.push_back(label);
+            runs_.push_back({y, start, x - 1, label, value != 0});
+        }
+
+        for (size_t i = previous_begin, j = begin; i < previous_end && j < runs_.size();) {
+            const Run &above = runs_[i], &run = runs_[j];
+            if (above.dark == run.dark) {
+                uint32_t a = Find(above.label), b = Find(run.label);
+                if (a != b)
+                    parent_[std::max(a, b)] = std::min(a, b);
+            }
+            if (above.end < run.end)
+                ++i;
+            else if (above.end > run.end)
+                ++j;
+            else
+                ++i, ++j;
+        }
+        previous_begin = begin;
+        previous_end = runs_.size();
+    }
+
+    // Moments per region, sums of x and x^2 over a run are closed form
+    regions_.clear();
+    region_of_.assign(parent_.size(), -1);
+    auto sum_squares = [](double n) { return n * (n + 1) * (2 * n + 1) / 6; };
+    for (const Run &run : runs_) {
+        uint32_t root = Find(run.label);
+        if (region_of_[root] < 0) {
+            region_of_[root] = static_cast<int32_t>(regions_.size());
+            Region region;
+            region.min_x = run.start;
+            region.max_x = run.end;
+            region.min_y = region.max_y = run.y;
+            region.dark = run.dark;
+            regions_.push_back(region);
+        }
+
+        Region part;
+        double n = run.end - run.start + 1, x_sum = n * (run.start + run.end) / 2.0;
+        part.area = n;
+        part.sx = x_sum;
+        part.sy = n * run.y;
+        part.sxx = sum_squares(run.end) - (run.start > 0 ? sum_squares(run.start - 1) : 0);
+        part.syy = n * run.y * static_cast<double>(run.y);
+        part.sxy = x_sum * run.y;
+        part.min_x = run.start;
+        part.max_x = run.end;
+        part.min_y = part.max_y = run.y;
+        regions_[region_of_[root]].Add(part);
+    }
+}
+
+std::vector<WhyConMarker> WhyConDetector::Detect(const uint8_t *image, int width, int height, int stride) {
+    std::vector<WhyConMarker> markers;
+    if (width < min_diameter_ || height < min_diameter_)
+        return markers;
+
+    // Otsu threshold from a 4x decimated histogram
+    const int step = 4;
+    thumbnail_.resize(static_cast<size_t>(width / step) * (height / step));
+    ImageKernels::Decimate(image, width, height, stride, 1, 0, step, thumbnail_.data());
+    uint32_t histogram[256];
+    ImageKernels::Histogram(thumbnail_.data(), thumbnail_.size(), histogram);
+
+    double total = 0, sum = 0;
+    for (int level = 0; level < 256; ++level) {
+        total += histogram[level];
+        sum += static_cast<double>(level) * histogram[level];
+    }
+    double below = 0, below_sum = 0, best = -1;
+    int level = 128;
+    for (int t = 0; t < 256; ++t) {
+        below += histogram[t];
+        below_sum += static_cast<double>(t) * histogram[t];
+        if (below == 0 || below == total)
+            continue;
+        double difference = below_sum / below - (sum - below_sum) / (total - below);
+        double between = below * (total - below) * difference * difference;
+        if (between > best) {
+            best = between;
+            level = t + 1;
+        }
+    }
+
+    mask_.resize(static_cast<size_t>(width) * height);
+    ImageKernels::Threshold(image, width, height, stride, static_cast<uint8_t>(std::min(level, 255)), mask_.data());
+    Label(width, height);
+
+    // Rings and the light discs that could sit inside them
+    std::vector<const Region *> rings, discs;
+    for (const Region &region : regions_) {
+        int region_width = region.max_x - region.min_x + 1, region_height = region.max_y - region.min_y + 1;
+        bool border = region.min_x == 0 || region.min_y == 0 || region.max_x == width - 1 ||
+                      region.max_y == height - 1;
+        if (border)
+            continue;
+        if (region.dark && std::max(region_width, region_height) >= min_diameter_)
+            rings.push_back(&region);
+        else if (!region.dark && std::max(region_width, region_height) >= min_diameter_ / 4)
+            discs.push_back(&region);
+    }
+
+    for (const Region *ring : rings) {
+        double ring_x = ring->sx / ring->area, ring_y = ring->sy / ring->area;
+        double size = std::max(ring->max_x - ring->min_x, ring->max_y - ring->min_y) + 1;
+
+        // The largest light region inside the ring's box and centred with it
+        const Region *disc = nullptr;
+        for (const Region *candidate : discs) {
+            if (candidate->min_x <= ring->min_x || candidate->max_x >= ring->max_x ||
+                candidate->min_y <= ring->min_y || candidate->max_y >= ring->max_y)
+                continue;
+            double dx = candidate->sx / candidate->area - ring_x, dy = candidate->sy / candidate->area - ring_y;
+            if (std::hypot(dx, dy) < 0.1 * size && (disc == nullptr || candidate->area > disc->area))
+                disc = candidate;
+        }
+        if (disc == nullptr)
+            continue;
+
+        // A ring from half to the full radius R has variance (R^2 + (R / 2)^2) / 4 = 1.25 R^2 / 4 along each axis of
+        // its ellipse, the code band inside does not change it
+        double x = ring_x, y = ring_y;
+        double var_x = ring->sxx / ring->area - x * x, var_y = ring->syy / ring->area - y * y;
+        double covariance = ring->sxy / ring->area - x * y;
+        double half_trace = (var_x + var_y) / 2;
+        double spread = std::sqrt((var_x - var_y) * (var_x - var_y) / 4 + covariance * covariance);
+        if (half_trace - spread <= 0)
+            continue;
+        double major = 2 * std::sqrt((half_trace + spread) / 1.25), minor = 2 * std::sqrt((half_trace - spread) / 1.25);
+        double angle = 0.5 * std::atan2(2 * covariance, var_x - var_y);
+
+        // Ring and disc areas against the ellipse, the disc loses up to half its area to the code band
+        double ellipse = M_PI * major * minor;
+        double fill = ring->area / (0.75 * ellipse), disc_ratio = disc->area / ellipse;
+        if (fill < 0.75 || fill > 1.25 || disc_ratio < 0.06 || disc_ratio > 0.3)
+            continue;
+
+        WhyConMarker found;
+        found.x = static_cast<float>(x);
+        found.y = static_cast<float>(y);
+        found.diameter = static_cast<float>(2 * major);
+        found.id = Decode(image, width, height, stride, x, y, major, minor, angle,
+                          static_cast<uint8_t>(std::min(level, 255)));
+        markers.push_back(found);
+    }
+    return markers;
+}
+
+int WhyConDetector::Decode(const uint8_t *image, int width, int height, int stride, double x, double y,
+                           double major, double minor, double angle, uint8_t level) {
+    if (id_bits_ == 0)
+        return 0;
+
+    // The code band is centred at 0.3 of the outer radius, every bit is the majority of three samples
+    const double band = 0.3;
+    uint32_t code = 0;
+    for (int bit = 0; bit < id_bits_; ++bit) {
+        int dark = 0;
+        for (int sample = 1; sample <= 3; ++sample) {
+            double theta = 2 * M_PI * (bit + sample / 4.0) / id_bits_;
+            double u = band * major * std::cos(theta), v = band * minor * std::sin(theta);
+            int px = static_cast<int>(std::lround(x + u * std::cos(angle) - v * std::sin(angle)));
+            int py = static_cast<int>(std::lround(y + u * std::sin(angle) + v * std::cos(angle)));
+            if (px >= 0 && py >= 0 && px < width && py < height && image[static_cast<size_t>(py) * stride + px] < level)
+                dark++;
+        }
+        code = (code << 1) | (dark >= 2 ? 1u : 0u);
+    }
+
+    // Smallest rotation, the marker's orientation must not change its id
+    uint32_t mask = (1u << id_bits_) - 1, smallest = code;
+    for (int rotation = 1; rotation < id_bits_; ++rotation) {
+        code = ((code << 1) | (code >> (id_bits_ - 1))) & mask;
+        smallest = std::min(smallest, code);
+    }
+    return static_cast<int>(smallest);
+}
@@ -0,0 +1,89 @@
+#include <algorithm>
+#include <iostream>
+
+#include "WorkerPool.hpp"
+#include "Tracer.hpp"
+
+WorkerPool::WorkerPool(unsigned int threads, size_t max_queue, const std::string &name) : max_queue_(max_queue),
+                                                                                          name_(name) {
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+
+    for (unsigned int i = 0; i < threads; ++i)
+        threads_.emplace_back(&WorkerPool::Run, this, i);
+}
+
+WorkerPool::~WorkerPool() {
+    // Finish everything already queued before the workers exit
+    Wait();
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        stop_ = true;
+    }
+    task_ready_.notify_all();
+    for (auto &thread : threads_)
+        thread.join();
+}
+
+void WorkerPool::Submit(std::function<void()> task) {
+    std::unique_lock<std::mutex> lock(lock_);
+    task_taken_.wait(lock, [this]() { return max_queue_ == 0 || tasks_.size() < max_queue_; });
+    tasks_.push_back(std::move(task));
+    lock.unlock();
+    task_ready_.notify_one();
+}
+
+bool WorkerPool::TrySubmit(std::function<void()> task) {
+    std::unique_lock<std::mutex> lock(lock_);
+    if (max_queue_ != 0 && tasks_.size() >= max_queue_)
+        return false;
+    tasks_.push_back(std::move(task));
+    lock.unlock();
+    task_ready_.notify_one();
+    return true;
+}
+
+void WorkerPool::Wait() {
+    std::unique_lock<std::mutex> lock(lock_);
+    idle_.wait(lock, [this]() { return tasks_.empty() && active_ == 0; });
+}
+
+size_t WorkerPool::Pending() {
+    std::lock_guard<std::mutex> lock(lock_);
+    return tasks_.size() + active_;
+}
+
+unsigned int WorkerPool::Size() const {
+    return static_cast<unsigned int>(threads_.size());
+}
+
+void WorkerPool::Run(unsigned int index) {
+    Tracer::SetThreadName(name_ + " " + std::to_string(index));
+
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(lock_);
+            task_ready_.wait(lock, [this]() { return stop_ || !tasks_.empty(); });
+            if (stop_ && tasks_.empty())
+                return;
+            task = std::move(tasks_.front());
+            tasks_.pop_front();
+            active_++;
+        }
+        task_taken_.notify_one();
+
+        try {
+            task();
+        } catch (const std::exception &e) {
+            std::cerr << "WorkerPool: " << e.what() << std::endl;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(lock_);
+            active_--;
+            if (tasks_.empty() && active_ == 0)
+                idle_.notify_all();
+        }
+    }
+}
@@ -0,0 +1,236 @@
+#include <string>
+#include <algorithm>
+#include <atomic>
+
+#include <opencv2/opencv.hpp>
+#include <librealsense2/rs.hpp>
+#include <json.hpp>
+
+#include <Strawberry.hpp>
+#include <RealSenseD400.hpp>
+#include <ConfigManager.hpp>
+#include <Settings.hpp>
+#include <Tracer.hpp>
+#include <WorkerPool.hpp>
+
+/// Usage:
+///     Converts .bag recordings into the standard dataset layout (rgb_8UC3.png, depth_16UC1.png, ...)
+///             ./bag_converter --decimate 5 --start 10 --end 70 a.bag b.bag
+///     Frames are decoded as fast as playback allows and encoded on every core. A frame whose capture_meta.csv
+///     exists is complete (it is written last), so rerunning after an interruption only converts what is missing
+
+void PrintHelp() {
+    std::cout << "Usage: bag_converter [options] <recording.bag>...\nOptions (--name value):" <<
+              "\n\t--config <path> (Config file for file names and defaults, default ../config.json)" <<
+              "\n\t--save-path <dir> (Dataset root, default save-path-prefix)" <<
+              "\n\t--project <name> (Dataset name, default project-name)" <<
+              "\n\t--serial <serial> (Camera folder, default the recorded serial number)" <<
+              "\n\t--decimate <n> (Keep every n-th frame set, default 1)" <<
+              "\n\t--start, --end <s> (Seconds from the start of the recording to convert, default all)" <<
+              "\n\t--threads <n> (Encoder threads, default all cores)" <<
+              "\n\t--overwrite <0/1> (Convert frames again even if they are complete)" << std::endl;
+}
+
+struct ConvertOptions {
+    std::string save_path, project_name, serial_number;
+    int decimate = 1;
+    double start_seconds = 0, end_seconds = -1;
+    bool overwrite = false;
+};
+
+struct ConvertStats {
+    std::atomic<uint64_t> written{0}, skipped{0}, failed{0};
+};
+
+// Host time of the capture in ms since epoch, used to name the frame's folder like a live capture would
+double CaptureTimestamp(const rs2::frame &frame, double fallback_ms) {
+    if (frame.supports_frame_metadata(RS2_FRAME_METADATA_TIME_OF_ARRIVAL))
+        return frame.get_frame_metadata(RS2_FRAME_METADATA_TIME_OF_ARRIVAL);
+    if (frame.get_frame_timestamp_domain() != RS2_TIMESTAMP_DOMAIN_HARDWARE_CLOCK)
+        return frame.get_timestamp();
+    return fallback_ms;
+}
+
+void WriteFrameset(const rs2::frameset &frames, Strawberry::DataStructure &data_structure, double timestamp_ms,
+                   const std::string &file_name, ConvertStats &stats, bool overwrite) {
+    // Processing blocks keep internal state, give every encoder thread its own
+    thread_local rs2::colorizer color_map;
+    thread_local rs2::pointcloud pc;
+    TraceScope trace("WriteFrameset");
+
+    data_structure.UpdateFolderPaths(false, timestamp_ms);
+    std::string capture_meta = data_structure.FilePath(RsType::CAPTURE, true);
+    if (!overwrite && boost::filesystem::exists(capture_meta)) {
+        stats.skipped++;
+        return;
+    }
+
+    rs2::video_frame depth = frames.get_depth_frame(), colour = frames.get_color_frame();
+    rs2::video_frame lir = frames.get_infrared_frame(1), rir = frames.get_infrared_frame(2);
+    auto write = [&data_structure](RsType type, const rs2::video_frame &frame, int cv_type) {
+        cv::Mat image(cv::Size(frame.get_width(), frame.get_height()), cv_type, (void *) frame.get_data());
+        cv::imwrite(data_structure.FilePath(type), image);
+    };
+
+    if (depth) {
+        write(RsType::DEPTH, depth, CV_16UC1);
+        write(RsType::COLOURED_DEPTH, color_map.process(depth), CV_8UC3);
+        RealSenseD400::WriteVideoFrameMetaData(data_structure.FilePath(RsType::DEPTH, true), depth);
+
+        pc.map_to(depth);
+        rs2::points point_cloud = pc.calculate(depth);
+        point_cloud.export_to_ply(data_structure.FilePath(RsType::POINT_CLOUD), colour ? colour : depth);
+    }
+    if (colour) {
+        write(RsType::COLOUR, colour, CV_8UC3);
+        RealSenseD400::WriteVideoFrameMetaData(data_structure.FilePath(RsType::COLOUR, true), colour);
+    }
+    if (lir) {
+        write(RsType::IR_LEFT, lir, CV_8UC1);
+        RealSenseD400::WriteVideoFrameMetaData(data_structure.FilePath(RsType::IR, true), lir);
+    }
+    if (rir)
+        write(RsType::IR_RIGHT, rir, CV_8UC1);
+
+    // Written last, marks the frame as complete
+    rs2::frame reference = depth ? rs2::frame(depth) : frames[0];
+    std::ofstream csv(capture_meta);
+    csv << "Capture Attribute,Value\n";
+    csv << "Source," << file_name << '\n';
+    csv << "Frame Counter," << (reference.supports_frame_metadata(RS2_FRAME_METADATA_FRAME_COUNTER) ?
+                                reference.get_frame_metadata(RS2_FRAME_METADATA_FRAME_COUNTER) :
+                                static_cast<long long>(reference.get_frame_number())) << '\n';
+    csv << "Frame Timestamp (ms)," << std::fixed << std::setprecision(3) << timestamp_ms << '\n';
+    csv.close();
+
+    if (csv.good())
+        stats.written++;
+    else
+        stats.failed++;
+}
+
+bool ConvertRecording(const std::string &file_name, const ConvertOptions &options, WorkerPool &pool) {
+    std::cout << "Converting " << file_name << std::endl;
+
+    // Decode without real time pacing, the bounded pool queue throttles playback to the encoders
+    rs2::config cfg;
+    cfg.enable_device_from_file(file_name, false);
+    rs2::pipeline pipe;
+    rs2::pipeline_profile profile = pipe.start(cfg);
+    rs2::playback playback = profile.get_device().as<rs2::playback>();
+    playback.set_real_time(false);
+
+    std::string serial_number = options.serial_number.empty() ?
+                                std::string(playback.get_info(RS2_CAMERA_INFO_SERIAL_NUMBER)) : options.serial_number;
+    Strawberry::DataStructure data_structure(serial_number);
+    data_structure.UpdatePathPrefix(options.save_path, options.project_name);
+    data_structure.SetFileConstructionNames();
+
+    // Recordings with only device clock timestamps are placed by the file time, which is when recording stopped
+    double duration_ms = std::chrono::duration<double, std::milli>(playback.get_duration()).count();
+    double recording_start_ms = boost::filesystem::last_write_time(file_name) * 1000.0 - duration_ms;
+
+    if (options.start_seconds > 0)
+        playback.seek(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::duration<double>(options.start_seconds)));
+
+    ConvertStats stats;
+    rs2::frameset frames;
+    unsigned long long last_frame_number = 0;
+    long long index = 0;
+    bool first = true;
+    auto start = std::chrono::steady_clock::now();
+
+    while (pipe.try_wait_for_frames(&frames, 1000)) {
+        double position_ms = playback.get_position() / 1e6;
+        if (options.end_seconds >= 0 && position_ms > options.end_seconds * 1000.0)
+            break;
+
+        // The syncer repeats the slower stream, a new frame set starts with a new depth frame
+        rs2::frame key = frames.get_depth_frame() ? rs2::frame(frames.get_depth_frame()) : frames[0];
+        if (!first && key.get_frame_number() == last_frame_number)
+            continue;
+        first = false;
+        last_frame_number = key.get_frame_number();
+
+        if (index++ % options.decimate != 0)
+            continue;
+
+        // Keep the frames alive outside the pipeline queue until the encoder has finished with them
+        frames.keep();
+        double timestamp_ms = CaptureTimestamp(key, recording_start_ms + position_ms);
+        pool.Submit([frames, data_structure, timestamp_ms, &file_name, &stats, &options]() mutable {
+            WriteFrameset(frames, data_structure, timestamp_ms, file_name, stats, options.overwrite);
+        });
+
+        if (index % (100 * options.decimate) == 0)
+            std::cout << "\t" << stats.written + stats.skipped << " frame sets done, " << pool.Pending()
+                      << " queued, " << std::fixed << std::setprecision(1) << position_ms / 1000.0 << "s of "
+                      << duration_ms / 1000.0 << "s" << std::defaultfloat << std::endl;
+    }
+
+    pipe.stop();
+    pool.Wait();
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "\t" << stats.written << " written, " << stats.skipped << " already complete, " << stats.failed
+              << " failed in " << std::fixed << std::setprecision(1) << seconds << "s ("
+              << stats.written / std::max(seconds, 1e-3) << " frame sets/s)" << std::defaultfloat << std::endl;
+    return stats.failed == 0;
+}
+
+int main(int argc, char *argv[]) try {
+    std::map<std::string, std::string> args = {{"config", "../config.json"}, {"decimate", "1"}, {"start", "0"},
+                                               {"end", "-1"}, {"threads", "0"}, {"overwrite", "0"}};
+    std::vector<std::string> recordings;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg(argv[i]);
+        if (arg == "--help" || arg == "-h") {
+            PrintHelp();
+            return EXIT_SUCCESS;
+        } else if (arg.compare(0, 2, "--") == 0 && i + 1 < argc) {
+            args[arg.substr(2)] = argv[++i];
+        } else {
+            recordings.push_back(arg);
+        }
+    }
+
+    if (recordings.empty()) {
+        PrintHelp();
+        return EXIT_FAILURE;
+    }
+
+    ConfigManager::SetInstance(args["config"]);
+
+    const PathSettings &paths = CaptureSettings::Current()->Defaults().paths;
+
+    ConvertOptions options;
+    options.save_path = args.count("save-path") ? args["save-path"] : paths.save_path_prefix;
+    options.project_name = args.count("project") ? args["project"] : paths.project_name;
+    options.serial_number = args.count("serial") ? args["serial"] : "";
+    options.decimate = std::max(1, std::stoi(args["decimate"]));
+    options.start_seconds = std::stod(args["start"]);
+    options.end_seconds = std::stod(args["end"]);
+    options.overwrite = args["overwrite"] != "0";
+
+    // A few frame sets per thread in flight keeps every core busy without buffering the whole recording
+    unsigned int threads = static_cast<unsigned int>(std::stoi(args["threads"]));
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    WorkerPool pool(threads, threads * 2, "encoder");
+
+    bool success = true;
+    for (auto &recording : recordings)
+        success &= ConvertRecording(recording, options, pool);
+
+    return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+catch (const rs2::error &e) {
+    std::cerr << "RealSense error calling " << e.get_failed_function() << "(" << e.get_failed_args() << "):\n    "
+              << e.what() << std::endl;
+    return EXIT_FAILURE;
+}
+catch (const std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    return EXIT_FAILURE;
+}
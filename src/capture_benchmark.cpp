@@ -0,0 +1,251 @@
+#include <string>
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <librealsense2/rs.hpp>
+#include <json.hpp>
+
+#include <MultiCamD400.hpp>
+#include <ConfigManager.hpp>
+#include <Metrics.hpp>
+
+/// Usage:
+///     End to end capture to disk benchmark driving MultiCamD400 with synthetic cameras, results are written as JSON
+///             ./capture_benchmark --cameras 8 --width 1280 --height 720 --fps 6 --duration 30 --bursts 5
+///     Compare the JSON of two builds to catch regressions in frame rate, save latency or encoder throughput
+
+void PrintHelp() {
+    std::cout << "Options (--name value):\n\t--config <path> (Config file, default ../config.json)" <<
+              "\n\t--cameras <n> (Synthetic cameras, default 4)\n\t--width, --height <px> (Depth/IR resolution)" <<
+              "\n\t--colour-width, --colour-height <px> (Colour resolution)\n\t--fps <hz> (Frame rate)" <<
+              "\n\t--warmup <s> (Seconds before measuring, default 3)\n\t--duration <s> (Measured seconds, default 20)" <<
+              "\n\t--bursts <n> (Save bursts spread over the run, default 5)\n\t--burst-size <n> (Saves per burst, " <<
+              "default 3)\n\t--save-path <dir> (Folder the run's own capture_benchmark-XXXXXX folder is made in, " <<
+              "default the system temporary folder)\n\t--keep <0/1> (Keep the written dataset)" <<
+              "\n\t--output <path> (JSON results, default stdout)" << std::endl;
+}
+
+std::map<std::string, std::string> ParseArguments(int argc, char *argv[]) {
+    std::map<std::string, std::string> args = {
+            {"config", "../config.json"}, {"cameras", "4"}, {"warmup", "3"}, {"duration", "20"}, {"bursts", "5"},
+            {"burst-size", "3"}, {"save-path", ""}, {"keep", "0"}, {"output", ""}
+    };
+
+    for (int i = 1; i < argc; ++i) {
+        std::string key(argv[i]);
+        if (key == "--help" || key == "-h" || key.compare(0, 2, "--") != 0 || i + 1 >= argc) {
+            PrintHelp();
+            std::exit(key == "--help" || key == "-h" ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+        args[key.substr(2)] = argv[++i];
+    }
+    return args;
+}
+
+// A new folder for this run inside root, the only folder the benchmark ever deletes
+std::filesystem::path MakeRunFolder(const std::filesystem::path &root) {
+    std::filesystem::create_directories(root);
+    std::string folder = (root / "capture_benchmark-XXXXXX").string();
+    if (mkdtemp(&folder[0]) == nullptr)
+        throw std::runtime_error("Could not create a run folder in " + root.string());
+    return std::filesystem::canonical(folder);
+}
+
+// Refuses anything but a folder MakeRunFolder made in root, so a wrong --save-path can not take other data with it
+void RemoveRunFolder(const std::filesystem::path &folder, const std::filesystem::path &root) {
+    if (folder.parent_path() != std::filesystem::canonical(root) ||
+        folder.filename().string().compare(0, 18, "capture_benchmark-") != 0) {
+        std::cerr << "Not removing " << folder << ", it is not a benchmark run folder in " << root << std::endl;
+        return;
+    }
+    std::filesystem::remove_all(folder);
+}
+
+double Seconds(const timeval &time) {
+    return time.tv_sec + time.tv_usec / 1e6;
+}
+
+double CpuSeconds() {
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return Seconds(usage.ru_utime) + Seconds(usage.ru_stime);
+}
+
+// Nearest rank percentiles of a sample in milliseconds
+nlohmann::json Summary(std::vector<double> samples) {
+    nlohmann::json summary = {{"count", samples.size()}};
+    if (samples.empty())
+        return summary;
+
+    std::sort(samples.begin(), samples.end());
+    auto percentile = [&samples](double p) {
+        auto rank = static_cast<size_t>(std::ceil(p / 100.0 * samples.size()));
+        return samples[std::max<size_t>(rank, 1) - 1];
+    };
+
+    double sum = 0;
+    for (double sample : samples)
+        sum += sample;
+
+    summary["mean"] = sum / samples.size();
+    summary["p50"] = percentile(50);
+    summary["p90"] = percentile(90);
+    summary["p99"] = percentile(99);
+    summary["max"] = samples.back();
+    return summary;
+}
+
+int main(int argc, char *argv[]) try {
+    std::map<std::string, std::string> args = ParseArguments(argc, argv);
+    ConfigManager::SetInstance(args["config"]);
+    ConfigManager *config = ConfigManager::GetInstance();
+
+    nlohmann::json depth_config = config->Get("stream-depth");
+    nlohmann::json colour_config = config->Get("stream-colour");
+    auto arg = [&args](const std::string &key, int default_value) {
+        return args.count(key) ? std::stoi(args[key]) : default_value;
+    };
+
+    int camera_count = arg("cameras", 4), fps = arg("fps", depth_config["frame-rate"]);
+    int width = arg("width", depth_config["width"]), height = arg("height", depth_config["height"]);
+    int colour_width = arg("colour-width", colour_config["width"]);
+    int colour_height = arg("colour-height", colour_config["height"]);
+    int warmup = arg("warmup", 3), duration = arg("duration", 20);
+    int bursts = arg("bursts", 5), burst_size = arg("burst-size", 3);
+    std::string project_name = "benchmark";
+    std::filesystem::path save_root = args["save-path"].empty() ? std::filesystem::temp_directory_path() :
+                                      std::filesystem::path(args["save-path"]);
+    std::filesystem::path run_folder = MakeRunFolder(save_root), dataset = run_folder / project_name;
+
+    // Headless synthetic cameras writing into a throwaway dataset
+    config->Set("gui-enabled", false);
+    config->Set("stabilise-exposure", false);
+    config->Set("save-path-prefix", run_folder.string() + "/");
+    config->Set("project-name", project_name);
+    config->Set("cameras", nlohmann::json{
+            {"physical", false},
+            {"virtual", nlohmann::json::array({{{"type", "synthetic"}, {"serial", "benchmark"},
+                                                {"count", camera_count}, {"width", width}, {"height", height},
+                                                {"colour-width", colour_width}, {"colour-height", colour_height},
+                                                {"frame-rate", fps}}})}
+    });
+    Metrics::SetEnabled(true);
+
+    std::filesystem::create_directories(dataset);
+    int save_fd = open(dataset.c_str(), O_RDONLY | O_DIRECTORY);
+    if (save_fd < 0)
+        throw std::runtime_error("Could not open " + dataset.string());
+
+    std::cerr << "Starting " << camera_count << " synthetic cameras" << std::endl;
+    MultiCamD400 cameras(std::max(fps * 2, 20));
+    cameras.Available();
+    cameras.Pause(false);
+
+    std::this_thread::sleep_for(std::chrono::seconds(warmup));
+    Metrics::GetInstance()->Reset();
+
+    // Measured window, bursts are spread evenly with the first one half an interval in
+    auto start = std::chrono::steady_clock::now();
+    auto end = start + std::chrono::seconds(duration);
+    double start_cpu = CpuSeconds();
+    std::vector<double> written_ms, durable_ms;
+
+    auto interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(static_cast<double>(duration) / std::max(bursts, 1)));
+    for (int burst = 0; burst < bursts; ++burst) {
+        std::this_thread::sleep_until(start + interval * burst + interval / 2);
+        std::cerr << "Save burst " << burst + 1 << "/" << bursts << std::endl;
+
+        for (int i = 0; i < burst_size; ++i) {
+            // Command to written is what the operator waits for, durable adds flushing the page cache to the disk
+            auto command = std::chrono::steady_clock::now();
+            cameras.SaveFrames();
+            auto written = std::chrono::steady_clock::now();
+            syncfs(save_fd);
+            auto durable = std::chrono::steady_clock::now();
+
+            written_ms.push_back(std::chrono::duration<double, std::milli>(written - command).count());
+            durable_ms.push_back(std::chrono::duration<double, std::milli>(durable - command).count());
+        }
+    }
+    std::this_thread::sleep_until(end);
+
+    double wall_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    double cpu_seconds = CpuSeconds() - start_cpu;
+    cameras.Pause(true);
+    close(save_fd);
+
+    nlohmann::json results;
+    results["parameters"] = {{"cameras", camera_count}, {"width", width}, {"height", height},
+                             {"colour-width", colour_width}, {"colour-height", colour_height}, {"fps", fps},
+                             {"warmup", warmup}, {"duration", duration}, {"bursts", bursts},
+                             {"burst-size", burst_size}, {"save-path", run_folder.string()}};
+
+    // Per camera frame rate over the whole window (saves pause acquisition, so bursts show up here too)
+    std::map<std::string, std::pair<uint64_t, double>> stream_totals;
+    const Stage streams[] = {Stage::WRITE_DEPTH, Stage::WRITE_COLOURED_DEPTH, Stage::WRITE_COLOUR,
+                             Stage::WRITE_IR_LEFT, Stage::WRITE_IR_RIGHT, Stage::EXPORT_PLY};
+    std::map<std::string, std::vector<double>> stream_latency_ms;
+    for (auto &cam : Metrics::GetInstance()->Cameras()) {
+        uint64_t frames = cam->Count(Counter::FRAMES);
+        results["cameras"].push_back({{"serial", cam->GetSerialNumber()}, {"frames", frames},
+                                      {"fps", frames / wall_seconds},
+                                      {"dropped-frames", cam->Count(Counter::DROPPED_FRAMES)},
+                                      {"saves", cam->Count(Counter::SAVES)}});
+
+        for (Stage stage : streams) {
+            auto &total = stream_totals[StageToString(stage)];
+            total.first += cam->Bytes(stage);
+            total.second += cam->Histogram(stage).Sum() / 1e9;
+            stream_latency_ms[StageToString(stage)].push_back(cam->Histogram(stage).Percentile(99) / 1e6);
+        }
+    }
+
+    results["saves"] = {{"written-ms", Summary(written_ms)}, {"durable-ms", Summary(durable_ms)}};
+
+    // Encoder throughput is bytes produced per second spent in the write call (point clouds are not sized)
+    for (auto &stream : stream_totals) {
+        double seconds = stream.second.second;
+        std::vector<double> &latency = stream_latency_ms[stream.first];
+        results["streams"][stream.first] = {
+                {"bytes", stream.second.first}, {"seconds", seconds},
+                {"megabytes-per-second", seconds > 0 ? stream.second.first / 1e6 / seconds : 0.0},
+                {"p99-ms-worst-camera", *std::max_element(latency.begin(), latency.end())}
+        };
+    }
+
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    results["process"] = {{"wall-seconds", wall_seconds}, {"cpu-seconds", cpu_seconds},
+                          {"cpu-cores-used", cpu_seconds / wall_seconds},
+                          {"cpu-utilisation", cpu_seconds / wall_seconds / std::thread::hardware_concurrency()},
+                          {"peak-rss-megabytes", usage.ru_maxrss / 1024.0}};
+
+    if (args["output"].empty()) {
+        std::cout << results.dump(4) << std::endl;
+    } else {
+        std::ofstream out(args["output"]);
+        out << results.dump(4) << std::endl;
+        std::cerr << "Results written to " << args["output"] << std::endl;
+    }
+
+    if (args["keep"] == "0")
+        RemoveRunFolder(run_folder, save_root);
+    else
+        std::cerr << "Dataset kept in " << dataset << std::endl;
+
+    return EXIT_SUCCESS;
+}
+catch (const rs2::error &e) {
+    std::cerr << "RealSense error calling " << e.get_failed_function() << "(" << e.get_failed_args() << "):\n    "
+              << e.what() << std::endl;
+    return EXIT_FAILURE;
+}
+catch (const std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    return EXIT_FAILURE;
+}
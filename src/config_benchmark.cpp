@@ -0,0 +1,177 @@
+#include <string>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <thread>
+
+#include <json.hpp>
+
+#include <ConfigManager.hpp>
+
+/// Usage:
+///     Reader contention on ConfigManager, every reader thread looks up one setting in a loop while an optional
+///     writer publishes new versions
+///             ./config_benchmark --threads 1,2,4,8,16 --duration 1 --write-rate 10 --output config.json
+///     "locked_copy" reproduces the previous Get (IGet's lock, then a deep copy of the subtree under the config lock),
+///     "get_copy" is the current Get and "snapshot" reads through ConfigManager::ISnapshot without copying
+
+void PrintHelp() {
+    std::cout << "Options (--name value):\n\t--config <path> (Config file, default ../config.json)" <<
+              "\n\t--threads <n,n,...> (Reader thread counts, default 1,2,4,8 and the core count)" <<
+              "\n\t--duration <s> (Seconds per run, default 1)" <<
+              "\n\t--write-rate <hz> (New versions published per second while reading, default 0)" <<
+              "\n\t--key <name> (Setting read, default stream-depth)" <<
+              "\n\t--output <path> (JSON results, default stdout)" << std::endl;
+}
+
+// The mutex and copy on every read ConfigManager used before snapshots
+class LockedConfig {
+public:
+    explicit LockedConfig(nlohmann::json config) : config_(std::move(config)) {}
+    nlohmann::json Get(const std::string &key) {
+        std::lock_guard<std::mutex> instance(instance_lock_);
+        std::lock_guard<std::mutex> lock(lock_);
+        return config_[key];
+    }
+    void Set(const std::string &key, nlohmann::json value) {
+        std::lock_guard<std::mutex> lock(lock_);
+        config_[key] = std::move(value);
+    }
+private:
+    std::mutex instance_lock_, lock_;
+    nlohmann::json config_;
+};
+
+struct Run {
+    double reads_per_second, ns_per_read;
+    uint64_t writes;
+};
+
+// Every reader runs read() until stopped, the writer publishes at write_rate Hz in the meantime
+Run Measure(int threads, double duration, int write_rate, const std::function<int()> &read,
+            const std::function<void(uint64_t)> &write) {
+    std::atomic<bool> start{false}, stop{false};
+    std::atomic<uint64_t> reads{0};
+    std::atomic<int> checksum{0};
+    std::vector<std::thread> readers;
+    for (int t = 0; t < threads; ++t)
+        readers.emplace_back([&]() {
+            while (!start)
+                std::this_thread::yield();
+            uint64_t count = 0;
+            int sum = 0;
+            while (!stop.load(std::memory_order_relaxed)) {
+                for (int i = 0; i < 64; ++i)
+                    sum += read();
+                count += 64;
+            }
+            reads += count;
+            checksum += sum;
+        });
+
+    uint64_t writes = 0;
+    using clock = std::chrono::steady_clock;
+    auto seconds_to_ticks = [](double seconds) {
+        return std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(seconds));
+    };
+    clock::time_point begin = clock::now(), end = begin + seconds_to_ticks(duration);
+    start = true;
+    if (write_rate > 0) {
+        clock::duration period = seconds_to_ticks(1.0 / write_rate);
+        for (clock::time_point next = begin + period; next < end; next += period) {
+            std::this_thread::sleep_until(next);
+            write(++writes);
+        }
+    }
+    std::this_thread::sleep_until(end);
+    stop = true;
+    for (auto &reader : readers)
+        reader.join();
+
+    double seconds = std::chrono::duration<double>(clock::now() - begin).count();
+    return {reads / seconds, seconds * threads * 1e9 / std::max<uint64_t>(reads, 1), writes};
+}
+
+int main(int argc, char *argv[]) try {
+    std::map<std::string, std::string> args = {{"config", "../config.json"}, {"duration", "1"}, {"write-rate", "0"},
+                                               {"key", "stream-depth"}, {"output", ""}};
+    for (int i = 1; i < argc; ++i) {
+        std::string key(argv[i]);
+        if (key == "--help" || key == "-h" || key.compare(0, 2, "--") != 0 || i + 1 >= argc) {
+            PrintHelp();
+            return key == "--help" || key == "-h" ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+        args[key.substr(2)] = argv[++i];
+    }
+
+    std::vector<int> thread_counts;
+    int cores = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    if (args.count("threads")) {
+        std::istringstream list(args["threads"]);
+        std::string count;
+        while (std::getline(list, count, ','))
+            thread_counts.push_back(std::stoi(count));
+    } else {
+        thread_counts = {1, 2, 4, 8};
+        if (std::find(thread_counts.begin(), thread_counts.end(), cores) == thread_counts.end())
+            thread_counts.push_back(cores);
+    }
+    double duration = std::stod(args["duration"]);
+    int write_rate = std::stoi(args["write-rate"]);
+    std::string key = args["key"];
+
+    ConfigManager::SetInstance(args["config"]);
+    ConfigManager *config = ConfigManager::GetInstance();
+    if (config->Get(key).is_null())
+        throw std::runtime_error("Setting " + key + " is not in " + args["config"]);
+    LockedConfig locked(config->GetSnapshot().Json());
+
+    // Every read touches the value so the copy can not be skipped, objects read their size
+    auto value = [](const nlohmann::json &setting) {
+        return setting.is_object() || setting.is_array() ? static_cast<int>(setting.size()) :
+               setting.is_number() ? setting.get<int>() : 1;
+    };
+
+    std::vector<std::pair<std::string, std::pair<std::function<int()>, std::function<void(uint64_t)>>>> variants = {
+            {"locked_copy", {[&]() { return value(locked.Get(key)); },
+                             [&](uint64_t n) { locked.Set("benchmark-version", n); }}},
+            {"get_copy", {[&]() { return value(ConfigManager::IGet(key)); },
+                          [&](uint64_t n) { config->Set("benchmark-version", n); }}},
+            {"snapshot", {[&]() { return value(ConfigManager::ISnapshot()[key]); },
+                          [&](uint64_t n) { config->Set("benchmark-version", n); }}},
+    };
+
+    nlohmann::json results = {{"key", key}, {"duration", duration}, {"write-rate", write_rate},
+                              {"cores", cores}, {"runs", nlohmann::json::array()}};
+    std::cerr << std::left << std::setw(14) << "variant" << std::right << std::setw(9) << "threads"
+              << std::setw(16) << "reads/s" << std::setw(12) << "ns/read" << std::setw(9) << "writes" << std::endl;
+    for (auto &variant : variants)
+        for (int threads : thread_counts) {
+            Run run = Measure(threads, duration, write_rate, variant.second.first, variant.second.second);
+            std::cerr << std::left << std::setw(14) << variant.first << std::right << std::setw(9) << threads
+                      << std::setw(16) << std::fixed << std::setprecision(0) << run.reads_per_second
+                      << std::setw(12) << std::setprecision(1) << run.ns_per_read << std::setw(9) << run.writes
+                      << std::defaultfloat << std::endl;
+            results["runs"].push_back({{"variant", variant.first}, {"threads", threads},
+                                       {"reads-per-second", run.reads_per_second},
+                                       {"ns-per-read", run.ns_per_read}, {"writes", run.writes}});
+        }
+
+    if (args["output"].empty()) {
+        std::cout << results.dump(4) << std::endl;
+    } else {
+        std::ofstream out(args["output"]);
+        out << results.dump(4) << std::endl;
+        std::cerr << "Results written to " << args["output"] << std::endl;
+    }
+    return EXIT_SUCCESS;
+}
+catch (const std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    return EXIT_FAILURE;
+}
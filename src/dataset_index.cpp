@@ -0,0 +1,309 @@
+#include <string>
+#include <algorithm>
+#include <atomic>
+
+#include <opencv2/opencv.hpp>
+#include <json.hpp>
+
+#include <ConfigManager.hpp>
+#include <DatasetParser.h>
+#include <ImageKernels.hpp>
+#include <SimilarityIndex.hpp>
+#include <WhyConDetector.hpp>
+#include <WorkerPool.hpp>
+
+/// Usage:
+///     Catalogues a dataset, hashes every colour image once (cached in <root>/dataset_index.csv) and answers
+///     similarity queries over it
+///             ./dataset_index --root /data/ hash
+///             ./dataset_index --root /data/ duplicates /data/rows/8224/2019_06_12/10_31_02_114/ --distance 6
+///             ./dataset_index --root /data/ cluster --distance 4 --output clusters.csv
+///             ./dataset_index --root /data/ whycon --image ir
+///             ./dataset_index --root /data/ marker 11
+///     Hashes match the ones the grabber writes to capture_meta.csv (Image Hash), which are reused when present.
+///     WhyCon markers are detected once per capture and cached in the index like the hashes
+
+void PrintHelp() {
+    std::cout << "Usage: dataset_index [options] <hash | duplicates <capture or image> | cluster | whycon | "
+                 "marker <id>>\n"
+              << "Options (--name value):" <<
+              "\n\t--config <path> (Config file for file names and defaults, default ../config.json)" <<
+              "\n\t--root <dir> (Data root holding the datasets, default save-path-prefix)" <<
+              "\n\t--index <path> (Index file, default <root>/dataset_index.csv)" <<
+              "\n\t--threads <n> (Hashing threads, default all cores)" <<
+              "\n\t--distance <bits> (Hamming distance for duplicates and clusters, default 4)" <<
+              "\n\t--output <path> (Cluster CSV, default stdout)" <<
+              "\n\t--image <colour | ir> (Image WhyCon markers are detected in, default ir)" <<
+              "\n\t--id-bits <n> (Code bits of the markers, 0 for plain markers, default 8)" <<
+              "\n\t--min-diameter <px> (Smallest marker to detect, default 12)" <<
+              "\n\t--redetect <0 | 1> (Detect again on captures already processed, default 0)" << std::endl;
+}
+
+// Same sampling as RealSenseD400 at save time: green channel decimated by 8, then a 64 bit dHash. Images are read as
+// 8 bit BGR (cv::IMREAD_COLOR) like the grabber's colour frames, so the hashes compare
+uint64_t HashImage(const cv::Mat &image) {
+    const int decimation = 8;
+    int channels = image.channels(), channel = channels == 3 ? 1 : 0;
+    int width = image.cols / decimation, height = image.rows / decimation;
+    std::vector<uint8_t> thumbnail(static_cast<size_t>(width) * height);
+    ImageKernels::Decimate(image.data, image.cols, image.rows, static_cast<int>(image.step), channels, channel,
+                           decimation, thumbnail.data());
+    return ImageKernels::DifferenceHash(thumbnail.data(), width, height);
+}
+
+// The hash the grabber stored with the capture, if it did. A damaged value counts as none so the image is hashed
+bool ReadCaptureHash(const std::string &file_name, uint64_t &hash) {
+    std::ifstream csv(file_name);
+    std::string line;
+    const std::string key = "Image Hash,";
+    while (std::getline(csv, line))
+        if (line.compare(0, key.size(), key) == 0) {
+            try {
+                hash = std::stoull(line.substr(key.size()), nullptr, 16);
+                return true;
+            } catch (const std::logic_error &) {
+                return false;
+            }
+        }
+    return false;
+}
+
+size_t HashCaptures(DatasetParser::GrabberDataset &dataset, unsigned int threads) {
+    std::vector<size_t> pending;
+    for (size_t i = 0; i < dataset.Size(); ++i)
+        if (!dataset[i].hashed)
+            pending.push_back(i);
+    if (pending.empty())
+        return 0;
+
+    std::cout << "Hashing " << pending.size() << " of " << dataset.Size() << " captures on " << threads
+              << " threads" << std::endl;
+    std::atomic<size_t> done{0}, failed{0};
+    auto start = std::chrono::steady_clock::now();
+
+    // Every task owns distinct captures, so results are written straight into the dataset
+    {
+        WorkerPool pool(threads, threads * 4, "hasher");
+        const size_t batch = 64;
+        for (size_t first = 0; first < pending.size(); first += batch) {
+            size_t last = std::min(first + batch, pending.size());
+            pool.Submit([&dataset, &pending, &done, &failed, first, last]() {
+                for (size_t i = first; i < last; ++i) {
+                    DatasetParser::DataCapture &capture = dataset[pending[i]];
+                    if (!ReadCaptureHash(capture.GetCaptureMetaPath(), capture.image_hash)) {
+                        cv::Mat image = cv::imread(capture.GetRGBPath(), cv::IMREAD_COLOR);
+                        if (image.empty()) {
+                            failed++;
+                            continue;
+                        }
+                        capture.image_hash = HashImage(image);
+                    }
+                    capture.hashed = true;
+                    done++;
+                }
+            });
+
+            if ((first / batch) % 200 == 0 && first > 0)
+                std::cout << "\t" << done << " hashed, " << failed << " without a colour image" << std::endl;
+        }
+        pool.Wait();
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "\t" << done << " hashed, " << failed << " without a colour image in " << std::fixed
+              << std::setprecision(1) << seconds << "s (" << done / std::max(seconds, 1e-3) << " images/s)"
+              << std::defaultfloat << std::endl;
+    return done;
+}
+
+size_t DetectMarkers(DatasetParser::GrabberDataset &dataset, unsigned int threads, bool use_ir, int id_bits,
+                     int min_diameter, bool redetect) {
+    std::vector<size_t> pending;
+    for (size_t i = 0; i < dataset.Size(); ++i)
+        if (redetect || !dataset[i].markers_detected)
+            pending.push_back(i);
+    if (pending.empty())
+        return 0;
+
+    std::cout << "Detecting markers in " << pending.size() << " of " << dataset.Size() << " captures on " << threads
+              << " threads" << std::endl;
+    std::atomic<size_t> done{0}, failed{0}, seen{0};
+    auto start = std::chrono::steady_clock::now();
+
+    {
+        WorkerPool pool(threads, threads * 4, "whycon");
+        const size_t batch = 16;
+        for (size_t first = 0; first < pending.size(); first += batch) {
+            size_t last = std::min(first + batch, pending.size());
+            pool.Submit([&, first, last]() {
+                // The detector keeps its buffers between images, one per worker
+                thread_local WhyConDetector detector(id_bits, min_diameter);
+                for (size_t i = first; i < last; ++i) {
+                    DatasetParser::DataCapture &capture = dataset[pending[i]];
+                    cv::Mat image = cv::imread(use_ir ? capture.GetIRPath() : capture.GetRGBPath(),
+                                               cv::IMREAD_GRAYSCALE);
+                    if (image.empty()) {
+                        failed++;
+                        continue;
+                    }
+                    capture.markers = detector.Detect(image.data, image.cols, image.rows,
+                                                      static_cast<int>(image.step));
+                    capture.markers_detected = true;
+                    seen += capture.markers.size();
+                    done++;
+                }
+            });
+        }
+        pool.Wait();
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "\t" << done << " processed, " << seen << " markers, " << failed << " without an image in "
+              << std::fixed << std::setprecision(1) << seconds << "s (" << done / std::max(seconds, 1e-3)
+              << " images/s)" << std::defaultfloat << std::endl;
+    dataset.IndexMarkers();
+    return done;
+}
+
+int main(int argc, char *argv[]) try {
+    std::map<std::string, std::string> args = {{"config", "../config.json"}, {"threads", "0"}, {"distance", "4"},
+                                               {"index", ""}, {"output", ""}, {"image", "ir"}, {"id-bits", "8"},
+                                               {"min-diameter", "12"}, {"redetect", "0"}};
+    std::vector<std::string> command;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg(argv[i]);
+        if (arg == "--help" || arg == "-h") {
+            PrintHelp();
+            return EXIT_SUCCESS;
+        } else if (arg.compare(0, 2, "--") == 0 && i + 1 < argc) {
+            args[arg.substr(2)] = argv[++i];
+        } else {
+            command.push_back(arg);
+        }
+    }
+
+    if (command.empty() || ((command[0] == "duplicates" || command[0] == "marker") && command.size() < 2)) {
+        PrintHelp();
+        return EXIT_FAILURE;
+    }
+
+    ConfigManager::SetInstance(args["config"]);
+    std::string root = args.count("root") ? args["root"] : ConfigManager::IGet("save-path-prefix").get<std::string>();
+    unsigned int threads = static_cast<unsigned int>(std::stoi(args["threads"]));
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    // A Hamming distance between 64 bit hashes, anything else would not find what was asked for
+    size_t parsed = 0;
+    int distance = std::stoi(args["distance"], &parsed);
+    if (parsed != args["distance"].size() || distance < 0 || distance > 64)
+        throw std::invalid_argument("--distance must be 0 to 64 bits, got " + args["distance"]);
+
+    // Catalogue, new captures are hashed once and cached
+    DatasetParser::GrabberDataset dataset(root, args["index"]);
+    auto start = std::chrono::steady_clock::now();
+    bool cached = dataset.Load();
+    size_t added = dataset.Scan();
+    std::cout << dataset.Size() << " captures under " << dataset.GetRoot() << " (" << added << " new"
+              << (cached ? "" : ", no index yet") << ") in " << std::chrono::duration<double>(
+                      std::chrono::steady_clock::now() - start).count() << "s" << std::endl;
+
+    if (command[0] == "whycon" || command[0] == "marker") {
+        // Markers are detected once, queries only use the cached ones
+        bool changed = added > 0 || !cached;
+        if (command[0] == "whycon")
+            changed |= DetectMarkers(dataset, threads, args["image"] != "colour", std::stoi(args["id-bits"]),
+                                     std::stoi(args["min-diameter"]), args["redetect"] == "1") > 0;
+        if (changed)
+            dataset.Save();
+
+        size_t processed = 0;
+        for (size_t i = 0; i < dataset.Size(); ++i)
+            processed += dataset[i].markers_detected ? 1 : 0;
+        if (command[0] == "whycon") {
+            std::cout << processed << " of " << dataset.Size() << " captures searched for markers" << std::endl;
+            return EXIT_SUCCESS;
+        }
+
+        int id = std::stoi(command[1]);
+        start = std::chrono::steady_clock::now();
+        std::vector<size_t> captures = dataset.GetByWhyCON(id);
+        double query_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        for (size_t i : captures)
+            for (const WhyConMarker &marker : dataset[i].markers)
+                if (marker.id == id)
+                    std::cout << dataset[i].GetPath() << "\t" << marker.x << "," << marker.y << "\t"
+                              << marker.diameter << std::endl;
+        std::cout << captures.size() << " captures see marker " << id << " (of " << processed
+                  << " searched), query took " << query_ms << "ms" << std::endl;
+        return EXIT_SUCCESS;
+    }
+
+    if (HashCaptures(dataset, threads) > 0 || added > 0 || !cached)
+        dataset.Save();
+    if (command[0] == "hash")
+        return EXIT_SUCCESS;
+
+    start = std::chrono::steady_clock::now();
+    SimilarityIndex index;
+    for (size_t i = 0; i < dataset.Size(); ++i)
+        if (dataset[i].hashed)
+            index.Insert(dataset[i].image_hash, i);
+    index.Build(distance);
+    std::cout << "Index of " << index.Size() << " hashes (" << index.DistinctHashes() << " distinct) built in "
+              << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count()
+              << "ms" << std::endl;
+
+    if (command[0] == "duplicates") {
+        // A catalogued capture uses its cached hash, anything else is read and hashed
+        uint64_t hash;
+        long capture = dataset.Find(command[1]);
+        if (capture >= 0 && dataset[capture].hashed) {
+            hash = dataset[capture].image_hash;
+        } else {
+            cv::Mat image = cv::imread(command[1], cv::IMREAD_COLOR);
+            if (image.empty())
+                throw std::runtime_error("Could not read " + command[1] + " as a capture or image");
+            hash = HashImage(image);
+        }
+
+        start = std::chrono::steady_clock::now();
+        std::vector<SimilarityIndex::Match> matches = index.Query(hash, distance);
+        double query_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        size_t found = 0;
+        for (auto &match : matches)
+            if (static_cast<long>(match.id) != capture) {
+                std::cout << match.distance << "\t" << dataset[match.id].GetPath() << std::endl;
+                found++;
+            }
+        std::cout << found << " within " << distance << " bits, query took " << query_ms << "ms" << std::endl;
+    } else if (command[0] == "cluster") {
+        start = std::chrono::steady_clock::now();
+        std::vector<std::vector<size_t>> clusters = index.Cluster(distance);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        std::ofstream file;
+        if (!args["output"].empty())
+            file.open(args["output"]);
+        std::ostream &out = args["output"].empty() ? std::cout : file;
+        out << "Cluster,Size,Path\n";
+        size_t duplicates = 0;
+        for (size_t c = 0; c < clusters.size(); ++c) {
+            duplicates += clusters[c].size() - 1;
+            for (size_t id : clusters[c])
+                out << c << ',' << clusters[c].size() << ',' << dataset[id].GetRelativePath() << '\n';
+        }
+
+        std::cerr << clusters.size() << " clusters within " << distance << " bits, " << duplicates
+                  << " captures are near duplicates of another, clustered in " << seconds << "s" << std::endl;
+    } else {
+        PrintHelp();
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+catch (const std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    return EXIT_FAILURE;
+}
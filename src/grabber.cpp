@@ -9,11 +9,23 @@
 #include <RealSenseD400.hpp>
 #include <MultiCamD400.hpp>
 #include <ConfigManager.hpp>
+#include <Settings.hpp>
+#include <Metrics.hpp>
+#include <MetricsServer.hpp>
+#include <Tracer.hpp>
 
 void PrintHelp() {
     std::cout << "Controls: \n\t-save, s (Writes all output to disk)\n\t-laser0, l0 (Turns laser off)\n\t-laser1 <pa" <<
               "ram>, l1 <param> (Turns laser on)\n\t\t-<param> can be min(-3), mid(-2), max(-1) or any float value" <<
               "\n\t-stab, st (Throws away frames for correcting exposure)" << "\n\t-new, n (Creates new dataset)" <<
+              "\n\t-record, r <start/stop> (Toggles continuous recording of every frame to .bag files)" <<
+              "\n\t-auto, a <on/off> (Toggles rolling capture on an interval or scene change)" <<
+              "\n\t-pair, p <on/off> (Toggles saving emitter off IR with emitter on depth from consecutive frames)" <<
+              "\n\t-fuse, f <on/off> (Toggles fusing the depth of several consecutive frames into each save)" <<
+              "\n\t-bracket, b <on/off> (Toggles saving colour frames at several exposures, merged into one image)" <<
+              "\n\t-drops, d (Prints dropped frames, drop rate and timestamp jitter per stream)" <<
+              "\n\t-metrics, m <reset> (Prints per stage latency and throughput, optionally resets them)" <<
+              "\n\t-trace, t <path> (Writes the recorded event timeline to a Chrome/Perfetto trace file)" <<
               "\n\t-help, h (Displays help)" << "\n\t-quit, q (Quits)" << std::endl;
 }
 
@@ -47,7 +59,8 @@ void NewDataset(std::string &project_root, std::string &project_name) {
     std::stringstream project_name_buf;
     project_name_buf <<  std::put_time(std::localtime(&t), "data-%Y_%m_%d-%H:%M:%S");
 
-    project_name = project_name_buf.str(), project_root = ConfigManager::IGet("save-path-prefix");
+    project_name = project_name_buf.str();
+    project_root = CaptureSettings::Current()->Defaults().paths.save_path_prefix;
 
     std::cout << "Creating new dataset:" << std::endl;
 
@@ -93,6 +106,23 @@ void NewDataset(std::string &project_root, std::string &project_name) {
 int main(int argc, char *argv[]) try {
     // Set the singleton class up with the config file
     ConfigManager::SetInstance("../config.json");
+    CaptureSettings::Current();
+
+    // Enable stage timing before any camera starts, the metrics endpoint needs it too
+    nlohmann::json instrumentation = ConfigManager::IGet("instrumentation");
+    nlohmann::json endpoint = ConfigManager::IGet("metrics-endpoint");
+    bool endpoint_enabled = !endpoint.is_null() && endpoint["enabled"];
+    Metrics::SetEnabled(endpoint_enabled || (!instrumentation.is_null() && instrumentation["enabled"]));
+
+    nlohmann::json tracing = ConfigManager::IGet("tracing");
+    bool tracing_enabled = !tracing.is_null() && tracing["enabled"];
+    std::string trace_path = tracing_enabled ? tracing["path"] : "";
+    Tracer::SetEnabled(tracing_enabled);
+    Tracer::SetThreadName("input");
+
+    std::unique_ptr<MetricsServer> metrics_server;
+    if (endpoint_enabled)
+        metrics_server.reset(new MetricsServer(endpoint["address"], endpoint["port"]));
 
     // Initialise currently connected cameras and wait until ready
     // Set refresh rate to 20 Hz since frame rate is only 6
@@ -143,8 +173,33 @@ int main(int argc, char *argv[]) try {
                 cameras.SetLaser(true, power);
             } else if (token == "save" || token == "s") {
                 cameras.SaveFrames();
+            } else if(token == "record" || token == "r") {
+                bool start = param.empty() ? !cameras.Recording() : param == "start";
+                if (start)
+                    cameras.StartRecording();
+                else
+                    cameras.StopRecording();
+            } else if(token == "auto" || token == "a") {
+                cameras.SetRollingCapture(param.empty() ? !cameras.RollingCapture() : param == "on");
+            } else if(token == "pair" || token == "p") {
+                cameras.SetPairedCapture(param.empty() ? !cameras.PairedCapture() : param == "on");
+            } else if(token == "fuse" || token == "f") {
+                cameras.SetDepthFusion(param.empty() ? !cameras.DepthFusion() : param == "on");
+            } else if(token == "bracket" || token == "b") {
+                cameras.SetExposureBracket(param.empty() ? !cameras.ExposureBracket() : param == "on");
             } else if(token == "stab" || token == "st") {
                 cameras.StabiliseExposure();
+            } else if(token == "drops" || token == "d") {
+                cameras.PrintFrameStatistics();
+            } else if(token == "metrics" || token == "m") {
+                Metrics::GetInstance()->Dump(std::cout);
+                if (param == "reset")
+                    Metrics::GetInstance()->Reset();
+            } else if(token == "trace" || token == "t") {
+                if (Tracer::Enabled())
+                    Tracer::GetInstance()->Flush(param.empty() ? trace_path : param);
+                else
+                    std::cout << "Tracing disabled, set 'tracing/enabled' in the config file" << std::endl;
             } else if(token == "help" || token == "h") {
                 PrintHelp();
             } else if(token == "quit" || token == "q") {
@@ -155,6 +210,14 @@ int main(int argc, char *argv[]) try {
         }
     } while (!quit);
 
+    if (cameras.Recording())
+        cameras.StopRecording();
+
+    if (Metrics::Enabled())
+        Metrics::GetInstance()->Dump(std::cout);
+    if (Tracer::Enabled())
+        Tracer::GetInstance()->Flush(trace_path);
+
     std::cout << "Threads terminated" << std::endl;
     return EXIT_SUCCESS;
 }
@@ -0,0 +1,33 @@
+#ifndef STRAWBERRYDATA_BAGCAMERA_H
+#define STRAWBERRYDATA_BAGCAMERA_H
+
+#include <string>
+#include <librealsense2/rs.hpp>
+
+#include "RealSenseD400.hpp"
+
+/// Usage:
+///     Replays a .bag recording as if it was a connected camera, every stream in the recording is enabled
+///             BagCamera camera("recording.bag");                   // Serial number from the recording
+///             BagCamera camera("recording.bag", "bag-0", true, false); // Loop as fast as frames are consumed
+///     Sensor options are read only during playback so the laser can not be toggled
+
+class BagCamera : public RealSenseD400 {
+public:
+    explicit BagCamera(const std::string &file_name, const std::string &serial_number = "", bool repeat = true,
+                       bool real_time = true);
+    const void SetLaser(bool status, float power=-4) override;
+    bool SetPairedCapture(bool enabled) override;
+    bool SetExposureBracket(bool enabled) override;
+    bool WasRemoved(const rs2::event_information &info) override;
+    bool StartRecording() override;
+protected:
+    bool RestartStreams() override;
+private:
+    BagCamera(rs2::playback recording, const std::string &file_name, const std::string &serial_number, bool repeat,
+              bool real_time);
+
+    std::string file_name_;
+};
+
+#endif //STRAWBERRYDATA_BAGCAMERA_H
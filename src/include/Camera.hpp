@@ -0,0 +1,138 @@
+#ifndef STRAWBERRYDATA_CAMERA_H
+#define STRAWBERRYDATA_CAMERA_H
+
+#include <array>
+#include <memory>
+#include <string>
+#include <vector>
+#include <librealsense2/rs.hpp>
+
+#include "Strawberry.hpp"
+#include "FrameMonitor.hpp"
+
+// Values for RS2_OPTION_INTER_CAM_SYNC_MODE on the depth sensor
+enum class SyncMode : int { DEFAULT = 0, MASTER = 1, SLAVE = 2 };
+
+// Per frame quality, sharpness and exposure from a decimated colour (green) or IR image, depth over the full frame
+struct FrameQuality {
+    bool measured = false, passed = true;
+    double sharpness = 0;                       // Variance of the Laplacian
+    double brightness = 0;                      // Mean 0 - 255
+    double under_exposed = 0, over_exposed = 0; // Fraction of pixels clipped at either end of the range
+    double depth_valid = 0;                     // Fraction of depth pixels with a measurement
+    std::array<float, 16> histogram{};          // Exposure histogram as fractions of the pixels
+};
+
+// Everything needed to write one save, taken from the acquisition thread so it can be written on another
+struct Capture {
+    explicit Capture(const Strawberry::DataStructure &structure) : data_structure(structure) {}
+
+    rs2::video_frame depth{nullptr}, colour{nullptr}, lir{nullptr}, rir{nullptr}, c_depth{nullptr};
+    rs2::points point_cloud;
+
+    // Folders are named after the time the save was requested, not when the writer gets to it
+    Strawberry::DataStructure data_structure;
+    double timestamp_ms = 0;
+
+    SyncMode sync_mode = SyncMode::DEFAULT;
+    long long capture_group = -1, frame_counter = -1;
+    bool hardware_aligned = false;
+    double frame_timestamp = 0;
+    FrameMonitor frame_monitor;
+
+    // What caused the save (manual, interval or change) and the change score at the time
+    std::string trigger = "manual";
+    double change_score = 0;
+    FrameQuality quality;
+
+    // Perceptual hash of the colour image and its distance to the closest of the camera's recent saves (-1 for none)
+    uint64_t image_hash = 0;
+    int duplicate_distance = -1;
+    bool duplicate = false;
+
+    // Paired capture, IR from an emitter off frame saved with the depth of the neighbouring emitter on frame, with the
+    // frame counter gap between them and the emitter mode metadata of both
+    bool paired = false;
+    long long ir_frame_counter = -1, paired_frame_gap = -1, depth_emitter_mode = -1, ir_emitter_mode = -1;
+
+    // Depth fusion, the method ("median" or "mean") and the counters of the first and last of the fused frames
+    std::string fusion;
+    int fused_frames = 0;
+    long long fused_first_counter = -1, fused_last_counter = -1;
+
+    // Exposure bracket, a colour frame per exposure with the exposure it reported (ACTUAL_EXPOSURE) and its capture
+    // group (hardware aligned only), the frames read to collect them and whether the writer merges them into one
+    // exposure fused image
+    std::vector<rs2::video_frame> bracket;
+    std::vector<double> bracket_exposures;
+    std::vector<long long> bracket_groups;
+    int bracket_frames = 0;
+    bool merge_bracket = false;
+};
+
+/// Usage:
+///     Interface MultiCamD400 drives, implemented by every capture backend
+///             RealSenseD400   - physical camera (rs2::device)
+///             BagCamera       - replays a .bag recording through rs2::config::enable_device_from_file
+///             SyntheticCamera - generated depth, colour and IR frames at a configurable resolution and rate
+class Camera {
+public:
+    virtual ~Camera() = default;
+
+    // Capture
+    virtual const void WaitForFrames() = 0;
+    virtual void WriteData() = 0;
+    virtual std::shared_ptr<Capture> TakeCapture(const std::string &trigger = "manual") = 0;
+    virtual void WriteCapture(Capture &capture) = 0;
+    virtual void StabiliseExposure(int stabilization_window = 30) = 0;
+    virtual const void SetLaser(bool status, float power=-4) = 0;
+    virtual void ConfigureDataset(std::string data_name = "", std::string data_root = "") = 0;
+    virtual void CloseGUI() = 0;
+
+    // Applies only what differs from the current settings, the streams are only restarted for a new resolution or
+    // frame rate
+    virtual void ApplySettings(const CameraSettings &settings) = 0;
+
+    // Continuous capture of every raw frame to a .bag in the current session folder
+    virtual bool StartRecording() = 0;
+    virtual void StopRecording() = 0;
+    virtual bool Recording() = 0;
+
+    // Change since the last save on a decimated IR (or colour) image, computed per frame once enabled
+    virtual void SetChangeDetection(bool enabled, bool colour = false, int decimation = 8) = 0;
+    virtual double GetChangeScore() = 0;
+
+    // Quality of the current frame, measured per frame when the quality gate is enabled
+    virtual const FrameQuality &GetQuality() = 0;
+
+    // Returns true when the device behind this camera was unplugged
+    virtual bool WasRemoved(const rs2::event_information &info) = 0;
+
+    // Hot-plug, Detach stops streaming and releases every frame once unplugged. Reattach resumes on the replugged
+    // device with the same streams, options and dataset, false means the camera has to be created again
+    virtual void Detach() = 0;
+    virtual bool Reattach(rs2::device dev) = 0;
+
+    // Alternates the emitter every frame so a save holds pattern free IR and emitter on depth, false if unsupported
+    virtual bool SetPairedCapture(bool enabled) = 0;
+
+    // Saves fuse the depth of several consecutive frames to fill holes and average out noise, false if unsupported
+    virtual bool SetDepthFusion(bool enabled) = 0;
+
+    // Saves add colour frames at several manual exposures for scenes beyond the sensor's range, false if unsupported
+    virtual bool SetExposureBracket(bool enabled) = 0;
+
+    // Inter-camera synchronisation
+    virtual const std::string &GetSerialNumber() = 0;
+    virtual SyncMode GetSyncMode() = 0;
+    virtual bool HardwareSynced() = 0;
+    virtual long long GetFrameCounter() = 0;
+    virtual double GetFrameTimestamp() = 0;
+    virtual double GetFramePeriod() = 0;
+    virtual void SetCaptureGroup(long long group, bool hardware_aligned) = 0;
+
+    // Frame loss
+    virtual void PrintFrameStatistics() = 0;
+};
+
+#endif //STRAWBERRYDATA_CAMERA_H
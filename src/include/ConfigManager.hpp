@@ -1,12 +1,38 @@
 #ifndef STRAWBERRYDATA_CONFIG_H
 #define STRAWBERRYDATA_CONFIG_H
 
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
 #include <string>
 #include <fstream>
 
 #include <json.hpp>
 #include <mutex>
 
+// One immutable version of the whole configuration, never modified once published
+class ConfigSnapshot {
+public:
+    ConfigSnapshot(nlohmann::json config, uint64_t version);
+
+    // Top level setting, a null json when the key is not set (never inserts)
+    const nlohmann::json &operator[](const std::string &key) const;
+    const nlohmann::json &Json() const;
+    uint64_t Version() const;
+private:
+    const nlohmann::json config_;
+    const uint64_t version_;
+};
+
+/// Usage:
+///     Settings are published as immutable snapshots (read copy update): a writer copies the current version, changes
+///     it and swaps the new one in, readers never lock and never copy the json
+///             const ConfigSnapshot &config = ConfigManager::ISnapshot();
+///             int width = config["stream-depth"].at("width");
+///     The reference is to the calling thread's cached snapshot, it stays valid until that thread asks for a snapshot
+///     again after a write. Use GetShared to keep one version longer. Get and IGet still return a copy
+///     of one setting for existing callers, they take no lock either
 class ConfigManager {
 public:
     static ConfigManager* GetInstance();
@@ -14,23 +40,43 @@ public:
     static void SetInstance(std::string path);
     ConfigManager& operator=(ConfigManager const&) = delete;
     static nlohmann::json IGet(const std::string& key);
+    static const ConfigSnapshot &ISnapshot();
     nlohmann::json Get(const std::string& key);
+    const ConfigSnapshot &GetSnapshot();
+    std::shared_ptr<const ConfigSnapshot> GetShared() const;
+    uint64_t Version() const;
+    const std::string &GetPath() const;
+
+    // Reads the config file again and publishes it when it differs from the current version (returns true). Values
+    // changed with Set are kept unless the file changed the same key. A file that does not parse, or that validate
+    // throws for, is reported and the current version stays
+    bool Reload(const std::function<void(const nlohmann::json &)> &validate = nullptr);
     const void Print(int spaces = 2);
     template<typename T>
     void ISet(const std::string &key, T value) {GetInstance()->Set(key, value);}
     template<typename T>
-    void Set(const std::string &key, T value) {std::lock_guard<std::mutex> lock(singleton_lock_); config[key] = value;}
+    void Set(const std::string &key, T value) {Update(key, nlohmann::json(value));}
 private:
     ConfigManager();
     explicit ConfigManager(std::string path);
     ~ConfigManager();
     void Load();
+    void Update(const std::string &key, nlohmann::json value);
+    // Makes config the current version, callers hold write_lock_
+    void Publish(nlohmann::json config);
 
-    static ConfigManager *self_;
+    static std::atomic<ConfigManager *> self_;
     static std::mutex singleton_lock_;
 
-    nlohmann::json config;
+    // Only accessed through std::atomic_load / std::atomic_store, version_ is bumped after every store so readers
+    // only have to load one integer to know their cached snapshot is current
+    std::shared_ptr<const ConfigSnapshot> current_;
+    std::atomic<uint64_t> version_{0};
+    std::mutex write_lock_;
     std::string path_;
+
+    // The file as last read and the keys Set since, kept apart so a reload can tell which one changed
+    nlohmann::json file_, runtime_ = nlohmann::json::object();
 };
 
 
@@ -0,0 +1,38 @@
+#ifndef STRAWBERRYDATA_CONFIGWATCHER_H
+#define STRAWBERRYDATA_CONFIGWATCHER_H
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+
+#include "ThreadClass.hpp"
+#include "ConfigManager.hpp"
+
+/// Usage:
+///     Reloads ConfigManager when its file is saved (inotify) and reports what changed
+///             ConfigWatcher watcher([](const ConfigSnapshot &previous, const ConfigSnapshot &current) {...});
+///     The directory is watched rather than the file, editors often save by writing a new file and renaming it over
+///     the old one. Saves closer together than debounce_ms are reloaded once, a config CaptureSettings rejects is
+///     reported and ignored so a half edited file never reaches the cameras
+
+class ConfigWatcher : ThreadClass {
+public:
+    using Callback = std::function<void(const ConfigSnapshot &previous, const ConfigSnapshot &current)>;
+
+    explicit ConfigWatcher(Callback on_change, int debounce_ms = 250);
+    ~ConfigWatcher() override;
+private:
+    const void Setup() override;
+    const void Loop() override;
+    void Reload();
+
+    Callback on_change_;
+    std::chrono::milliseconds debounce_;
+    std::string directory_, file_name_;
+    int inotify_ = -1;
+    bool pending_ = false;
+    std::chrono::steady_clock::time_point last_event_;
+};
+
+#endif //STRAWBERRYDATA_CONFIGWATCHER_H
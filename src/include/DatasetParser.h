@@ -2,64 +2,27 @@
 #define STRAWBERRYDATA_DATASETPARSER_H
 
 #include <chrono>
+#include <cstdint>
 #include <string>
+#include <unordered_map>
 #include <vector>
-#include <map>
 
-namespace DatasetParser {
-    using timestamp = std::chrono::high_resolution_clock::time_point;
-
-    class CaptureMeta {
-    public:
-        CaptureMeta(std::string path);
-        timestamp frame, sensor, arrival, backend;
-        int frame_counter_id;
-    private:
-        std::string meta_path;
-    };
-
-    class CaptureImage {
-    public:
-        CaptureImage(std::string folder_path);
-        CaptureImage(const CaptureImage&) = delete;
-        void operator=(const CaptureImage &capture_image) = delete;
-        bool LoadCaptureMeta();
-        virtual std::string GetPath();
-        timestamp GetTimestamp();
-        timestamp GetFrameTimestamp();
-        timestamp GetSensorTimestamp();
-        timestamp GetArrivalTimestamp();
-        timestamp GetBackendTimestamp();
-    private:
-        std::string absolute_path;
-        CaptureMeta capture_meta;
-    };
+#include "WhyConDetector.hpp"
 
-    class RGBCapture : CaptureImage {
-    public:
-        RGBCapture(std::string folder_root);
-
-    };
-
-    class DepthCapture : CaptureImage {
-    public:
-        DepthCapture(std::string folder_root);
-        std::string GetDepthPath();
-        std::string GetColourisedDepthPath();
+/// Usage:
+///     Catalogue of every capture under a data root, laid out by the grabber as
+///     <root>/<dataset>/<serial>/<YYYY_MM_DD>/<HH_MM_SS_mmm>/rgb_8UC3.png ...
+///             DatasetParser::GrabberDataset dataset("/data/");
+///             dataset.Load();     // Cached index (<root>/dataset_index.csv), if there is one
+///             dataset.Scan();     // Adds capture folders written since
+///             for (size_t i : dataset.GetByDay("2019_06_12"))
+///                 std::cout << dataset[i].GetRGBPath() << std::endl;
+///             dataset.Save();
+///     Results of the offline tools (perceptual hashes, ...) are stored per capture and cached in the index so they
+///     are only computed once
 
-    private:
-        std::string colourised_depth_absolute_path_;
-    };
-
-    class IRCapture : CaptureImage {
-    public:
-        IRCapture(std::string folder_root);
-        std::string GetLeftIRPath();
-        std::string GetRightIRPath();
-
-    private:
-        std::string right_ir_absolute_path_;
-    };
+namespace DatasetParser {
+    using timestamp = std::chrono::system_clock::time_point;
 
     enum class SensorType : int8_t {
         RGB = 0,
@@ -69,130 +32,86 @@ namespace DatasetParser {
         COLOURISED_DEPTH = 4
     };
 
-    class DataCapture {
-    public:
-        DataCapture();
-        RGBCapture rgb;
-        DepthCapture depth;
-        IRCapture ir;
-        std::string GetPath(SensorType sensor_type);
-        std::string GetRGBPath();
-        std::string GetDepthPath(SensorType sensor_type = SensorType::DEPTH);
-        std::string GetIRPath(SensorType sensor_type = SensorType::IR_LEFT);
+    // File names inside a capture folder, the defaults match config.json "file-names"
+    struct FileNames {
+        std::string rgb = "rgb_8UC3", ir_left = "ir_left_8UC1", ir_right = "ir_right_8UC1", depth = "depth_16UC1";
+        std::string coloured_depth = "colourised_depth_8UC3", capture = "capture";
+        std::string video_frame_ext = ".png", metadata_ext = "_meta.csv";
+
+        // The global "file-names" of config.json
+        static FileNames FromConfig();
     };
 
-    class CameraMeta {
+    // One save of one camera (a timestamp folder)
+    class DataCapture {
     public:
-        std::string name, serial_number;
+        DataCapture(const std::string *root, const FileNames *file_names, std::string dataset,
+                    std::string serial_number, std::string day, std::string time);
+        std::string GetRelativePath() const;
+        std::string GetPath() const;
+        std::string GetPath(SensorType sensor_type) const;
+        std::string GetRGBPath() const;
+        std::string GetDepthPath(SensorType sensor_type = SensorType::DEPTH) const;
+        std::string GetIRPath(SensorType sensor_type = SensorType::IR_LEFT) const;
+        std::string GetCaptureMetaPath() const;
+        timestamp GetTimestamp() const;
+
+        std::string dataset, serial_number, day, time;
+
+        // Perceptual hash of the colour image (ImageKernels::DifferenceHash), valid once hashed is set
+        uint64_t image_hash = 0;
+        bool hashed = false;
+
+        // WhyCon markers seen in the capture, valid once markers_detected is set (empty if there were none)
+        std::vector<WhyConMarker> markers;
+        bool markers_detected = false;
     private:
-        std::string path;
+        const std::string *root_;
+        const FileNames *file_names_;
     };
 
-    class CameraData {
+    class GrabberDataset {
     public:
-        CameraMeta camera_meta;
-        std::map<timestamp, std::vector<DataCapture>> data;
+        explicit GrabberDataset(std::string data_root, std::string index_file = "");
+        GrabberDataset(const GrabberDataset&) = delete;
+        void operator=(const GrabberDataset&) = delete;
+
+        // Index file, captures no longer on disk are dropped by the next Scan
+        bool Load();
+        bool Save();
+
+        // Walks the data root, adds new capture folders and returns how many were added
+        size_t Scan();
+
+        size_t Size() const;
+        DataCapture &operator[](size_t index);
+        const DataCapture &operator[](size_t index) const;
+        const std::string &GetRoot() const;
+
+        // Index of the capture that owns a folder or file (absolute or relative to the root), -1 if not catalogued
+        long Find(const std::string &path) const;
+
+        // Queries return indices in dataset, serial, day, time order
+        std::vector<size_t> GetByHierarchy(const std::string &dataset, const std::string &serial_number = "",
+                                           const std::string &day = "") const;
+        std::vector<size_t> GetByDataSet(const std::string &dataset) const;
+        std::vector<size_t> GetByDay(const std::string &day) const;
+        std::vector<size_t> GetByStartTime(timestamp from, timestamp to) const;
+
+        // Captures that saw the marker, from an index rebuilt by Load, Scan and IndexMarkers
+        std::vector<size_t> GetByWhyCON(int id) const;
+
+        // Rebuilds the marker index after markers were detected on captures
+        void IndexMarkers();
     private:
-        std::string camera_folder_path;
-    };
+        void Sort();
 
-    class SessionMeta
-
-
-// class data_capture Each capture image set is part of a single grabber capture
-// public
-//      rgb_capture
-//      ir_capture
-//      depth_capture
-//      get path <- SENSOR_TYPE
-//      get rgb path
-//      get ir path <- SENSOR_TYPE : default 0
-//      get depth path <- SENSOR_TYPE : default 0
-
-/*
- * class camera_meta
- *  public
- *      string path
- *      string name
- *      string serial_number
- */
-
-/*
- * class camera_data
- *  private
-*       string sessions_folder_path (where all the timestamp folders are)
- *  public
- *      camera_meta
- *      std::map<session_date, std::vector<data_capture>> data
- */
-
-/*
- * class session_meta
- *  public
- *      string name
- *      string contact
- *      string lat
- *      string lon
- *      string location_name
- *      string capture_distance
- *      string crop
- *      string notes
- *      int clouds
- *      string detailed_weather_status
- *      int humidity
- *      int pressure
- *      int sea_level_pressure
- *      int last_3h_rain
- *      time reference
- *      time sunrise
- *      time sunset
- *      float kelvin_temp
- *      int visibility
- *      int weather code
- *      string country code
- *      time weather_info_reception
- *      string weather_loc_id
- *      string weather lat
- *      string weather lon
- *      string weather loc name
- *      string weather status
- *      int wind degree
- *      int wind speed
- *
- */
-
-
-/*
- * class session_data
- *  private
- *      string session_path (where the cameras are 3 folders)
- *  public
- *      std::vector<camera_data>
- *      session_meta
- */
-
-/*
- * class grabber_data
- *  private
- *      string data_folder //TopLevel data folder
- *  public
- *      session_data
- */
-
-/*
- * class grabber_dataset
- *  private
- *      std::vector<grabber_data> // Support for multiple data roots (start with one)
- *  public
- *    void GetByHierarchy()
- *    void GetByDay()
- *    void GetByImage()
- *    void GetByWhyCON()
- *    void GetByStartTime()
- *    void GetByDataSet()
- *    void GetByWeather()
- *    void GetByWeather()
-*/
+        std::string root_, index_file_;
+        FileNames file_names_;
+        std::vector<DataCapture> captures_;
+        std::unordered_map<std::string, size_t> paths_;
+        std::unordered_map<int, std::vector<size_t>> markers_;
+    };
 };
 
 
@@ -0,0 +1,68 @@
+#ifndef STRAWBERRYDATA_FRAMEMONITOR_H
+#define STRAWBERRYDATA_FRAMEMONITOR_H
+
+#include <array>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+#include <librealsense2/rs.hpp>
+
+/// Usage:
+///     Tracks the hardware frame counter and timestamp of one stream to find dropped frames and timing jitter
+///             StreamMonitor monitor("Depth", 1000.0 / fps);
+///             monitor.Update(frame); // for every frame received, never allocates
+///             monitor.Dropped(), monitor.DropRate(), monitor.JitterMean()
+
+class StreamMonitor {
+public:
+    explicit StreamMonitor(const char *name = "", double expected_period_ms = 0);
+    void Reset(double expected_period_ms);
+
+    // Returns the number of frames missing between this frame and the previous one
+    long long Update(const rs2::frame &frame);
+
+    const char *GetName() const;
+    uint64_t Received() const;
+    uint64_t Dropped() const;
+    uint64_t Gaps() const;
+    double DropRate() const;
+    double JitterMean() const;
+    double JitterMax() const;
+    long long LastCounter() const;
+
+    // Rolling window over the last kWindow received frames, each slot holds the frames missing before it
+    static constexpr int kWindow = 128;
+private:
+    const char *name_;
+    double expected_period_ms_;
+
+    long long last_counter_ = -1;
+    double last_timestamp_ms_ = 0;
+    uint64_t received_ = 0, dropped_ = 0, gaps_ = 0;
+    double jitter_sum_ms_ = 0, jitter_max_ms_ = 0;
+    uint64_t jitter_samples_ = 0;
+
+    std::array<uint32_t, kWindow> window_{};
+    int window_index_ = 0, window_fill_ = 0;
+    uint64_t window_dropped_ = 0;
+};
+
+// Monitors every stream of a camera, the order matches FrameMonitor::Stream
+class FrameMonitor {
+public:
+    enum Stream : int { DEPTH, COLOUR, IR_LEFT, IR_RIGHT, COUNT };
+
+    explicit FrameMonitor(double depth_period_ms = 0, double colour_period_ms = 0);
+    void Reset(double depth_period_ms, double colour_period_ms);
+    long long Update(Stream stream, const rs2::frame &frame);
+    const StreamMonitor &Get(Stream stream) const;
+    uint64_t Dropped() const;
+
+    void Print(std::ostream &out, const std::string &serial_number) const;
+    void WriteCsv(std::ostream &csv) const;
+private:
+    std::array<StreamMonitor, COUNT> streams_;
+};
+
+#endif //STRAWBERRYDATA_FRAMEMONITOR_H
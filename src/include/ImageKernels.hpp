@@ -0,0 +1,59 @@
+#ifndef STRAWBERRYDATA_IMAGEKERNELS_H
+#define STRAWBERRYDATA_IMAGEKERNELS_H
+
+#include <cstddef>
+#include <cstdint>
+
+/// Usage:
+///     Small per frame image kernels used by the capture triggers and quality checks, SSE2 on x86 with a scalar
+///     fallback (the *Scalar versions are kept for other targets and for kernel_benchmark comparisons)
+///             ImageKernels::Decimate(ir, width, height, stride, 1, 0, 8, thumbnail);
+///             double score = ImageKernels::MeanAbsDifference(thumbnail, reference, size);
+
+namespace ImageKernels {
+    // Point samples every step-th pixel of one channel into a dense (width / step) x (height / step) image
+    void Decimate(const uint8_t *src, int width, int height, int stride, int channels, int channel, int step,
+                  uint8_t *dst);
+
+    // Mean absolute difference of two 8 bit buffers (0 - 255)
+    double MeanAbsDifference(const uint8_t *a, const uint8_t *b, size_t size);
+    double MeanAbsDifferenceScalar(const uint8_t *a, const uint8_t *b, size_t size);
+
+    // Variance of the 4 neighbour Laplacian over the interior of a dense 8 bit image, low when blurred
+    double LaplacianVariance(const uint8_t *src, int width, int height);
+    double LaplacianVarianceScalar(const uint8_t *src, int width, int height);
+
+    // Dense mask of one channel, 1 where the pixel is below level and 0 elsewhere
+    void Threshold(const uint8_t *src, int width, int height, int stride, uint8_t level, uint8_t *dst);
+    void ThresholdScalar(const uint8_t *src, int width, int height, int stride, uint8_t level, uint8_t *dst);
+
+    // 256 bin histogram of an 8 bit buffer (overwrites histogram)
+    void Histogram(const uint8_t *src, size_t size, uint32_t histogram[256]);
+
+    // Pixels of a 16 bit image that are not 0, i.e. depth pixels with a measurement
+    size_t CountNonZero(const uint16_t *src, int width, int height, int stride);
+    size_t CountNonZeroScalar(const uint16_t *src, int width, int height, int stride);
+
+    // 64 bit difference hash (dHash) of a dense 8 bit image, area averaged to 9x8 and one bit per horizontal
+    // gradient sign, near identical images differ in a few bits
+    uint64_t DifferenceHash(const uint8_t *src, int width, int height);
+    int HammingDistance(uint64_t a, uint64_t b);
+
+    // Multi frame depth fusion of dense 16 bit depth, 0 is a pixel without a measurement. Accumulation streams one
+    // frame at a time into per pixel sum and count buffers (zeroed by the caller) so memory does not grow with the
+    // number of frames, a measurement further than tolerance (relative) from the pixel's running mean is rejected
+    void AccumulateDepth(const uint16_t *depth, size_t size, float tolerance, float *sum, float *count);
+    void AccumulateDepthScalar(const uint16_t *depth, size_t size, float tolerance, float *sum, float *count);
+
+    // Rounded mean of the accumulated measurements, 0 where fewer than min_count were kept
+    void ResolveDepthMean(const float *sum, const float *count, size_t size, int min_count, uint16_t *dst);
+    void ResolveDepthMeanScalar(const float *sum, const float *count, size_t size, int min_count, uint16_t *dst);
+
+    // Per pixel median of the measurements in frame_count frames (mean of the middle two for an even number), 0 where
+    // fewer than min_count frames measured the pixel. Needs every frame at once, at most kMaxMedianFrames
+    constexpr int kMaxMedianFrames = 16;
+    void MedianDepth(const uint16_t *const *frames, int frame_count, size_t size, int min_count, uint16_t *dst);
+    void MedianDepthScalar(const uint16_t *const *frames, int frame_count, size_t size, int min_count, uint16_t *dst);
+}
+
+#endif //STRAWBERRYDATA_IMAGEKERNELS_H
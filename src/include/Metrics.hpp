@@ -0,0 +1,140 @@
+#ifndef STRAWBERRYDATA_METRICS_H
+#define STRAWBERRYDATA_METRICS_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/// Usage:
+///     Lightweight instrumentation of the capture and save path, keyed by camera serial and stage
+///             CameraMetrics *metrics = Metrics::GetInstance()->Camera(serial_number);
+///             { ScopedTimer timer(metrics, Stage::WRITE_COLOUR); cv::imwrite(...); }
+///             metrics->Add(Counter::FRAMES);
+///     Everything is a no-op (one relaxed load) unless Metrics::SetEnabled(true) has been called
+
+enum class Stage : int {
+    WAIT_FOR_FRAMES, COLOURISE, POINT_CLOUD, QUALITY, CREATE_DIRECTORIES, WRITE_DEPTH, WRITE_COLOURED_DEPTH, WRITE_COLOUR,
+    WRITE_IR_LEFT, WRITE_IR_RIGHT, EXPORT_PLY, WRITE_METADATA, WRITE_DATA, REATTACH, STABILISE_EXPOSURE,
+    FUSE_DEPTH, EXPOSURE_BRACKET, MERGE_EXPOSURES, COUNT
+};
+
+enum class Counter : int { FRAMES, INVALID_FRAMES, DROPPED_FRAMES, SAVES, BYTES_WRITTEN, QUALITY_SKIPS, DUPLICATE_SKIPS,
+                           REATTACHES, COUNT };
+
+// Process wide values that are always maintained since updates are rare
+enum class Gauge : int { CAMERAS_CONNECTED, SAVE_QUEUE_DEPTH, COUNT };
+
+const char *StageToString(Stage stage);
+const char *CounterToString(Counter counter);
+const char *GaugeToString(Gauge gauge);
+
+// HDR style histogram: values below 32 are exact, above that every power of two is split into 16 linear
+// sub buckets (at most ~6% relative error) so nanoseconds to hours fit in a fixed array of atomics
+class LatencyHistogram {
+public:
+    LatencyHistogram();
+    void Record(uint64_t value);
+    void Reset();
+    uint64_t Count() const;
+    uint64_t Sum() const;
+    uint64_t Max() const;
+    double Mean() const;
+    uint64_t Percentile(double percentile) const;
+
+    static constexpr int kSubBucketBits = 5;
+    static constexpr int kSubBucketHalf = 1 << (kSubBucketBits - 1);
+    static constexpr int kBucketCount = (64 - kSubBucketBits + 1) * kSubBucketHalf + kSubBucketHalf;
+private:
+    static int BucketIndex(uint64_t value);
+    static uint64_t BucketUpperBound(int index);
+
+    std::array<std::atomic<uint64_t>, kBucketCount> buckets_;
+    std::atomic<uint64_t> count_, sum_, max_;
+};
+
+class CameraMetrics {
+public:
+    CameraMetrics(std::string serial_number, int slot);
+    void Record(Stage stage, uint64_t nanoseconds);
+    void Add(Counter counter, uint64_t value = 1);
+    void AddBytes(Stage stage, uint64_t bytes);
+    uint64_t Count(Counter counter) const;
+    uint64_t Bytes(Stage stage) const;
+    const LatencyHistogram &Histogram(Stage stage) const;
+    const std::string &GetSerialNumber() const;
+    void Reset();
+private:
+    std::string serial_number_;
+    int slot_;
+    std::array<LatencyHistogram, static_cast<int>(Stage::COUNT)> histograms_;
+};
+
+class Metrics {
+public:
+    static Metrics *GetInstance();
+    static bool Enabled() { return enabled_.load(std::memory_order_relaxed); }
+    static void SetEnabled(bool enabled);
+
+    // Returned pointers stay valid for the life of the process so reconnecting cameras keep their history
+    CameraMetrics *Camera(const std::string &serial_number);
+    std::vector<CameraMetrics *> Cameras();
+    void Dump(std::ostream &out);
+    void Reset();
+
+    static void AddGauge(Gauge gauge, int64_t value);
+    static void SetGauge(Gauge gauge, int64_t value);
+    static int64_t GetGauge(Gauge gauge);
+
+    // Counters live in per-thread shards so the hot path never contends on a shared cache line
+    static constexpr int kMaxCameras = 32;
+    static constexpr int kShardValues = static_cast<int>(Counter::COUNT) + static_cast<int>(Stage::COUNT);
+    struct CounterShard {
+        std::array<std::array<std::atomic<uint64_t>, kShardValues>, kMaxCameras> values;
+        // Set before the shard is published, shards are never removed from the list
+        CounterShard *next = nullptr;
+        CounterShard();
+    };
+    static CounterShard *LocalShard();
+    uint64_t SumShards(int slot, int index);
+    void ResetShards(int slot);
+private:
+    Metrics() = default;
+    CounterShard *AcquireShard();
+    void ReleaseShard(CounterShard *shard);
+    friend struct ShardHandle;
+
+    static std::atomic<bool> enabled_;
+    static std::array<std::atomic<int64_t>, static_cast<int>(Gauge::COUNT)> gauges_;
+    std::mutex lock_;
+    std::map<std::string, std::unique_ptr<CameraMetrics>> cameras_;
+
+    // Every shard ever created, readers walk it without a lock. Exited threads' shards are reused (free_lock_ is only
+    // taken on a thread's first increment and on its exit)
+    std::atomic<CounterShard *> shards_{nullptr};
+    std::mutex free_lock_;
+    std::vector<CounterShard *> free_shards_;
+};
+
+// Records the scope duration into a stage histogram and the trace timeline, the clock is only read when metrics or
+// tracing are enabled
+class ScopedTimer {
+public:
+    ScopedTimer(CameraMetrics *metrics, Stage stage);
+    ~ScopedTimer();
+    ScopedTimer(const ScopedTimer&) = delete;
+    void operator=(const ScopedTimer&) = delete;
+private:
+    CameraMetrics *metrics_;
+    Stage stage_;
+    bool timed_, traced_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+#endif //STRAWBERRYDATA_METRICS_H
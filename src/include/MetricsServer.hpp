@@ -0,0 +1,40 @@
+#ifndef STRAWBERRYDATA_METRICSSERVER_H
+#define STRAWBERRYDATA_METRICSSERVER_H
+
+#include <chrono>
+#include <map>
+#include <string>
+
+#include "ThreadClass.hpp"
+#include "Metrics.hpp"
+
+/// Usage:
+///     Serves the Metrics registry in Prometheus text format on http://<address>:<port>/metrics
+///             MetricsServer server("127.0.0.1", 9464);
+///             curl -s http://127.0.0.1:9464/metrics
+///     Only reads atomics and the lock free list of counter shards, so a scrape never blocks a counter increment
+
+class MetricsServer : ThreadClass {
+public:
+    MetricsServer(std::string address, int port);
+    ~MetricsServer() override;
+    std::string Render();
+private:
+    const void Setup() override;
+    const void Loop() override;
+    void HandleClient(int client);
+    std::string DiskPath();
+
+    std::string address_;
+    int port_;
+    int socket_ = -1;
+
+    // Previous scrape used to derive the per camera rates
+    struct Sample {
+        uint64_t frames = 0, bytes = 0;
+        std::chrono::steady_clock::time_point time;
+    };
+    std::map<std::string, Sample> last_samples_;
+};
+
+#endif //STRAWBERRYDATA_METRICSSERVER_H
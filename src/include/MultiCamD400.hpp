@@ -1,15 +1,30 @@
 #ifndef STRAWBERRYDATA_MULTICAMD400_H
 #define STRAWBERRYDATA_MULTICAMD400_H
 
+#include <functional>
 #include <librealsense2/rs.hpp>
 #include "ThreadClass.hpp"
+#include "Camera.hpp"
 #include "RealSenseD400.hpp"
 #include "ConfigManager.hpp"
+#include "WorkerPool.hpp"
+#include "ConfigWatcher.hpp"
+#include "QualityGate.hpp"
 
 class MultiCamD400 : ThreadClass {
 public:
     explicit MultiCamD400(unsigned int hz=60);
+    ~MultiCamD400() override;
+    // A serial number and how to create its camera, creating one blocks on the device (USB transfers, first frames)
+    struct PendingCamera {
+        std::string serial_number;
+        std::function<Camera*()> create;
+        rs2::device device; // Physical cameras only, resumes a camera detached by hot-plug instead of creating it
+    };
+
     const void AddDevice(rs2::device dev);
+    const void AddCamera(const std::string &serial_number, const std::function<Camera*()> &create);
+    const void AddCameras(const std::vector<PendingCamera> &pending);
     const void RemoveDevice(const rs2::event_information& info);
     const void SaveFrames();
     const void SaveFrames(int index);
@@ -21,28 +36,64 @@ public:
     const void UpdateDataConfiguration(std::string data_name, std::string data_root);
     const bool CamerasAvailable();
     const void Pause(bool pause=true);
+    const void PrintFrameStatistics();
+    const void StartRecording();
+    const void StopRecording();
+    const bool Recording();
+    const void SetRollingCapture(bool enabled);
+    const bool RollingCapture();
+    const void SetPairedCapture(bool enabled);
+    const bool PairedCapture();
+    const void SetDepthFusion(bool enabled);
+    const bool DepthFusion();
+    const void SetExposureBracket(bool enabled);
+    const bool ExposureBracket();
 
     // Utility function for calling methods
     void Available();
     bool initialised = false;
 private:
-    std::map<std::string, RealSenseD400*> cameras_;
+    using CameraMap = std::map<std::string, std::unique_ptr<Camera>>;
+    CameraMap cameras_;
+
+    // Unplugged cameras keep their configuration and dataset until the same serial number is plugged in again
+    CameraMap detached_;
+
+    // Typed config.json, validated once in Setup, every camera is created with its own entry
+    std::shared_ptr<const CaptureSettings> settings_;
+
+    // Saving config.json applies the changed settings to the running cameras (config-reload)
+    std::unique_ptr<ConfigWatcher> config_watcher_;
+    const void ReloadConfig(const ConfigSnapshot &previous, const ConfigSnapshot &current);
+    PendingCamera PendingDevice(rs2::device dev);
+    const void AddVirtualCameras(const std::vector<VirtualCameraSettings> &cameras,
+                                 std::vector<PendingCamera> &pending);
     const void Setup() override;
     const void Loop() override;
     bool loop_paused_;
+    bool recording_ = false;
 
-    // Flip guard to toggle between two values on scope/set default value
-    //  Example set value to true flip_guard<bool>(&value, true) until it goes out of scope and then set to false
-    //  Resets value to start value at the end (if value of v and s are the same this does nothing) unless e is defined
-    template <typename T>
-    class flip_guard {
-        T * f, fs, fe;
-    public:
-        flip_guard(T *v) {f = v; fs = *v;}
-        flip_guard(T *v, T s) : flip_guard(v) {fs = s; fe = *v == s == s; *f = fs;}
-        flip_guard(T *v, T s, T e) : flip_guard(v, s) {fe = e;}
-        ~flip_guard() {*f = fe;}
-    };
+    // Rolling capture saves on an interval or when the scene changes, written by writer_ off the acquisition thread
+    std::unique_ptr<WorkerPool> writer_;
+    bool rolling_capture_ = false;
+    bool paired_capture_ = false;
+    bool depth_fusion_ = false;
+    bool exposure_bracket_ = false;
+    std::chrono::steady_clock::time_point last_rolling_save_;
+    const void EvaluateTriggers();
+    const void QueueSave(const std::string &trigger);
+
+    // Quality gate policy, cameras flag frames that fail and saves either record them anyway, wait up to wait-ms for
+    // a passing frame (saving the last one otherwise) or skip the save
+    QualityGate quality_gate_;
+    const bool QualityPassed(int index = -1);
+    const bool AwaitQuality(int index = -1);
+    const void SkipSave(const std::string &trigger, int index = -1);
+
+    // Frame grouping across cameras, counter offsets are relative to the reference (master) camera
+    std::map<std::string, long long> counter_offsets_;
+    const void AlignFrames();
+    Camera *ReferenceCamera();
 };
 
 
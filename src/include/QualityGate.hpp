@@ -0,0 +1,33 @@
+#ifndef STRAWBERRYDATA_QUALITYGATE_H
+#define STRAWBERRYDATA_QUALITYGATE_H
+
+#include <chrono>
+
+/// Usage:
+///     Decides what a rolling capture trigger does with frames that fail the quality gate, without blocking the loop
+///             QualityGate gate(QualityGate::Policy::WAIT, 300);
+///             QualityGate::Decision decision = gate.Evaluate(!trigger.empty(), QualityPassed(), now);
+///     A failing trigger is held (HOLD) for up to wait_ms, then saved (WAIT) or skipped (SKIP). Every trigger gets
+///     the full wait, one that goes away before it ends clears the wait
+
+class QualityGate {
+public:
+    enum class Policy { RECORD, WAIT, SKIP };
+    enum class Decision { NONE, HOLD, SAVE, SKIP };
+
+    explicit QualityGate(Policy policy = Policy::RECORD, int wait_ms = 0);
+
+    Decision Evaluate(bool triggered, bool passed, std::chrono::steady_clock::time_point now);
+    void Reset();
+
+    Policy GetPolicy() const;
+    int GetWaitMs() const;
+    bool Waiting() const;
+private:
+    Policy policy_;
+    int wait_ms_;
+    bool waiting_ = false;
+    std::chrono::steady_clock::time_point wait_start_;
+};
+
+#endif //STRAWBERRYDATA_QUALITYGATE_H
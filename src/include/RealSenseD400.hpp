@@ -1,39 +1,108 @@
 #ifndef STRAWBERRYDATA_REALSENSED400_H
 #define STRAWBERRYDATA_REALSENSED400_H
 
+#include <deque>
 #include <string>
 #include <librealsense2/rs.hpp>
 #include <librealsense2/rs_advanced_mode.hpp>
 #include <opencv2/opencv.hpp>
 
+#include "Camera.hpp"
 #include "ThreadClass.hpp"
 #include "Strawberry.hpp"
+#include "Metrics.hpp"
+#include "FrameMonitor.hpp"
 
-class RealSenseD400 {
+class RealSenseD400 : public Camera {
 public:
     explicit RealSenseD400(rs2::device dev);
-    ~RealSenseD400();
+    RealSenseD400(rs2::device dev, const CameraSettings &settings);
+    ~RealSenseD400() override;
     void PrintDeviceInfo();
-    void StabiliseExposure(int stabilization_window = 30);
-    const void SetLaser(bool status, float power=-4);
-    void WriteData();
-    const void WaitForFrames();
+    void StabiliseExposure(int stabilization_window = 30) override;
+    const void SetLaser(bool status, float power=-4) override;
+    void WriteData() override;
+    std::shared_ptr<Capture> TakeCapture(const std::string &trigger = "manual") override;
+    void WriteCapture(Capture &capture) override;
+    const void WaitForFrames() override;
     rs2::pipeline_profile GetProfile();
-    void CloseGUI();
-    void ConfigureDataset(std::string data_name = "", std::string data_root = "");
-private:
+    void CloseGUI() override;
+    void ConfigureDataset(std::string data_name = "", std::string data_root = "") override;
+    void ApplySettings(const CameraSettings &settings) override;
+    bool WasRemoved(const rs2::event_information &info) override;
+    void Detach() override;
+    bool Reattach(rs2::device dev) override;
+    bool SetPairedCapture(bool enabled) override;
+    bool SetDepthFusion(bool enabled) override;
+    bool SetExposureBracket(bool enabled) override;
+
+    // Capture triggers
+    void SetChangeDetection(bool enabled, bool colour = false, int decimation = 8) override;
+    double GetChangeScore() override;
+    const FrameQuality &GetQuality() override;
+
+    // Recording
+    bool StartRecording() override;
+    void StopRecording() override;
+    bool Recording() override;
+
+    // Inter-camera synchronisation
+    const std::string &GetSerialNumber() override;
+    SyncMode GetSyncMode() override;
+    bool HardwareSynced() override;
+    long long GetFrameCounter() override;
+    double GetFrameTimestamp() override;
+    double GetFramePeriod() override;
+    void SetCaptureGroup(long long group, bool hardware_aligned) override;
+
+    // Frame loss
+    void PrintFrameStatistics() override;
+
+    // Writes every metadata attribute the frame supports as a CSV (also used by the bag converter)
+    static void WriteVideoFrameMetaData(const std::string &file_name, const rs2::video_frame &frame);
+protected:
+    // Used by the virtual backends: binds to an already created device without configuring or starting it, the
+    // derived constructor starts its frame source and then calls Open()
+    RealSenseD400(rs2::device dev, const std::string &serial_number);
+    RealSenseD400(rs2::device dev, const std::string &serial_number, const CameraSettings &settings);
+    void Open();
+
+    // Source of coherent frame sets, the pipeline unless a backend feeds frames itself
+    virtual rs2::frameset NextFrameset();
+
+    // Restarts the pipeline with the streams of settings_, returns false when they can not be changed
+    virtual bool RestartStreams();
+    // Starts the pipeline with cfg again after a stop or a failed restart, a camera that can not stays stopped
+    bool ResumeStreams();
+
+    // Start up timing, each stage is the time since the previous one and Open reports them all on one line
+    std::chrono::steady_clock::time_point stage_start_ = std::chrono::steady_clock::now();
+    std::vector<std::pair<std::string, double>> startup_stages_;
+    void StartupStage(const std::string &stage);
+    double ReportStartup(const std::string &action);
+    std::chrono::steady_clock::time_point detached_at_;
+
     // Device
     rs2::device dev_;
-    rs400::advanced_mode advanced_dev_;
 
     rs2::depth_sensor depth_sensor_;
     float depth_sensor_scale_;
     std::string serial_number_;
 
+    // Streams, sensor options, file names and paths (config.json with this camera's overrides)
+    CameraSettings settings_;
+
     // Pipeline configuration
     rs2::config cfg;
     rs2::pipeline pipe_;
     rs2::pipeline_profile selection;
+    bool pipeline_started_ = false;
+    void EnableStreams(rs2::config &config);
+
+    // Recording restarts the pipeline with a recorder attached, frames are compressed and written by librealsense
+    bool recording_ = false;
+    std::string recording_path_;
+    std::chrono::steady_clock::time_point recording_start_;
 
     // Point cloud
     rs2::colorizer color_map;
@@ -52,6 +121,14 @@ private:
 
     rs2::points point_cloud_;
 
+    // Synchronisation state (frame counter and host timestamp of the current depth frame)
+    SyncMode sync_mode_ = SyncMode::DEFAULT;
+    bool hardware_synced_ = false;
+    long long frame_counter_ = -1, capture_group_ = -1;
+    bool capture_hardware_aligned_ = false;
+    double frame_timestamp_ = 0, frame_period_ = 0;
+    void SetFramePeriods(int depth_fps, int colour_fps);
+
     // OpenCV Frames
     cv::Mat colour_mat_, depth_mat_, c_depth_mat_, lir_mat_, rir_mat_;
 
@@ -62,18 +139,101 @@ private:
     Strawberry::DataStructure data_structure_;
 
     // Visualisation flags
-    bool gui_enabled_;
+    bool gui_enabled_ = false;
+
+    // Instrumentation (shared by every instance with the same serial number)
+    CameraMetrics *metrics_ = nullptr;
+
+    // Frame loss detection
+    FrameMonitor frame_monitor_;
+    std::chrono::steady_clock::time_point last_drop_report_;
+    int max_frame_attempts_ = 10;
+
+    // Change detection, a decimated copy of every frame compared with the one taken at the last save
+    bool change_detection_ = false, change_on_colour_ = false;
+    int change_decimation_ = 8;
+    std::vector<uint8_t> thumbnail_, reference_thumbnail_;
+    double change_score_ = 0;
+    void UpdateChangeScore();
+
+    // Quality gate, sharpness and exposure on a decimated image plus the depth fill, checked against the thresholds
+    bool quality_enabled_ = false, quality_on_colour_ = true;
+    int quality_decimation_ = 4;
+    double min_sharpness_ = 0, max_clipped_ = 1, min_depth_valid_ = 0;
+    std::vector<uint8_t> quality_thumbnail_;
+    FrameQuality quality_;
+    void UpdateQuality();
+
+    // Near duplicate suppression, dHash of every save compared with the last duplicate_history_ saved hashes
+    bool duplicate_enabled_ = false, duplicate_skip_ = false;
+    size_t duplicate_history_ = 8;
+    int duplicate_max_distance_ = 4;
+    std::deque<uint64_t> saved_hashes_;
+    std::vector<uint8_t> hash_thumbnail_;
+    void HashCapture(Capture &capture);
+
+    // Paired capture, RS2_OPTION_EMITTER_ON_OFF alternates the emitter every frame and the latest frames of either
+    // state are kept. A save pairs them when their frame counters are at most paired_max_gap_ apart
+    struct EmitterFrames {
+        rs2::video_frame depth{nullptr}, colour{nullptr}, lir{nullptr}, rir{nullptr}, c_depth{nullptr};
+        rs2::points point_cloud;
+        long long frame_counter = -1;
+    };
+    bool paired_capture_ = false;
+    int paired_max_gap_ = 1;
+    EmitterFrames emitter_on_, emitter_off_;
+    // 1 emitter on, 0 off, -1 without metadata. EmitterMode is the raw metadata value (-1 without)
+    static int EmitterState(const rs2::frame &frame);
+    static long long EmitterMode(const rs2::frame &frame);
+
+    // Depth fusion, a save waits for fusion_frames_ consecutive frames and replaces the depth (and the colourised
+    // depth and point cloud made from it) with their per pixel median or outlier rejecting mean. The colour and IR
+    // come from the middle frame of the window
+    bool depth_fusion_ = false, fusion_median_ = true;
+    int fusion_frames_ = 8, fusion_min_valid_ = 2;
+    float fusion_tolerance_ = 0.02f;
+    std::vector<float> fusion_sum_, fusion_count_;
+    void FuseDepth(Capture &capture);
+
+    // Exposure bracket, a save switches the colour sensor to manual exposure and steps through bracket_exposures_
+    // (RS2_OPTION_EXPOSURE units). The next value is set as soon as a frame reports the current one in its metadata,
+    // frames still showing the previous exposure are skipped, at most bracket_max_frames_ are read
+    bool exposure_bracket_ = false, merge_bracket_ = true;
+    std::vector<float> bracket_exposures_{20, 80, 320};
+    double bracket_tolerance_ = 0.05, bracket_metadata_scale_ = 1;
+    int bracket_max_frames_ = 12;
+    void BracketExposure(Capture &capture);
 
+private:
     // Utility
-    void WriteVideoFrameMetaData(const std::string &file_name, rs2::video_frame &frame);
+    void WriteImage(Strawberry::DataStructure &data_structure, RsType type, const rs2::video_frame &frame, int cv_type,
+                    Stage stage, const std::string &suffix = "");
     bool WindowsAreOpen();
     void Visualise();
-    bool DeviceInAdvancedMode();
+    bool DeviceInAdvancedMode(rs400::advanced_mode &advanced_dev);
+
+    // Enabling advanced mode resets the device, it comes back as a new device with the same serial number
+    static const int kReconnectTimeout = 15;
+    rs2::device WaitForReconnect();
+
+    // Advanced mode preset, skipped when the cache shows the device already has it
+    void LoadPreset();
+    static nlohmann::json ReadPresetCache(const std::string &file_name);
+    static std::string Fnv1a(const std::string &data);
     void SetSensorOptions();
+    bool SetOption(const rs2::sensor &sensor, rs2_option option, float value, std::ostream &log);
+
+    // Exposure, gain and white balance from the frame metadata, settled when no value moved more than tolerance
+    static bool ExposureState(const rs2::frameset &frames, std::vector<double> &state);
+    static bool ExposureSettled(const std::vector<double> &previous, const std::vector<double> &current,
+                                double tolerance);
+    void SetSyncMode();
+    void MonitorFrames();
 
     const void Setup();
 
     void WriteDeviceData(const std::string &file_name);
+    void WriteCaptureMetaData(const std::string &file_name, const Capture &capture);
 };
 
 #endif //STRAWBERRYDATA_REALSENSED400_H
@@ -0,0 +1,200 @@
+#ifndef STRAWBERRYDATA_SETTINGS_H
+#define STRAWBERRYDATA_SETTINGS_H
+
+#include <map>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <json.hpp>
+
+// "stream-depth" (depth and both IR streams) and "stream-colour"
+struct StreamSettings {
+    int width = 1280, height = 720, frame_rate = 6;
+
+    bool operator==(const StreamSettings &other) const {
+        return std::tie(width, height, frame_rate) == std::tie(other.width, other.height, other.frame_rate);
+    }
+    bool operator!=(const StreamSettings &other) const { return !(*this == other); }
+};
+
+// "options", applied to every sensor that supports them
+struct SensorSettings {
+    bool auto_exposure = true, back_light_compensation = true, auto_white_balance = true;
+
+    bool operator==(const SensorSettings &other) const {
+        return std::tie(auto_exposure, back_light_compensation, auto_white_balance) ==
+               std::tie(other.auto_exposure, other.back_light_compensation, other.auto_white_balance);
+    }
+    bool operator!=(const SensorSettings &other) const { return !(*this == other); }
+};
+
+// "file-names", the defaults match config.json
+struct FileNameSettings {
+    std::string video_frame_ext = ".png", point_cloud_ext = ".ply", metadata_ext = "_meta.csv";
+    std::string recording_ext = ".bag";
+    std::string depth = "depth_16UC1", coloured_depth = "colourised_depth_8UC3", colour = "rgb_8UC3";
+    std::string ir = "ir_8UC1", ir_left = "ir_left_8UC1", ir_right = "ir_right_8UC1";
+    std::string point_cloud = "point_cloud", capture = "capture", recording = "recording";
+
+    bool operator==(const FileNameSettings &other) const {
+        return std::tie(video_frame_ext, point_cloud_ext, metadata_ext, recording_ext, depth, coloured_depth, colour,
+                        ir, ir_left, ir_right, point_cloud, capture, recording) ==
+               std::tie(other.video_frame_ext, other.point_cloud_ext, other.metadata_ext, other.recording_ext,
+                        other.depth, other.coloured_depth, other.colour, other.ir, other.ir_left, other.ir_right,
+                        other.point_cloud, other.capture, other.recording);
+    }
+    bool operator!=(const FileNameSettings &other) const { return !(*this == other); }
+};
+
+// "save-path-prefix" and "project-name"
+struct PathSettings {
+    std::string save_path_prefix, project_name = "data";
+
+    bool operator==(const PathSettings &other) const {
+        return save_path_prefix == other.save_path_prefix && project_name == other.project_name;
+    }
+    bool operator!=(const PathSettings &other) const { return !(*this == other); }
+};
+
+// "advanced-preset", an rs400 advanced mode JSON (e.g. high_density_high_res.json) loaded at start up, an empty path
+// keeps the device's own parameters. cache records what was applied so an identical preset is not loaded again
+struct PresetSettings {
+    std::string path, cache = "advanced_preset_cache.json";
+
+    bool operator==(const PresetSettings &other) const { return path == other.path && cache == other.cache; }
+    bool operator!=(const PresetSettings &other) const { return !(*this == other); }
+};
+
+// "stabilise-exposure-convergence", when the exposure, gain and white balance metadata count as settled
+struct ConvergenceSettings {
+    double tolerance = 0.02;
+    int stable_frames = 3, timeout_ms = 5000;
+};
+
+// "quality-gate", sharpness, clipping and depth coverage a save has to reach. The policy (record, wait or skip) decides
+// what happens to a failing save
+struct QualitySettings {
+    bool enabled = false, on_colour = true;
+    int decimation = 4, wait_ms = 300;
+    double min_sharpness = 0, max_clipped = 1, min_depth_valid = 0;
+    std::string policy = "record";
+};
+
+// "duplicate-suppression", a save is flagged (or skipped) when its hash is within max_distance of a recent save
+struct DuplicateSettings {
+    bool enabled = false, skip = false;
+    int history = 8, max_distance = 4;
+};
+
+// "paired-capture", saves one emitter on and one emitter off frame set
+struct PairedSettings {
+    bool enabled = false;
+    int max_frame_gap = 1;
+};
+
+// "depth-fusion", saves the median (or mean) of several depth frames
+struct FusionSettings {
+    bool enabled = false, median = true;
+    int frames = 8, min_valid = 2;
+    double tolerance = 0.02;
+};
+
+// "exposure-bracket", saves one colour frame per manual exposure
+struct BracketSettings {
+    bool enabled = false, merge = true;
+    std::vector<double> exposures{20, 80, 320};
+    double tolerance = 0.05, metadata_scale = 1;
+    int max_frames = 12;
+};
+
+// "rolling-capture", saves every interval_ms and when the change score of the stream reaches change_threshold
+struct RollingSettings {
+    bool enabled = false, on_colour = false;
+    int interval_ms = 0, min_gap_ms = 500, decimation = 8;
+    double change_threshold = 12;
+};
+
+// "inter-cam-sync", the master drives the others, frames are aligned in software without one
+struct SyncSettings {
+    bool enabled = false;
+    std::string master;
+    int alignment_attempts = 3;
+};
+
+// "async-writer", the threads encoding saves and how many saves may wait for them
+struct WriterSettings {
+    int threads = 2, queue = 16;
+};
+
+// One entry of "cameras.virtual". A size of 0 uses the camera's stream settings
+struct VirtualCameraSettings {
+    std::string type, path, serial;
+    int count = 1, width = 0, height = 0, colour_width = 0, colour_height = 0, frame_rate = 0;
+    bool repeat = true, real_time = true;
+};
+
+// "cameras", physical cameras can be turned off to run only recorded or synthetic ones
+struct CameraSourceSettings {
+    bool physical = true;
+    std::vector<VirtualCameraSettings> virtual_cameras;
+};
+
+// "config-reload"
+struct ReloadSettings {
+    bool enabled = false;
+    int debounce_ms = 250;
+};
+
+// Everything one camera is configured with, the global settings with its "camera-overrides" entry applied
+struct CameraSettings {
+    StreamSettings depth{1280, 720, 6}, colour{1920, 1080, 6};
+    SensorSettings options;
+    PresetSettings preset;
+    FileNameSettings file_names;
+    PathSettings paths;
+    bool gui_enabled = true, stabilise_exposure = false;
+    int stabilise_exposure_count = 6;
+    ConvergenceSettings convergence;
+    QualitySettings quality;
+    DuplicateSettings duplicates;
+    PairedSettings paired;
+    FusionSettings fusion;
+    BracketSettings bracket;
+    RollingSettings rolling;
+    SyncSettings sync;
+    WriterSettings writer;
+    CameraSourceSettings cameras;
+    ReloadSettings reload;
+};
+
+/// Usage:
+///     Typed view of config.json, parsed and validated once per config version so consumers read plain fields
+///     instead of looking up json by string key
+///             std::shared_ptr<const CaptureSettings> settings = CaptureSettings::Current();
+///             const CameraSettings &camera = settings->Camera("8224");
+///             config.enable_stream(RS2_STREAM_DEPTH, camera.depth.width, camera.depth.height, ...);
+///     Missing settings keep their defaults. A wrong type, an out of range value or an unknown key (a typo) in one of
+///     the typed sections throws std::invalid_argument listing every problem, so a bad config fails at start up and
+///     not mid session. A camera can override any typed section, keys not given keep the global value:
+///             "camera-overrides": {"8224": {"stream-colour": {"frame-rate": 15}, "options": {"auto-exposure": false}}}
+class CaptureSettings {
+public:
+    static CaptureSettings Parse(const nlohmann::json &config);
+
+    // Settings of the current ConfigManager version, parsed again only after the config changed
+    static std::shared_ptr<const CaptureSettings> Current();
+
+    // The camera's settings, the global ones when it has no overrides
+    const CameraSettings &Camera(const std::string &serial_number) const;
+    const CameraSettings &Defaults() const;
+private:
+    static CameraSettings ParseCamera(const nlohmann::json &config, const std::string &prefix,
+                                      std::vector<std::string> &errors);
+
+    CameraSettings defaults_;
+    std::map<std::string, CameraSettings> cameras_;
+};
+
+#endif //STRAWBERRYDATA_SETTINGS_H
@@ -0,0 +1,53 @@
+#ifndef STRAWBERRYDATA_SIMILARITYINDEX_H
+#define STRAWBERRYDATA_SIMILARITYINDEX_H
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+/// Usage:
+///     Hamming radius queries over 64 bit perceptual hashes using multi-index hashing: the hash is split into
+///     max_radius + 1 chunks and every chunk is an exact lookup table. Two hashes within max_radius bits must agree
+///     on at least one whole chunk, so a query only checks the captures sharing one
+///             SimilarityIndex index;
+///             for (size_t i = 0; i < dataset.Size(); ++i) index.Insert(dataset[i].image_hash, i);
+///             index.Build(8);
+///             for (auto &match : index.Query(hash, 4)) ...       // {id, distance}, closest first
+///             for (auto &cluster : index.Cluster(4)) ...         // Ids connected by "within 4 bits"
+///     Queries above max_radius fall back to a linear scan of the distinct hashes (still only ~1 ms per million)
+///     A negative radius throws std::invalid_argument
+
+class SimilarityIndex {
+public:
+    struct Match {
+        size_t id;
+        int distance;
+    };
+
+    void Insert(uint64_t hash, size_t id);
+    void Build(int max_radius = 8);
+    std::vector<Match> Query(uint64_t hash, int radius) const;
+
+    // Single linkage clusters, largest first (singletons included)
+    std::vector<std::vector<size_t>> Cluster(int radius) const;
+
+    size_t Size() const;
+    size_t DistinctHashes() const;
+private:
+    // Indices into hashes_ within radius of hash
+    void Candidates(uint64_t hash, int radius, std::vector<uint32_t> &found) const;
+
+    std::vector<std::pair<uint64_t, size_t>> entries_;
+
+    // Built: distinct hashes with the ids sharing each one (ids_[offsets_[i]] to ids_[offsets_[i + 1]])
+    std::vector<uint64_t> hashes_;
+    std::vector<size_t> ids_, offsets_;
+
+    // One table per chunk, (chunk value, index into hashes_) sorted by value
+    int max_radius_ = -1;
+    std::vector<int> chunk_shift_, chunk_bits_;
+    std::vector<std::vector<std::pair<uint64_t, uint32_t>>> tables_;
+};
+
+#endif //STRAWBERRYDATA_SIMILARITYINDEX_H
@@ -8,9 +8,9 @@
 #include <librealsense2/rs.hpp>
 #include <boost/filesystem.hpp>
 #include <iomanip>
-#include "ConfigManager.hpp"
+#include "Settings.hpp"
 
-enum class RsType : int { DEPTH, COLOURED_DEPTH, COLOUR, IR, IR_LEFT, IR_RIGHT, POINT_CLOUD };
+enum class RsType : int { DEPTH, COLOURED_DEPTH, COLOUR, IR, IR_LEFT, IR_RIGHT, POINT_CLOUD, CAPTURE, RECORDING };
 
 namespace Strawberry {
 
@@ -19,10 +19,13 @@ namespace Strawberry {
         std::string data_set_name_ = "data";
         std::string serial_number_, date_, time_;
         std::string video_frame_ext = ".png", point_cloud_ext = ".ply", metadata_ext = "_meta.csv";
+        std::string recording_ext = ".bag";
         std::string depth_ = "depth_16UC1", coloured_depth_ =  "colourised_depth_8UC3", colour_ = "rgb_8UC3";
         std::string ir = "ir_8UC1", ir_left_ = "ir_left_8UC1", ir_right_ = "ir_right_8UC1", point_cloud_ =  "point_cloud";
-        std::string file_names_[7] = {depth_, coloured_depth_, colour_, ir, ir_left_, ir_right_, point_cloud_};
-        std::string ext_[3] = {video_frame_ext, point_cloud_ext, metadata_ext};
+        std::string capture_ = "capture", recording_ = "recording";
+        std::string file_names_[9] = {depth_, coloured_depth_, colour_, ir, ir_left_, ir_right_, point_cloud_, capture_,
+                                      recording_};
+        std::string ext_[4] = {video_frame_ext, point_cloud_ext, metadata_ext, recording_ext};
     };
 
     class DataStructure : GrabberFileNames {
@@ -32,14 +35,18 @@ namespace Strawberry {
         explicit DataStructure(std::string device_serial_number, std::string path_prefix = "./");
 
         const void UpdatePathPrefix(std::string path_prefix, std::string data_name = "");
-        const void UpdateFolderPaths(bool stop_at_folder_depth = false);
-        const std::string FilePath(RsType file_type, bool meta = false);
+        // A timestamp (ms since epoch) names the folders after a past capture instead of now, e.g. converting bags
+        const void UpdateFolderPaths(bool stop_at_folder_depth = false, double timestamp_ms = -1);
+        // A suffix tells several files of one type apart, e.g. "_exposure_0" gives rgb_8UC3_exposure_0.png
+        const std::string FilePath(RsType file_type, bool meta = false, const std::string &suffix = "");
 
-        const void SetFileConstructionNames(ConfigManager *config = nullptr);
+        // File names of the camera's settings, or the global ones
+        const void SetFileConstructionNames(const FileNameSettings &file_names);
+        const void SetFileConstructionNames();
 
         boost::filesystem::path parent_, folder_, sub_folder_;
     private:
-        const void UpdateTimestamp();
+        const void UpdateTimestamp(double timestamp_ms = -1);
 
     };
 };
@@ -0,0 +1,54 @@
+#ifndef STRAWBERRYDATA_SYNTHETICCAMERA_H
+#define STRAWBERRYDATA_SYNTHETICCAMERA_H
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <librealsense2/rs.hpp>
+#include <librealsense2/hpp/rs_internal.hpp>
+
+#include "RealSenseD400.hpp"
+
+// Software device with a D400 like stream layout, built before RealSenseD400 so it can be handed to its constructor
+struct SyntheticDevice {
+    SyntheticDevice(const std::string &serial_number, int width, int height, int colour_width, int colour_height,
+                    int fps);
+
+    rs2::software_device software_device_;
+    rs2::software_sensor software_depth_, software_colour_;
+    rs2::stream_profile depth_profile_, lir_profile_, rir_profile_, colour_profile_;
+    rs2::syncer sync_;
+
+    int width_, height_, colour_width_, colour_height_, fps_;
+};
+
+/// Usage:
+///     Generates moving depth, colour and IR frames without hardware (e.g. on CI), paced at the requested rate
+///             SyntheticCamera camera("synthetic-0", 1280, 720, 1920, 1080, 6);
+///     Each stream scrolls a precomputed pattern by a few pixels per frame so consecutive frames differ
+
+class SyntheticCamera : private SyntheticDevice, public RealSenseD400 {
+public:
+    SyntheticCamera(const std::string &serial_number, int width, int height, int colour_width, int colour_height,
+                    int fps);
+    ~SyntheticCamera() override;
+    bool WasRemoved(const rs2::event_information &info) override;
+    bool StartRecording() override;
+protected:
+    rs2::frameset NextFrameset() override;
+    bool RestartStreams() override;
+private:
+    // Patterns are twice the frame width, a frame is a window into them offset by the frame number
+    std::vector<uint16_t> depth_pattern_;
+    std::vector<uint8_t> ir_pattern_, colour_pattern_;
+    void GeneratePatterns();
+
+    void PushFrame(rs2::software_sensor &sensor, const rs2::stream_profile &profile, const uint8_t *pattern,
+                   int width, int height, int bpp, double timestamp);
+
+    std::chrono::steady_clock::time_point next_frame_;
+    long long frame_number_ = 0;
+    bool streaming_ = false;
+};
+
+#endif //STRAWBERRYDATA_SYNTHETICCAMERA_H
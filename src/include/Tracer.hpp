@@ -0,0 +1,79 @@
+#ifndef STRAWBERRYDATA_TRACER_H
+#define STRAWBERRYDATA_TRACER_H
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+/// Usage:
+///     Records begin/end timelines per thread that open in chrome://tracing or https://ui.perfetto.dev
+///             Tracer::SetEnabled(true);
+///             { TraceScope trace("wait_for_frames", serial_number); ... }
+///             Tracer::GetInstance()->Flush("grabber_trace.json");
+///     Names must be string literals (only the pointer is stored), the argument is copied
+
+struct TraceEvent {
+    const char *name;
+    char arg[24];
+    uint32_t thread_id;
+    uint64_t start_ns, duration_ns;
+    // Seqlock: 0 while the slot is being written, otherwise the index of the event + 1
+    std::atomic<uint64_t> sequence;
+};
+
+// Single producer ring, the oldest events are overwritten once a thread has recorded kCapacity of them
+class TraceBuffer {
+public:
+    static constexpr size_t kCapacity = 1 << 14;
+    void Push(const char *name, const char *arg, uint32_t thread_id, uint64_t start_ns, uint64_t end_ns);
+    template<typename F>
+    void ForEach(F &&f) const;
+private:
+    std::array<TraceEvent, kCapacity> events_{};
+    std::atomic<uint64_t> head_{0};
+};
+
+class Tracer {
+public:
+    static Tracer *GetInstance();
+    static bool Enabled() { return enabled_.load(std::memory_order_relaxed); }
+    static void SetEnabled(bool enabled);
+    static uint64_t Now();
+    static void SetThreadName(const std::string &name);
+
+    void Record(const char *name, const char *arg, uint64_t start_ns, uint64_t end_ns);
+    bool Flush(const std::string &file_name);
+private:
+    Tracer() = default;
+    struct ThreadState;
+    static ThreadState &Local();
+    TraceBuffer *AcquireBuffer(uint32_t &thread_id);
+    void ReleaseBuffer(TraceBuffer *buffer, uint32_t thread_id);
+
+    static std::atomic<bool> enabled_;
+    std::mutex lock_;
+    std::vector<std::unique_ptr<TraceBuffer>> buffers_;
+    std::vector<std::pair<TraceBuffer *, uint32_t>> free_buffers_;
+    std::map<uint32_t, std::string> thread_names_;
+    uint32_t next_thread_id_ = 1;
+};
+
+class TraceScope {
+public:
+    explicit TraceScope(const char *name, const std::string &arg = std::string());
+    ~TraceScope();
+    TraceScope(const TraceScope&) = delete;
+    void operator=(const TraceScope&) = delete;
+private:
+    const char *name_;
+    char arg_[24];
+    uint64_t start_ = 0;
+};
+
+#endif //STRAWBERRYDATA_TRACER_H
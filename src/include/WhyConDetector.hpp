@@ -0,0 +1,59 @@
+#ifndef STRAWBERRYDATA_WHYCONDETECTOR_H
+#define STRAWBERRYDATA_WHYCONDETECTOR_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// A detected marker, the id is 0 for a plain WhyCon marker (no code)
+struct WhyConMarker {
+    int id = 0;
+    float x = 0, y = 0;
+    float diameter = 0;
+};
+
+/// Usage:
+///     Finds WhyCon style markers, a black ring (outer diameter D) around a white disc of diameter D / 2, in an 8 bit
+///     image. Coded markers carry id_bits black or white sectors in a band between 0.2 D / 2 and 0.4 D / 2 from the
+///     centre, read clockwise with black as 1 and reduced to the smallest rotation so the id does not depend on how
+///     the marker is turned (a plain marker reads as 0)
+///             WhyConDetector detector;
+///             for (auto &marker : detector.Detect(ir.data, ir.cols, ir.rows, ir.step)) ...
+///     The image is thresholded (Otsu) into a mask with SSE2, dark and light regions are labelled as row runs in one
+///     pass and a ring is a dark region with a light region centred inside it. Keep one detector per thread, the
+///     buffers are reused between images
+
+class WhyConDetector {
+public:
+    explicit WhyConDetector(int id_bits = 8, int min_diameter = 12);
+    std::vector<WhyConMarker> Detect(const uint8_t *image, int width, int height, int stride);
+private:
+    struct Run {
+        int y, start, end;
+        uint32_t label;
+        bool dark;
+    };
+
+    // Raw moments of a labelled region, used for the centre and the ellipse axes
+    struct Region {
+        double area = 0, sx = 0, sy = 0, sxx = 0, syy = 0, sxy = 0;
+        int min_x, min_y, max_x, max_y;
+        bool dark;
+        void Add(const Region &other);
+    };
+
+    uint32_t Find(uint32_t label);
+    void Label(int width, int height);
+    // Reads the code band of the marker whose outer ellipse has the given centre, semi axes and orientation
+    int Decode(const uint8_t *image, int width, int height, int stride, double x, double y, double major,
+               double minor, double angle, uint8_t level);
+
+    int id_bits_, min_diameter_;
+    std::vector<uint8_t> mask_, thumbnail_;
+    std::vector<Run> runs_;
+    std::vector<uint32_t> parent_;
+    std::vector<int32_t> region_of_;
+    std::vector<Region> regions_;
+};
+
+#endif //STRAWBERRYDATA_WHYCONDETECTOR_H
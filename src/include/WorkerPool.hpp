@@ -0,0 +1,45 @@
+#ifndef STRAWBERRYDATA_WORKERPOOL_H
+#define STRAWBERRYDATA_WORKERPOOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/// Usage:
+///     Fixed set of worker threads draining a task queue
+///             WorkerPool pool(std::thread::hardware_concurrency(), 64);
+///             pool.Submit([frames]() { ... });  // Blocks while 64 tasks are already waiting
+///             pool.Wait();                      // Returns once every submitted task has finished
+///             if (!pool.TrySubmit(task)) ...       // Or drop the task instead of waiting
+///     Bounding the queue applies back pressure to the producer so queued frames can not exhaust memory
+
+class WorkerPool {
+public:
+    explicit WorkerPool(unsigned int threads = 0, size_t max_queue = 0, const std::string &name = "worker");
+    ~WorkerPool();
+    WorkerPool(const WorkerPool&) = delete;
+    void operator=(const WorkerPool&) = delete;
+
+    void Submit(std::function<void()> task);
+    // Never blocks, returns false when the queue is full
+    bool TrySubmit(std::function<void()> task);
+    void Wait();
+    size_t Pending();
+    unsigned int Size() const;
+private:
+    void Run(unsigned int index);
+
+    std::vector<std::thread> threads_;
+    std::deque<std::function<void()>> tasks_;
+    std::mutex lock_;
+    std::condition_variable task_ready_, task_taken_, idle_;
+    size_t max_queue_, active_ = 0;
+    std::string name_;
+    bool stop_ = false;
+};
+
+#endif //STRAWBERRYDATA_WORKERPOOL_H
@@ -0,0 +1,337 @@
+#include <string>
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <iomanip>
+
+#include <opencv2/opencv.hpp>
+#include <librealsense2/rs.hpp>
+#include <json.hpp>
+
+#include <ConfigManager.hpp>
+#include <SyntheticCamera.hpp>
+#include <ImageKernels.hpp>
+#include <WhyConDetector.hpp>
+
+/// Usage:
+///     Times the per frame and per save kernels of RealSenseD400 on fixed frames at the config.json resolutions
+///             ./kernel_benchmark --reps 50 --warmup 5 --output kernels.json
+///             ./kernel_benchmark --bag recording.bag --filter imwrite
+///     A kernel that gets replaced keeps its old entry, register the new one next to it as "<group>/<variant>" so
+///     every run prints the before and after numbers side by side
+
+void PrintHelp() {
+    std::cout << "Options (--name value):\n\t--config <path> (Config file, default ../config.json)" <<
+              "\n\t--bag <path> (Use the first frame set of a recording instead of synthetic frames)" <<
+              "\n\t--warmup <n> (Untimed runs per kernel, default 3)\n\t--reps <n> (Timed runs per kernel, default 30)" <<
+              "\n\t--filter <text> (Only run kernels whose name contains text)" <<
+              "\n\t--save-path <dir> (Scratch directory for written files, default kernel_benchmark_data/)" <<
+              "\n\t--output <path> (JSON results)" << std::endl;
+}
+
+std::map<std::string, std::string> ParseArguments(int argc, char *argv[]) {
+    std::map<std::string, std::string> args = {
+            {"config", "../config.json"}, {"bag", ""}, {"warmup", "3"}, {"reps", "30"}, {"filter", ""},
+            {"save-path", "kernel_benchmark_data/"}, {"output", ""}
+    };
+
+    for (int i = 1; i < argc; ++i) {
+        std::string key(argv[i]);
+        if (key == "--help" || key == "-h" || key.compare(0, 2, "--") != 0 || i + 1 >= argc) {
+            PrintHelp();
+            std::exit(key == "--help" || key == "-h" ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+        args[key.substr(2)] = argv[++i];
+    }
+    return args;
+}
+
+// Exposes a single synthetic frame set without the acquisition loop
+class SyntheticFrames : public SyntheticCamera {
+public:
+    using SyntheticCamera::SyntheticCamera;
+    using SyntheticCamera::NextFrameset;
+};
+
+struct Kernel {
+    std::string name;
+    std::function<void()> run;
+    // Bytes processed per run, used for MB/s (0 to skip)
+    size_t bytes;
+};
+
+struct Result {
+    std::string name;
+    double mean, stddev, min, median, p90, max, megabytes_per_second;
+};
+
+Result Measure(const Kernel &kernel, int warmup, int reps) {
+    for (int i = 0; i < warmup; ++i)
+        kernel.run();
+
+    std::vector<double> samples;
+    samples.reserve(static_cast<size_t>(reps));
+    for (int i = 0; i < reps; ++i) {
+        auto start = std::chrono::steady_clock::now();
+        kernel.run();
+        samples.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+    }
+    std::sort(samples.begin(), samples.end());
+
+    double sum = 0, squares = 0;
+    for (double sample : samples)
+        sum += sample;
+    double mean = sum / samples.size();
+    for (double sample : samples)
+        squares += (sample - mean) * (sample - mean);
+
+    auto percentile = [&samples](double p) {
+        auto rank = static_cast<size_t>(std::ceil(p / 100.0 * samples.size()));
+        return samples[std::max<size_t>(rank, 1) - 1];
+    };
+
+    Result result{kernel.name, mean, samples.size() > 1 ? std::sqrt(squares / (samples.size() - 1)) : 0.0,
+                  samples.front(), percentile(50), percentile(90), samples.back(), 0.0};
+    if (kernel.bytes > 0)
+        result.megabytes_per_second = kernel.bytes / 1e6 / (result.median / 1e3);
+    return result;
+}
+
+int main(int argc, char *argv[]) try {
+    std::map<std::string, std::string> args = ParseArguments(argc, argv);
+    ConfigManager::SetInstance(args["config"]);
+    ConfigManager *config = ConfigManager::GetInstance();
+    config->Set("gui-enabled", false);
+    config->Set("stabilise-exposure", false);
+    config->Set("save-path-prefix", args["save-path"]);
+    config->Set("project-name", std::string("kernels"));
+
+    nlohmann::json depth_config = config->Get("stream-depth");
+    nlohmann::json colour_config = config->Get("stream-colour");
+
+    // Fixed input: one frame set, either generated at the configured resolutions or read from a recording
+    std::unique_ptr<SyntheticFrames> synthetic;
+    rs2::pipeline playback;
+    rs2::frameset frames;
+    if (args["bag"].empty()) {
+        synthetic.reset(new SyntheticFrames("kernels", depth_config["width"], depth_config["height"],
+                                            colour_config["width"], colour_config["height"],
+                                            depth_config["frame-rate"]));
+        frames = synthetic->NextFrameset();
+    } else {
+        rs2::config cfg;
+        cfg.enable_device_from_file(args["bag"], false);
+        playback.start(cfg).get_device().as<rs2::playback>().set_real_time(false);
+        frames = playback.wait_for_frames();
+    }
+
+    rs2::video_frame depth = frames.get_depth_frame(), colour = frames.get_color_frame();
+    rs2::video_frame lir = frames.get_infrared_frame(1), rir = frames.get_infrared_frame(2);
+    rs2::colorizer color_map;
+    rs2::pointcloud pc;
+    rs2::video_frame c_depth = color_map.process(depth);
+    pc.map_to(depth);
+    rs2::points point_cloud = pc.calculate(depth);
+
+    cv::Mat colour_mat(cv::Size(colour.get_width(), colour.get_height()), CV_8UC3, (void *) colour.get_data());
+    cv::Mat depth_mat(cv::Size(depth.get_width(), depth.get_height()), CV_16UC1, (void *) depth.get_data());
+    cv::Mat c_depth_mat(cv::Size(c_depth.get_width(), c_depth.get_height()), CV_8UC3, (void *) c_depth.get_data());
+    cv::Mat lir_mat(cv::Size(lir.get_width(), lir.get_height()), CV_8UC1, (void *) lir.get_data());
+    cv::Mat rir_mat(cv::Size(rir.get_width(), rir.get_height()), CV_8UC1, (void *) rir.get_data());
+    cv::Mat depth_mat_8bit, lrir_mat, cd_depth_mat;
+
+    std::string scratch = args["save-path"];
+    boost::filesystem::create_directories(scratch);
+    auto file_size = [](const std::string &file_name) {
+        return static_cast<size_t>(boost::filesystem::file_size(file_name));
+    };
+    auto image_bytes = [](const cv::Mat &image) { return image.total() * image.elemSize(); };
+
+    // Rolling capture change score, an 8x decimated left IR image against the decimated right IR image
+    const int decimation = 8;
+    std::vector<uint8_t> thumbnail(static_cast<size_t>(lir_mat.cols / decimation) * (lir_mat.rows / decimation));
+    std::vector<uint8_t> reference(thumbnail.size());
+    ImageKernels::Decimate(rir_mat.data, rir_mat.cols, rir_mat.rows, static_cast<int>(rir_mat.step), 1, 0, decimation,
+                           reference.data());
+    double change_score = 0;
+
+    // Quality gate on the green channel of the colour image decimated by 4, depth fill over the full frame
+    const int quality_decimation = 4;
+    int quality_width = colour_mat.cols / quality_decimation, quality_height = colour_mat.rows / quality_decimation;
+    std::vector<uint8_t> quality_thumbnail(static_cast<size_t>(quality_width) * quality_height);
+    ImageKernels::Decimate(colour_mat.data, colour_mat.cols, colour_mat.rows, static_cast<int>(colour_mat.step), 3, 1,
+                           quality_decimation, quality_thumbnail.data());
+    uint32_t histogram[256];
+    double sharpness = 0;
+    size_t depth_valid = 0;
+
+    // Near duplicate hash of the colour green channel decimated by 8
+    int hash_width = colour_mat.cols / 8, hash_height = colour_mat.rows / 8;
+    std::vector<uint8_t> hash_thumbnail(static_cast<size_t>(hash_width) * hash_height);
+    uint64_t image_hash = 0;
+
+    // Offline WhyCon detection (dataset_index whycon) on the left IR image
+    std::vector<uint8_t> marker_mask(lir_mat.total());
+    WhyConDetector detector;
+    size_t markers = 0;
+
+    // Depth fusion of the depth frame above and the next 7, the bytes are every input frame
+    const size_t fusion_frames = 8;
+    std::vector<rs2::frame> fusion_input = {depth};
+    while (fusion_input.size() < fusion_frames) {
+        rs2::frame next = (synthetic ? synthetic->NextFrameset() : playback.wait_for_frames()).get_depth_frame();
+        next.keep();
+        fusion_input.push_back(next);
+    }
+    std::vector<const uint16_t *> fusion_depth;
+    for (rs2::frame &frame : fusion_input)
+        fusion_depth.push_back(static_cast<const uint16_t *>(frame.get_data()));
+    std::vector<float> fusion_sum(depth_mat.total()), fusion_count(depth_mat.total());
+    std::vector<uint16_t> fused(depth_mat.total());
+    auto fuse_mean = [&](bool sse2) {
+        std::fill(fusion_sum.begin(), fusion_sum.end(), 0.0f);
+        std::fill(fusion_count.begin(), fusion_count.end(), 0.0f);
+        for (const uint16_t *frame : fusion_depth)
+            (sse2 ? ImageKernels::AccumulateDepth : ImageKernels::AccumulateDepthScalar)(
+                    frame, fused.size(), 0.02f, fusion_sum.data(), fusion_count.data());
+        (sse2 ? ImageKernels::ResolveDepthMean : ImageKernels::ResolveDepthMeanScalar)(
+                fusion_sum.data(), fusion_count.data(), fused.size(), 2, fused.data());
+    };
+
+    // Kernels in the order RealSenseD400 runs them, per frame (WaitForFrames, Visualise) then per save (WriteData)
+    std::vector<Kernel> kernels = {
+            {"visualise/depth_to_8bit", [&]() {
+                depth_mat.convertTo(depth_mat_8bit, CV_8UC1, 1.0 / 256.0);
+                cv::cvtColor(depth_mat_8bit, depth_mat_8bit, cv::COLOR_GRAY2BGR);
+            }, image_bytes(depth_mat)},
+            {"visualise/hconcat", [&]() {
+                cv::hconcat(lir_mat, rir_mat, lrir_mat);
+                cv::hconcat(depth_mat_8bit, c_depth_mat, cd_depth_mat);
+            }, image_bytes(lir_mat) * 2 + image_bytes(c_depth_mat) * 2},
+            {"frames/colorizer", [&]() { c_depth = color_map.process(depth); }, image_bytes(depth_mat)},
+            {"frames/point_cloud", [&]() {
+                pc.map_to(depth);
+                point_cloud = pc.calculate(depth);
+            }, image_bytes(depth_mat)},
+            {"trigger/decimate", [&]() {
+                ImageKernels::Decimate(lir_mat.data, lir_mat.cols, lir_mat.rows, static_cast<int>(lir_mat.step), 1, 0,
+                                       decimation, thumbnail.data());
+            }, thumbnail.size()},
+            {"trigger/change_score_scalar", [&]() {
+                change_score = ImageKernels::MeanAbsDifferenceScalar(thumbnail.data(), reference.data(),
+                                                                     thumbnail.size());
+            }, thumbnail.size() * 2},
+            {"trigger/change_score_sse2", [&]() {
+                change_score = ImageKernels::MeanAbsDifference(thumbnail.data(), reference.data(), thumbnail.size());
+            }, thumbnail.size() * 2},
+            {"quality/decimate", [&]() {
+                ImageKernels::Decimate(colour_mat.data, colour_mat.cols, colour_mat.rows,
+                                       static_cast<int>(colour_mat.step), 3, 1, quality_decimation,
+                                       quality_thumbnail.data());
+            }, quality_thumbnail.size()},
+            {"quality/laplacian_variance_scalar", [&]() {
+                sharpness = ImageKernels::LaplacianVarianceScalar(quality_thumbnail.data(), quality_width,
+                                                                  quality_height);
+            }, quality_thumbnail.size()},
+            {"quality/laplacian_variance_sse2", [&]() {
+                sharpness = ImageKernels::LaplacianVariance(quality_thumbnail.data(), quality_width, quality_height);
+            }, quality_thumbnail.size()},
+            {"quality/histogram", [&]() {
+                ImageKernels::Histogram(quality_thumbnail.data(), quality_thumbnail.size(), histogram);
+            }, quality_thumbnail.size()},
+            {"quality/depth_valid_scalar", [&]() {
+                depth_valid = ImageKernels::CountNonZeroScalar(depth_mat.ptr<uint16_t>(), depth_mat.cols,
+                                                               depth_mat.rows, static_cast<int>(depth_mat.step));
+            }, image_bytes(depth_mat)},
+            {"quality/depth_valid_sse2", [&]() {
+                depth_valid = ImageKernels::CountNonZero(depth_mat.ptr<uint16_t>(), depth_mat.cols, depth_mat.rows,
+                                                         static_cast<int>(depth_mat.step));
+            }, image_bytes(depth_mat)},
+            {"duplicate/difference_hash", [&]() {
+                ImageKernels::Decimate(colour_mat.data, colour_mat.cols, colour_mat.rows,
+                                       static_cast<int>(colour_mat.step), 3, 1, 8, hash_thumbnail.data());
+                image_hash = ImageKernels::DifferenceHash(hash_thumbnail.data(), hash_width, hash_height);
+            }, hash_thumbnail.size()},
+            {"whycon/threshold_scalar", [&]() {
+                ImageKernels::ThresholdScalar(lir_mat.data, lir_mat.cols, lir_mat.rows,
+                                              static_cast<int>(lir_mat.step), 128, marker_mask.data());
+            }, image_bytes(lir_mat)},
+            {"whycon/threshold_sse2", [&]() {
+                ImageKernels::Threshold(lir_mat.data, lir_mat.cols, lir_mat.rows, static_cast<int>(lir_mat.step),
+                                        128, marker_mask.data());
+            }, image_bytes(lir_mat)},
+            {"whycon/detect", [&]() {
+                markers = detector.Detect(lir_mat.data, lir_mat.cols, lir_mat.rows,
+                                          static_cast<int>(lir_mat.step)).size();
+            }, image_bytes(lir_mat)},
+            {"fusion/median_scalar", [&]() {
+                ImageKernels::MedianDepthScalar(fusion_depth.data(), static_cast<int>(fusion_frames), fused.size(), 2,
+                                                fused.data());
+            }, image_bytes(depth_mat) * fusion_frames},
+            {"fusion/median_sse2", [&]() {
+                ImageKernels::MedianDepth(fusion_depth.data(), static_cast<int>(fusion_frames), fused.size(), 2,
+                                          fused.data());
+            }, image_bytes(depth_mat) * fusion_frames},
+            {"fusion/mean_scalar", [&]() { fuse_mean(false); }, image_bytes(depth_mat) * fusion_frames},
+            {"fusion/mean_sse2", [&]() { fuse_mean(true); }, image_bytes(depth_mat) * fusion_frames},
+            {"imwrite/depth", [&]() { cv::imwrite(scratch + "depth.png", depth_mat); }, image_bytes(depth_mat)},
+            {"imwrite/coloured_depth", [&]() { cv::imwrite(scratch + "coloured_depth.png", c_depth_mat); },
+             image_bytes(c_depth_mat)},
+            {"imwrite/colour", [&]() { cv::imwrite(scratch + "colour.png", colour_mat); }, image_bytes(colour_mat)},
+            {"imwrite/ir_left", [&]() { cv::imwrite(scratch + "ir_left.png", lir_mat); }, image_bytes(lir_mat)},
+            {"imwrite/ir_right", [&]() { cv::imwrite(scratch + "ir_right.png", rir_mat); }, image_bytes(rir_mat)},
+            {"export_to_ply", [&]() { point_cloud.export_to_ply(scratch + "point_cloud.ply", colour); }, 0},
+    };
+
+    int warmup = std::stoi(args["warmup"]), reps = std::stoi(args["reps"]);
+    std::cout << "Input: " << (args["bag"].empty() ? "synthetic" : args["bag"]) << ", depth " << depth.get_width()
+              << "x" << depth.get_height() << ", colour " << colour.get_width() << "x" << colour.get_height()
+              << ", " << warmup << " warmup, " << reps << " reps\n";
+    std::cout << std::left << std::setw(36) << "Kernel" << std::right << std::setw(10) << "Mean" << std::setw(10)
+              << "Stddev" << std::setw(10) << "Min" << std::setw(10) << "Median" << std::setw(10) << "P90"
+              << std::setw(10) << "Max" << std::setw(10) << "MB/s" << " (ms)" << std::endl;
+
+    nlohmann::json results;
+    results["input"] = {{"source", args["bag"].empty() ? "synthetic" : args["bag"]},
+                        {"depth", {depth.get_width(), depth.get_height()}},
+                        {"colour", {colour.get_width(), colour.get_height()}}, {"warmup", warmup}, {"reps", reps}};
+    for (auto &kernel : kernels) {
+        if (kernel.name.find(args["filter"]) == std::string::npos)
+            continue;
+
+        Result result = Measure(kernel, warmup, reps);
+        std::cout << std::left << std::setw(36) << result.name << std::right << std::fixed << std::setprecision(3)
+                  << std::setw(10) << result.mean << std::setw(10) << result.stddev << std::setw(10) << result.min
+                  << std::setw(10) << result.median << std::setw(10) << result.p90 << std::setw(10) << result.max
+                  << std::setprecision(1) << std::setw(10) << result.megabytes_per_second << std::endl;
+
+        results["kernels"][result.name] = {{"mean-ms", result.mean}, {"stddev-ms", result.stddev},
+                                           {"min-ms", result.min}, {"median-ms", result.median},
+                                           {"p90-ms", result.p90}, {"max-ms", result.max},
+                                           {"megabytes-per-second", result.megabytes_per_second}};
+    }
+
+    // Encoded sizes give the compression ratio behind the imwrite numbers
+    for (auto &name : {"depth", "coloured_depth", "colour", "ir_left", "ir_right"}) {
+        std::string file_name = scratch + name + ".png";
+        if (boost::filesystem::exists(file_name))
+            results["encoded-bytes"][name] = file_size(file_name);
+    }
+
+    if (!args["output"].empty()) {
+        std::ofstream out(args["output"]);
+        out << results.dump(4) << std::endl;
+        std::cout << "Results written to " << args["output"] << std::endl;
+    }
+
+    return EXIT_SUCCESS;
+}
+catch (const rs2::error &e) {
+    std::cerr << "RealSense error calling " << e.get_failed_function() << "(" << e.get_failed_args() << "):\n    "
+              << e.what() << std::endl;
+    return EXIT_FAILURE;
+}
+catch (const std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    return EXIT_FAILURE;
+}
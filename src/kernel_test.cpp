@@ -0,0 +1,380 @@
+#include <string>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+#include <json.hpp>
+
+#include <ImageKernels.hpp>
+#include <QualityGate.hpp>
+#include <Settings.hpp>
+#include <SimilarityIndex.hpp>
+
+/// Usage:
+///     Checks the SIMD kernels against their scalar versions on random and edge case inputs (every tail length, all
+///     zero and saturated values) and on hand worked inputs, CaptureSettings::Parse error reporting, the QualityGate
+///     wait and skip decisions and SimilarityIndex::Query against a linear scan. Prints each failure and exits non zero when any check failed
+///             ./kernel_test
+///             ctest --output-on-failure
+
+namespace {
+    int failures = 0, checks = 0;
+
+    void Check(bool passed, const std::string &what) {
+        ++checks;
+        if (!passed) {
+            ++failures;
+            std::cerr << "FAILED: " << what << std::endl;
+        }
+    }
+
+    bool Near(double a, double b) {
+        return std::abs(a - b) <= 1e-9 * std::max(1.0, std::max(std::abs(a), std::abs(b)));
+    }
+
+    std::string Size(int width, int height) {
+        return " at " + std::to_string(width) + "x" + std::to_string(height);
+    }
+
+    std::mt19937 rng(42);
+
+    // Random values, or one of the edge patterns every SIMD lane has to agree on
+    template<typename T>
+    std::vector<T> Fill(size_t size, int pattern, T max) {
+        std::vector<T> values(size);
+        std::uniform_int_distribution<int> random(0, max);
+        for (size_t i = 0; i < size; ++i)
+            values[i] = static_cast<T>(pattern == 0 ? random(rng) : pattern == 1 ? 0 : pattern == 2 ? max :
+                                       (i % 3 == 0 ? 0 : random(rng)));
+        return values;
+    }
+
+    // Widths around the 8 and 16 pixel vector widths, so every tail length is covered
+    const std::vector<int> kWidths = {1, 2, 3, 7, 8, 9, 15, 16, 17, 23, 31, 33, 64, 67};
+    const std::vector<int> kHeights = {1, 3, 4, 9};
+    const int kPatterns = 4;
+
+    void TestImageKernels() {
+        for (int width : kWidths) {
+            for (int height : kHeights) {
+                for (int pattern = 0; pattern < kPatterns; ++pattern) {
+                    size_t size = static_cast<size_t>(width) * height;
+                    std::string at = Size(width, height) + " pattern " + std::to_string(pattern);
+                    std::vector<uint8_t> a = Fill<uint8_t>(size, pattern, 255), b = Fill<uint8_t>(size, 0, 255);
+
+                    Check(Near(ImageKernels::MeanAbsDifference(a.data(), b.data(), size),
+                               ImageKernels::MeanAbsDifferenceScalar(a.data(), b.data(), size)),
+                          "MeanAbsDifference" + at);
+                    Check(Near(ImageKernels::LaplacianVariance(a.data(), width, height),
+                               ImageKernels::LaplacianVarianceScalar(a.data(), width, height)),
+                          "LaplacianVariance" + at);
+
+                    // A padded stride checks the kernels do not read or write past each row
+                    int stride = width + 5;
+                    std::vector<uint8_t> padded = Fill<uint8_t>(static_cast<size_t>(stride) * height, pattern, 255);
+                    for (int level : {0, 1, 127, 254, 255}) {
+                        std::vector<uint8_t> simd(size, 7), scalar(size, 7);
+                        ImageKernels::Threshold(padded.data(), width, height, stride, static_cast<uint8_t>(level),
+                                                simd.data());
+                        ImageKernels::ThresholdScalar(padded.data(), width, height, stride,
+                                                      static_cast<uint8_t>(level), scalar.data());
+                        Check(simd == scalar, "Threshold level " + std::to_string(level) + at);
+                    }
+
+                    std::vector<uint16_t> depth = Fill<uint16_t>(static_cast<size_t>(stride) * height, pattern,
+                                                                 65535);
+                    int depth_stride = stride * static_cast<int>(sizeof(uint16_t));
+                    Check(ImageKernels::CountNonZero(depth.data(), width, height, depth_stride) ==
+                          ImageKernels::CountNonZeroScalar(depth.data(), width, height, depth_stride),
+                          "CountNonZero" + at);
+                }
+            }
+        }
+    }
+
+    void TestFusion() {
+        for (int width : kWidths) {
+            for (int frame_count : {1, 2, 3, 4, 7, 8, ImageKernels::kMaxMedianFrames}) {
+                size_t size = static_cast<size_t>(width) * 3;
+                std::string at = Size(width, 3) + " of " + std::to_string(frame_count) + " frames";
+
+                // Invalid (0) pixels and saturated ones mixed in, so min_count and the tolerance both matter
+                std::vector<std::vector<uint16_t>> frames;
+                for (int frame = 0; frame < frame_count; ++frame)
+                    frames.push_back(Fill<uint16_t>(size, frame % kPatterns, 65535));
+                std::vector<const uint16_t *> pointers;
+                for (auto &frame : frames)
+                    pointers.push_back(frame.data());
+
+                for (int min_count = 1; min_count <= frame_count + 1; min_count += std::max(1, frame_count / 2)) {
+                    std::vector<uint16_t> simd(size, 1), scalar(size, 2);
+                    ImageKernels::MedianDepth(pointers.data(), frame_count, size, min_count, simd.data());
+                    ImageKernels::MedianDepthScalar(pointers.data(), frame_count, size, min_count, scalar.data());
+                    Check(simd == scalar, "MedianDepth min count " + std::to_string(min_count) + at);
+                }
+
+                for (float tolerance : {0.0f, 0.02f, 1.0f}) {
+                    std::vector<float> sum(size, 0), count(size, 0), scalar_sum(size, 0), scalar_count(size, 0);
+                    for (auto &frame : frames) {
+                        ImageKernels::AccumulateDepth(frame.data(), size, tolerance, sum.data(), count.data());
+                        ImageKernels::AccumulateDepthScalar(frame.data(), size, tolerance, scalar_sum.data(),
+                                                            scalar_count.data());
+                    }
+                    std::string with = " tolerance " + std::to_string(tolerance) + at;
+                    Check(sum == scalar_sum && count == scalar_count, "AccumulateDepth" + with);
+
+                    for (int min_count : {1, 2, frame_count}) {
+                        std::vector<uint16_t> simd(size, 1), scalar(size, 2);
+                        ImageKernels::ResolveDepthMean(sum.data(), count.data(), size, min_count, simd.data());
+                        ImageKernels::ResolveDepthMeanScalar(scalar_sum.data(), scalar_count.data(), size, min_count,
+                                                             scalar.data());
+                        Check(simd == scalar, "ResolveDepthMean min count " + std::to_string(min_count) + with);
+                    }
+                }
+            }
+        }
+    }
+
+    // Hand worked inputs, so a bug shared by the SIMD and scalar versions still fails. Sizes are picked to take the
+    // vector path with a tail as well as the scalar one
+    void TestKnownAnswers() {
+        for (int width : {17, 35}) {
+            std::string at = Size(width, 5);
+            std::vector<uint8_t> flat(static_cast<size_t>(width) * 5, 128), ramp(flat.size());
+            for (size_t i = 0; i < ramp.size(); ++i)
+                ramp[i] = static_cast<uint8_t>(i % width);
+            Check(ImageKernels::LaplacianVariance(flat.data(), width, 5) == 0 &&
+                  ImageKernels::LaplacianVarianceScalar(flat.data(), width, 5) == 0, "flat LaplacianVariance" + at);
+            Check(ImageKernels::LaplacianVariance(ramp.data(), width, 5) == 0, "linear ramp LaplacianVariance" + at);
+        }
+
+        // One spike of 10 in a 20x3 image: Laplacians 40 and -10 among 18 interior pixels, variance 850/9 - 25/9
+        std::vector<uint8_t> spike(60, 0);
+        spike[21] = 10;
+        Check(Near(ImageKernels::LaplacianVariance(spike.data(), 20, 3), 825.0 / 9), "spike LaplacianVariance");
+
+        // Pixel values 0, 3, 1, 2 over four frames: three valid, median 2. A fourth valid value gives the rounded up
+        // mean of the middle two, fewer valid values than min_count give 0
+        for (size_t size : {size_t(1), size_t(17)}) {
+            std::string at = " over " + std::to_string(size) + " pixels";
+            auto median = [size](std::vector<uint16_t> values, int min_count) {
+                std::vector<std::vector<uint16_t>> frames;
+                std::vector<const uint16_t *> pointers;
+                for (uint16_t value : values)
+                    frames.emplace_back(size, value);
+                for (auto &frame : frames)
+                    pointers.push_back(frame.data());
+                std::vector<uint16_t> dst(size, 7);
+                ImageKernels::MedianDepth(pointers.data(), static_cast<int>(pointers.size()), size, min_count,
+                                          dst.data());
+                return std::all_of(dst.begin(), dst.end(), [&dst](uint16_t v) { return v == dst[0]; }) ? dst[0] : -1;
+            };
+            Check(median({0, 3, 1, 2}, 2) == 2, "median of {0, 3, 1, 2} with min count 2" + at);
+            Check(median({0, 3, 1, 2}, 4) == 0, "median of {0, 3, 1, 2} with min count 4" + at);
+            Check(median({4, 3, 1, 2}, 2) == 3, "median of {4, 3, 1, 2}" + at);
+
+            // 1000 and 1010 agree within 2%, 5000 is rejected as an outlier and 0 is invalid: mean 1005 of 2
+            std::vector<float> sum(size, 0), count(size, 0);
+            for (uint16_t value : {1000, 0, 1010, 5000}) {
+                std::vector<uint16_t> frame(size, value);
+                ImageKernels::AccumulateDepth(frame.data(), size, 0.02f, sum.data(), count.data());
+            }
+            std::vector<uint16_t> mean(size, 7), strict(size, 7);
+            ImageKernels::ResolveDepthMean(sum.data(), count.data(), size, 2, mean.data());
+            ImageKernels::ResolveDepthMean(sum.data(), count.data(), size, 3, strict.data());
+            Check(mean == std::vector<uint16_t>(size, 1005), "mean with an outlier rejected" + at);
+            Check(strict == std::vector<uint16_t>(size, 0), "mean with fewer inliers than min count" + at);
+        }
+
+        // Neighbouring cells compare left < right, so a rising ramp sets all 64 bits and a flat or falling one none
+        std::vector<uint8_t> flat(36 * 16, 90), rising(flat.size()), falling(flat.size());
+        for (size_t i = 0; i < flat.size(); ++i) {
+            rising[i] = static_cast<uint8_t>(i % 36 * 7);
+            falling[i] = static_cast<uint8_t>(255 - i % 36 * 7);
+        }
+        Check(ImageKernels::DifferenceHash(flat.data(), 36, 16) == 0, "flat DifferenceHash");
+        Check(ImageKernels::DifferenceHash(rising.data(), 36, 16) == ~0ull, "rising DifferenceHash");
+        Check(ImageKernels::DifferenceHash(falling.data(), 36, 16) == 0, "falling DifferenceHash");
+        Check(ImageKernels::DifferenceHash(rising.data(), 8, 8) == 0, "DifferenceHash below 9x8");
+        Check(ImageKernels::HammingDistance(0, ~0ull) == 64 && ImageKernels::HammingDistance(5, 6) == 2,
+              "HammingDistance");
+
+        // 1027 = 4 * 256 + 3 values counting up, the first three bins get the extra one
+        std::vector<uint8_t> counting(1027);
+        for (size_t i = 0; i < counting.size(); ++i)
+            counting[i] = static_cast<uint8_t>(i);
+        uint32_t histogram[256];
+        ImageKernels::Histogram(counting.data(), counting.size(), histogram);
+        bool counted = true;
+        for (int bin = 0; bin < 256; ++bin)
+            counted = counted && histogram[bin] == (bin < 3 ? 5u : 4u);
+        Check(counted, "Histogram");
+
+        // Green of a 6x4 BGR image with a 20 byte stride, every second pixel of every second row
+        std::vector<uint8_t> bgr(20 * 4);
+        std::iota(bgr.begin(), bgr.end(), 0);
+        std::vector<uint8_t> decimated(6, 0);
+        ImageKernels::Decimate(bgr.data(), 6, 4, 20, 3, 1, 2, decimated.data());
+        Check(decimated == std::vector<uint8_t>({1, 7, 13, 41, 47, 53}), "Decimate");
+    }
+
+    // The message Parse throws for config, empty when it is accepted
+    std::string ParseError(const nlohmann::json &config) {
+        try {
+            CaptureSettings::Parse(config);
+        } catch (const std::invalid_argument &e) {
+            return e.what();
+        }
+        return "";
+    }
+
+    bool Contains(const std::string &text, const std::string &part) {
+        return text.find(part) != std::string::npos;
+    }
+
+    void TestSettings() {
+        nlohmann::json valid = {
+                {"stream-depth", {{"width", 848}, {"height", 480}, {"frame-rate", 30}}},
+                {"depth-fusion", {{"enabled", true}, {"frames", 4}, {"method", "mean"}}},
+                {"exposure-bracket", {{"exposures", {10, 40}}}},
+                {"camera-overrides", {{"8224", {{"stream-depth", {{"frame-rate", 15}}}}}}}
+        };
+        Check(ParseError(valid).empty(), "Parse rejected a valid config: " + ParseError(valid));
+        CaptureSettings settings = CaptureSettings::Parse(valid);
+        Check(settings.Defaults().depth.frame_rate == 30 && settings.Camera("8224").depth.frame_rate == 15 &&
+              settings.Camera("8224").depth.width == 848, "camera-overrides merged into the global settings");
+        Check(settings.Defaults().fusion.enabled && !settings.Defaults().fusion.median &&
+              settings.Defaults().fusion.frames == 4, "depth-fusion read");
+        Check(settings.Defaults().bracket.exposures == std::vector<double>({10, 40}), "exposure-bracket read");
+        Check(settings.Defaults().colour.frame_rate == 6, "missing settings keep their defaults");
+
+        // Every problem is listed in one message, not only the first
+        nlohmann::json invalid = {
+                {"stream-depth", {{"width", "848"}, {"frame-rate", 0}}},
+                {"options", {{"auto-exposur", true}}},
+                {"depth-fusion", {{"method", "average"}}},
+                {"exposure-bracket", {{"exposures", nlohmann::json::array()}}},
+                {"cameras", {{"virtual", {{{"type", "bag"}}}}}},
+                {"camera-overrides", {{"8224", {{"depth-fusion", {{"enabled", true}}}}}}}
+        };
+        std::string error = ParseError(invalid);
+        Check(Contains(error, "stream-depth.width: expected an integer"), "wrong type reported: " + error);
+        Check(Contains(error, "stream-depth.frame-rate: expected 1 to 300"), "out of range reported: " + error);
+        Check(Contains(error, "options.auto-exposur: unknown setting"), "unknown key reported: " + error);
+        Check(Contains(error, "depth-fusion.method: expected 'median' or 'mean'"), "bad choice reported: " + error);
+        Check(Contains(error, "exposure-bracket.exposures: expected a list"), "empty list reported: " + error);
+        Check(Contains(error, "cameras.virtual.0.path"), "bag camera without a path reported: " + error);
+        Check(Contains(error, "camera-overrides.8224.depth-fusion: can not be set per camera"),
+              "global only setting in an override reported: " + error);
+
+        Check(!ParseError(nlohmann::json::array()).empty(), "a config that is not an object is rejected");
+        nlohmann::json bad_override = {{"camera-overrides", {{"8224", {{"stream-colour", {{"width", -1}}}}}}}};
+        Check(Contains(ParseError(bad_override), "camera-overrides.8224.stream-colour.width"),
+              "override problems are prefixed with the serial number");
+    }
+
+    void TestQualityGate() {
+        using Decision = QualityGate::Decision;
+        auto start = std::chrono::steady_clock::now();
+        auto at = [start](int ms) { return start + std::chrono::milliseconds(ms); };
+
+        QualityGate record(QualityGate::Policy::RECORD, 300);
+        Check(record.Evaluate(true, false, at(0)) == Decision::SAVE, "record saves a failing frame");
+
+        for (auto policy : {QualityGate::Policy::WAIT, QualityGate::Policy::SKIP}) {
+            std::string name = policy == QualityGate::Policy::WAIT ? "wait" : "skip";
+            Decision expired = policy == QualityGate::Policy::WAIT ? Decision::SAVE : Decision::SKIP;
+            QualityGate gate(policy, 300);
+            Check(gate.Evaluate(false, false, at(0)) == Decision::NONE, name + ": no trigger, nothing to do");
+            Check(gate.Evaluate(true, true, at(0)) == Decision::SAVE, name + ": a passing frame saves");
+            Check(gate.Evaluate(true, false, at(10)) == Decision::HOLD, name + ": a failing frame is held");
+            Check(gate.Evaluate(true, false, at(200)) == Decision::HOLD, name + ": held within wait-ms");
+            Check(gate.Evaluate(true, true, at(250)) == Decision::SAVE, name + ": a frame passing in the wait saves");
+            Check(gate.Evaluate(true, false, at(1000)) == Decision::HOLD, name + ": the next trigger waits again");
+            Check(gate.Evaluate(true, false, at(1300)) == expired, name + ": the wait runs out");
+
+            // A trigger going away must not leave its wait running for the next one
+            Check(gate.Evaluate(true, false, at(2000)) == Decision::HOLD, name + ": held before the trigger goes");
+            Check(gate.Evaluate(false, false, at(2100)) == Decision::NONE && !gate.Waiting(),
+                  name + ": a trigger going away clears the wait");
+            Check(gate.Evaluate(true, false, at(60000)) == Decision::HOLD,
+                  name + ": a later trigger gets the full wait");
+            gate.Reset();
+            Check(gate.Evaluate(true, false, at(90000)) == Decision::HOLD, name + ": Reset clears the wait");
+        }
+    }
+
+    void TestSimilarityIndex() {
+        // Groups of near duplicates around a few random hashes, plus repeated hashes
+        std::uniform_int_distribution<uint64_t> random_hash;
+        std::uniform_int_distribution<int> random_bit(0, 63), random_flips(0, 12);
+        std::vector<uint64_t> hashes;
+        for (int group = 0; group < 40; ++group) {
+            uint64_t centre = random_hash(rng);
+            for (int member = 0; member < 25; ++member) {
+                uint64_t hash = centre;
+                for (int flip = random_flips(rng); flip > 0; --flip)
+                    hash ^= 1ull << random_bit(rng);
+                hashes.push_back(hash);
+            }
+            hashes.push_back(centre);
+        }
+
+        for (int max_radius : {0, 4, 8}) {
+            SimilarityIndex index;
+            for (size_t i = 0; i < hashes.size(); ++i)
+                index.Insert(hashes[i], i);
+            index.Build(max_radius);
+            Check(index.Size() == hashes.size(), "SimilarityIndex size");
+
+            // Radii above max_radius take the linear fallback, both paths have to match the scan
+            for (int radius : {0, 1, 3, 4, 6, 8, 12, 64}) {
+                for (size_t query = 0; query < hashes.size(); query += 37) {
+                    std::vector<std::pair<int, size_t>> expected, found;
+                    for (size_t i = 0; i < hashes.size(); ++i) {
+                        int distance = ImageKernels::HammingDistance(hashes[query], hashes[i]);
+                        if (distance <= radius)
+                            expected.emplace_back(distance, i);
+                    }
+                    std::vector<SimilarityIndex::Match> matches = index.Query(hashes[query], radius);
+                    bool ordered = std::is_sorted(matches.begin(), matches.end(),
+                                                  [](const SimilarityIndex::Match &a, const SimilarityIndex::Match &b) {
+                                                      return a.distance < b.distance;
+                                                  });
+                    for (auto &match : matches)
+                        found.emplace_back(match.distance, match.id);
+                    std::sort(expected.begin(), expected.end());
+                    std::sort(found.begin(), found.end());
+                    Check(ordered && found == expected, "SimilarityIndex::Query radius " + std::to_string(radius) +
+                                                        " built for " + std::to_string(max_radius));
+                }
+            }
+
+            bool rejected = false;
+            try {
+                index.Cluster(-1);
+            } catch (const std::invalid_argument &) {
+                rejected = true;
+            }
+            Check(rejected, "SimilarityIndex::Cluster rejects a negative radius");
+        }
+    }
+}
+
+int main() {
+    TestImageKernels();
+    TestFusion();
+    TestKnownAnswers();
+    TestSettings();
+    TestQualityGate();
+    TestSimilarityIndex();
+
+    std::cout << checks - failures << " of " << checks << " checks passed" << std::endl;
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}